@@ -0,0 +1,200 @@
+#include "benchmark.h"
+#include "pico.h"
+#include "drv8825.h"
+#include "jobs.h"
+#include "profile.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+
+// Target rates (full steps per second) and accelerations (full steps per second^2) swept on every axis
+static const double benchmark_rates[] = { 100, 200, 400, 800, 1600, 3200, 6400 };
+static const double benchmark_accelerations[] = { 500, 2000, 8000 };
+
+#define BENCHMARK_RATE_COUNT            (sizeof(benchmark_rates) / sizeof(benchmark_rates[0]))
+#define BENCHMARK_ACCELERATION_COUNT    (sizeof(benchmark_accelerations) / sizeof(benchmark_accelerations[0]))
+
+// Benchmark State
+static bool benchmark_running;
+// The run being measured
+static uint8_t benchmark_axis, benchmark_acceleration, benchmark_rate;
+static bool benchmark_queued;
+// What the queued run should take if every step period is exactly as planned
+static uint32_t benchmark_planned_us, benchmark_pulses;
+
+
+// Queue a constant rate node on the axis in the finest mode. Returns the time it is planned to take
+static uint32_t benchmark_queue_node(DRV_DRIVER axis, bool dir, uint32_t pulses, double rate)
+{
+    uint8_t mode_pins = drv_mode_pins(DRV_MODE_COUNT - 1);
+    double delay = DRV_MIN_STEP * 1e6 / (2 * rate);
+    uint16_t step_delay_us = delay > 0xFFFF ? 0xFFFF : (uint16_t)ceil(delay);
+    if(step_delay_us < DRV_STEP_DELAY_US) step_delay_us = DRV_STEP_DELAY_US;
+
+    // Queued as is (the net movement of a run is nothing so the pending location doesn't change)
+    drv_queue_node_t node = {
+        .mode_0 = GET_BIT_N(mode_pins, 0),
+        .mode_1 = GET_BIT_N(mode_pins, 1),
+        .mode_2 = GET_BIT_N(mode_pins, 2),
+        .step_delay_us = step_delay_us,
+    };
+    node.steps[axis] = pulses;
+    node.dir[axis] = dir;
+    drv_queue_node(&node);
+
+    benchmark_pulses += pulses;
+    return pulses * (2 * step_delay_us + DRV_STEP_PERIOD_EXTRA_US);
+}
+
+// Queue a change of rate at the acceleration as a few constant rate nodes. Returns the time it is planned to take
+static uint32_t benchmark_queue_ramp(DRV_DRIVER axis, bool dir, double from_rate, double to_rate, double acceleration)
+{
+    uint32_t planned_us = 0;
+    for(uint8_t i = 0; i < BENCHMARK_RAMP_SEGMENTS; i++)
+    {
+        double start_rate = from_rate + (to_rate - from_rate) * i / BENCHMARK_RAMP_SEGMENTS;
+        double end_rate = from_rate + (to_rate - from_rate) * (i + 1) / BENCHMARK_RAMP_SEGMENTS;
+
+        // Distance (full steps) to get from one rate to the other at the acceleration
+        double distance = fabs(end_rate * end_rate - start_rate * start_rate) / (2 * acceleration);
+        uint32_t pulses = (uint32_t)ceil(distance / DRV_MIN_STEP);
+        if(!pulses) pulses = 1;
+
+        planned_us += benchmark_queue_node(axis, dir, pulses, (start_rate + end_rate) / 2);
+    }
+    return planned_us;
+}
+
+// Queue the run there and back or report why it can't be done. Returns true if it was queued
+static bool benchmark_queue_run(void)
+{
+    DRV_DRIVER axis = (DRV_DRIVER)benchmark_axis;
+    double rate = benchmark_rates[benchmark_rate], acceleration = benchmark_accelerations[benchmark_acceleration];
+
+    printf("bench axis=%c accel=%g rate=%g ", toupper(drv_axes[axis].name), acceleration, rate);
+
+    // Ramping up and down covers rate^2 / acceleration. The ramps round up to whole pulses
+    double travel = rate * rate / acceleration + BENCHMARK_CRUISE_STEPS + 2 * BENCHMARK_RAMP_SEGMENTS * DRV_MIN_STEP;
+    double available = machine_profile.max_steps[axis] - pico_state.drv_location_pending[axis];
+
+    if(DRV_MIN_STEP * 1e6 / (2 * rate) < DRV_STEP_DELAY_US)
+    {
+        printf("skipped (faster than the driver)\n");
+        return false;
+    }
+    if(travel > available)
+    {
+        printf("skipped (needs %.0f steps of travel)\n", ceil(travel));
+        return false;
+    }
+
+    pico_state.step_loop_pulses = 0;
+    pico_state.step_loop_us = 0;
+    pico_state.step_loop_wait_us = 0;
+    benchmark_pulses = 0;
+    benchmark_planned_us = 0;
+
+    uint32_t cruise_pulses = (uint32_t)(BENCHMARK_CRUISE_STEPS / DRV_MIN_STEP);
+    for(uint8_t i = 0; i < 2; i++)
+    {
+        bool dir = !i; // Out then back
+        benchmark_planned_us += benchmark_queue_ramp(axis, dir, 0, rate, acceleration);
+        benchmark_planned_us += benchmark_queue_node(axis, dir, cruise_pulses, rate);
+        benchmark_planned_us += benchmark_queue_ramp(axis, dir, rate, 0, acceleration);
+    }
+    return true;
+}
+
+// Report the run that just finished
+static void benchmark_report(void)
+{
+    uint32_t took_us = pico_state.step_loop_us ? pico_state.step_loop_us : 1;
+
+    // How close the step loop got to the planned timing and how much of the time it spent waiting out step periods
+    printf("pulses=%lu planned=%luus took=%luus speed=%lu%% headroom=%lu%%",
+        pico_state.step_loop_pulses, benchmark_planned_us, took_us,
+        (uint32_t)((uint64_t)benchmark_planned_us * 100 / took_us),
+        (uint32_t)((uint64_t)pico_state.step_loop_wait_us * 100 / took_us));
+    if(pico_state.step_loop_pulses != benchmark_pulses)
+        printf(" (expected %lu pulses)", benchmark_pulses);
+    printf("\n");
+}
+
+// Move on to the next run. Returns false once every axis has been swept
+static bool benchmark_next(void)
+{
+    if(++benchmark_rate < BENCHMARK_RATE_COUNT)
+        return true;
+    benchmark_rate = 0;
+    if(++benchmark_acceleration < BENCHMARK_ACCELERATION_COUNT)
+        return true;
+    benchmark_acceleration = 0;
+    return ++benchmark_axis < DRV_AXIS_COUNT;
+}
+
+bool benchmark_start(void)
+{
+    if(benchmark_running || job_is_recording() || job_is_replaying() || pico_state.aborting ||
+        !queue_is_idle(&pico_state.step_queue))
+        return false;
+
+    // Every run starts from the origin so it has the whole travel of the axis
+    if(!drv_go_to_axes(machine_profile.min_steps))
+        return false;
+
+    printf("bench driver=%s mode=1/%.0f cruise=%d steps feed=%d%%\n",
+        DRV_NAME, 1 / DRV_MIN_STEP, BENCHMARK_CRUISE_STEPS, pico_state.feed_override);
+
+    benchmark_axis = benchmark_acceleration = benchmark_rate = 0;
+    benchmark_queued = false;
+    benchmark_running = true;
+    return true;
+}
+
+void benchmark_service(void)
+{
+    if(!benchmark_running)
+        return;
+
+    // Wait for the last run (or the move to the origin) to finish. Without the queue lock as this runs in the main loop,
+    // which the UART interrupt can interrupt while it holds it
+    if(!queue_is_idle(&pico_state.step_queue))
+        return;
+
+    if(benchmark_queued)
+    {
+        benchmark_report();
+        benchmark_queued = false;
+        if(!benchmark_next())
+        {
+            printf("bench done\n");
+            benchmark_stop();
+            return;
+        }
+    }
+
+    // Runs that can't be done are reported and skipped straight away.
+    // The UART interrupt is held off while the run is queued as it queues movements too (see pico_uart_irq_pause)
+    pico_uart_irq_pause(true);
+    while(!(benchmark_queued = benchmark_queue_run()))
+    {
+        if(!benchmark_next())
+        {
+            printf("bench done\n");
+            benchmark_stop();
+            break;
+        }
+    }
+    pico_uart_irq_pause(false);
+}
+
+void benchmark_stop(void)
+{
+    benchmark_running = false;
+    benchmark_queued = false;
+}
+
+bool benchmark_is_running(void)
+{
+    return benchmark_running;
+}
@@ -0,0 +1,26 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdbool.h>
+
+// On-Device Step Rate Benchmark
+// Sweeps the step rate and acceleration of each axis over a fixed pattern and reports how close the step loop
+// got to the planned timing and how much of each step period it spent waiting (CPU headroom) over UART.
+// Every run ramps up, cruises and ramps down in the finest mode then does the same back to where it started.
+// Watch the machine while it runs, the fastest run that didn't stall or skip is the safe max rate of that axis
+
+// Full steps each run cruises for at the target rate (each way)
+#define BENCHMARK_CRUISE_STEPS      10
+// Constant rate nodes each acceleration ramp is made of
+#define BENCHMARK_RAMP_SEGMENTS     8
+
+// Move to the origin and start the benchmark. Fails while anything else is moving, recording or replaying
+bool benchmark_start(void);
+// Queue the next run once the last one has finished and report it. Should be called often while benchmarking
+void benchmark_service(void);
+// Stop after the current run (Already queued runs still execute)
+void benchmark_stop(void);
+// Is the benchmark running
+bool benchmark_is_running(void);
+
+#endif // BENCHMARK_H
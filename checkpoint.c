@@ -0,0 +1,258 @@
+#include "checkpoint.h"
+#include "pico.h"
+#include "hardware/sync.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Tracking State
+static uint32_t checkpoint_job_id;
+static bool checkpoint_tracking;
+// pico_state.sequence when tracking started, the amount of the job's movements that were done by then
+// and where the queued movements were going to leave the axes
+static uint32_t checkpoint_base, checkpoint_resume_from;
+static double checkpoint_start[DRV_AXIS_COUNT];
+
+// The checkpoint that was saved before the last restart (What $restore goes back to)
+static checkpoint_record_t checkpoint_loaded;
+static bool checkpoint_loaded_valid;
+
+// Saved State. What was last saved, the record slot the next checkpoint goes into and the number it is given
+static uint32_t checkpoint_saved_job_id, checkpoint_saved_done;
+static uint32_t checkpoint_next_record, checkpoint_number;
+// Sector that has been erased ahead of the records (-1 until one has been)
+static int32_t checkpoint_erased_sector = -1;
+
+_Static_assert(sizeof(checkpoint_record_t) <= CHECKPOINT_RECORD_SIZE, "A checkpoint has to fit in its record slot");
+
+// Page the next record is programmed with. Everything else is left erased so the records around it don't change
+static uint8_t checkpoint_page[FLASH_STORE_PAGE_SIZE];
+
+// FNV-1a hash of the record up to the checksum
+static uint32_t checkpoint_checksum(const checkpoint_record_t *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < offsetof(checkpoint_record_t, checksum); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Offset of a record slot inside the flash store
+static uint32_t checkpoint_record_offset(uint32_t index)
+{
+    return CHECKPOINT_OFFSET + index * CHECKPOINT_RECORD_SIZE;
+}
+
+// Read the last movement core 1 finished and where it left the axes (Read again if core 1 changed them part way through)
+static uint32_t checkpoint_read_sequence_done(double location[DRV_AXIS_COUNT])
+{
+    uint32_t version, sequence;
+    do
+    {
+        version = pico_state.sequence_done_version;
+        __dmb();
+        sequence = pico_state.sequence_done;
+        for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+            location[axis] = pico_state.sequence_done_location[axis];
+        __dmb();
+    } while((version & 1) || version != pico_state.sequence_done_version);
+    return sequence;
+}
+
+// Amount of the tracked job's movements that are done and where the last of them left the axes
+static uint32_t checkpoint_progress(double location[DRV_AXIS_COUNT])
+{
+    uint32_t sequence_done = checkpoint_read_sequence_done(location);
+
+    // Movements queued before tracking started aren't part of the job (Compared as a difference so it still works once the numbers wrap)
+    int32_t since = (int32_t)(sequence_done - checkpoint_base);
+    if(checkpoint_tracking && since > 0)
+        return checkpoint_resume_from + since;
+
+    memcpy(location, checkpoint_start, sizeof(checkpoint_start));
+    return checkpoint_resume_from;
+}
+
+// Whether a record slot is still erased and can be programmed
+static bool checkpoint_record_erased(uint32_t index)
+{
+    const uint8_t *bytes = flash_store_read(checkpoint_record_offset(index));
+    for(uint32_t i = 0; i < CHECKPOINT_RECORD_SIZE; i++)
+        if(bytes[i] != FLASH_STORE_ERASED)
+            return false;
+    return true;
+}
+
+// Whether every record slot of a sector is still erased
+static bool checkpoint_sector_erased(uint32_t sector)
+{
+    for(uint32_t i = 0; i < CHECKPOINT_SECTOR_RECORDS; i++)
+        if(!checkpoint_record_erased(sector * CHECKPOINT_SECTOR_RECORDS + i))
+            return false;
+    return true;
+}
+
+// Erase the sector the records go into next while the machine is idle. That is the one the next record starts, otherwise
+// the other sector (The last checkpoint is in the sector the next record is in)
+static void checkpoint_erase_ahead(void)
+{
+    uint32_t sector = checkpoint_next_record / CHECKPOINT_SECTOR_RECORDS;
+    if(checkpoint_next_record % CHECKPOINT_SECTOR_RECORDS != 0)
+        sector = (sector + 1) % CHECKPOINT_SECTOR_COUNT;
+    if((int32_t)sector == checkpoint_erased_sector)
+        return;
+
+    if(!checkpoint_sector_erased(sector))
+        flash_store_erase(checkpoint_record_offset(sector * CHECKPOINT_SECTOR_RECORDS), FLASH_STORE_SECTOR_SIZE);
+    checkpoint_erased_sector = sector;
+}
+
+// Append a checkpoint after the last one. Once the records come back around to the start of a sector that hasn't been
+// erased ahead of them it is erased (The last checkpoint is in the other sector), but only while the machine is idle.
+// Returns false if the checkpoint has to wait until it is
+static bool checkpoint_save(uint32_t done, const double location[DRV_AXIS_COUNT], bool idle)
+{
+    // Slots left over from a power loss part way through programming are skipped
+    uint32_t index = checkpoint_next_record;
+    while(!checkpoint_record_erased(index))
+    {
+        if(index % CHECKPOINT_SECTOR_RECORDS != 0)
+            index = (index + 1) % CHECKPOINT_RECORD_COUNT;
+        else if(idle)
+            flash_store_erase(checkpoint_record_offset(index), FLASH_STORE_SECTOR_SIZE);
+        else
+            return false;
+    }
+
+    // Zero everything (including padding) so the checksum only depends on the values
+    checkpoint_record_t record;
+    memset(&record, 0, sizeof(checkpoint_record_t));
+    record.magic = CHECKPOINT_MAGIC;
+    record.job_id = checkpoint_job_id;
+    record.done = done;
+    memcpy(record.location, location, sizeof(record.location));
+    record.number = checkpoint_number++;
+    record.checksum = checkpoint_checksum(&record);
+
+    // Only whole pages can be programmed
+    uint32_t offset = checkpoint_record_offset(index);
+    uint32_t page_index = offset % FLASH_STORE_PAGE_SIZE;
+    memset(checkpoint_page, FLASH_STORE_ERASED, FLASH_STORE_PAGE_SIZE);
+    memcpy(checkpoint_page + page_index, &record, sizeof(checkpoint_record_t));
+    flash_store_program(offset - page_index, checkpoint_page, FLASH_STORE_PAGE_SIZE);
+
+    // The sector holds the last checkpoint now so the other one is erased ahead next
+    if((int32_t)(index / CHECKPOINT_SECTOR_RECORDS) == checkpoint_erased_sector)
+        checkpoint_erased_sector = -1;
+    checkpoint_next_record = (index + 1) % CHECKPOINT_RECORD_COUNT;
+    checkpoint_saved_job_id = checkpoint_job_id;
+    checkpoint_saved_done = done;
+    return true;
+}
+
+void checkpoint_load(void)
+{
+    checkpoint_loaded_valid = false;
+    checkpoint_next_record = 0;
+    checkpoint_number = 0;
+
+    // The records wrap around both sectors so the newest is the valid one with the highest number
+    // (Compared as a difference so it still works once the numbers wrap)
+    for(uint32_t i = 0; i < CHECKPOINT_RECORD_COUNT; i++)
+    {
+        const checkpoint_record_t *record = (const checkpoint_record_t *)flash_store_read(checkpoint_record_offset(i));
+
+        // A record that was cut off by a power loss is skipped
+        if(record->magic != CHECKPOINT_MAGIC || record->checksum != checkpoint_checksum(record))
+            continue;
+        if(checkpoint_loaded_valid && (int32_t)(record->number - checkpoint_loaded.number) <= 0)
+            continue;
+
+        memcpy(&checkpoint_loaded, record, sizeof(checkpoint_record_t));
+        checkpoint_loaded_valid = true;
+        checkpoint_next_record = (i + 1) % CHECKPOINT_RECORD_COUNT;
+        checkpoint_number = record->number + 1;
+    }
+
+    // Report the saved progress until the host carries on with the job (or starts another)
+    checkpoint_tracking = false;
+    checkpoint_job_id = checkpoint_saved_job_id = checkpoint_loaded_valid ? checkpoint_loaded.job_id : 0;
+    checkpoint_resume_from = checkpoint_saved_done = checkpoint_loaded_valid ? checkpoint_loaded.done : 0;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        checkpoint_start[axis] = checkpoint_loaded_valid ? checkpoint_loaded.location[axis] : 0;
+}
+
+bool checkpoint_service(void)
+{
+    if(!checkpoint_tracking)
+        return false;
+
+    double location[DRV_AXIS_COUNT];
+    uint32_t done = checkpoint_progress(location);
+    bool idle = queue_is_idle(&pico_state.step_queue);
+
+    // Programming a page pauses core 1 for a moment so only save every few movements while it is moving
+    bool changed = done != checkpoint_saved_done || checkpoint_job_id != checkpoint_saved_job_id;
+    if(changed && (idle || checkpoint_job_id != checkpoint_saved_job_id || done - checkpoint_saved_done >= CHECKPOINT_INTERVAL))
+        changed = !checkpoint_save(done, location, idle);
+
+    if(idle)
+        checkpoint_erase_ahead();
+
+    return !idle || changed;
+}
+
+// Start tracking from the next movement that is queued
+static void checkpoint_track(uint32_t job_id, uint32_t done)
+{
+    checkpoint_job_id = job_id;
+    checkpoint_tracking = job_id != 0;
+    checkpoint_base = pico_state.sequence;
+    checkpoint_resume_from = done;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        checkpoint_start[axis] = pico_state.drv_location_pending[axis];
+}
+
+void checkpoint_start_job(uint32_t job_id)
+{
+    checkpoint_track(job_id, 0);
+}
+
+bool checkpoint_resume_job(uint32_t done)
+{
+    if(!checkpoint_job_id)
+        return false;
+    checkpoint_track(checkpoint_job_id, done);
+    return true;
+}
+
+bool checkpoint_restore(void)
+{
+    // Anything queued since the restart has planned from the old location
+    if(!checkpoint_loaded_valid || pico_state.sequence || !queue_is_idle(&pico_state.step_queue))
+        return false;
+
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        pico_state.drv_location[axis] = pico_state.drv_location_pending[axis] = checkpoint_loaded.location[axis];
+    return true;
+}
+
+void checkpoint_print(void)
+{
+    double location[DRV_AXIS_COUNT];
+    uint32_t done = checkpoint_progress(location);
+    bool idle = queue_is_idle(&pico_state.step_queue);
+
+    // Positions are multiples of the smallest step (1/32) so they need 5 decimal places
+    printf("$job=%lu\n$done=%lu\n", checkpoint_job_id, done);
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        printf("$%c=%.5f\n", drv_axes[axis].name, location[axis]);
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        printf("$location_%c=%.5f\n", drv_axes[axis].name, pico_state.drv_location_pending[axis]);
+    printf("$saved=%lu\n", checkpoint_saved_job_id == checkpoint_job_id ? checkpoint_saved_done : 0);
+    printf("$restorable=%d\n$busy=%d\n", checkpoint_loaded_valid && !pico_state.sequence, !idle);
+}
@@ -0,0 +1,61 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include "flash_store.h"
+#include "queue.h"
+
+// Job Checkpoints
+// Every movement queued by drv_go_to_position or drv_queue_segment gets the next sequence number and core 1 marks it done
+// (with where the axes ended up) once it has finished stepping. While a job is tracked ($job=<id>) the amount of its
+// movements that are done is saved to flash so the host can carry on from there after a disconnect or a power loss
+
+// "CHKT" - Identifies a saved checkpoint
+#define CHECKPOINT_MAGIC        0x544B4843
+
+// Location of the checkpoints inside the flash store (The first two sectors, before the machine profile)
+#define CHECKPOINT_OFFSET       0
+#define CHECKPOINT_SIZE         (2 * FLASH_STORE_SECTOR_SIZE)
+// Checkpoints are appended one after the other through both sectors and back around. A sector is only erased while the
+// other sector holds the last checkpoint, in case the power goes part way through, and only while the machine is idle
+// (An erase stops core 1 and the UART for longer than a movement can wait). The sector the records go into next is erased
+// ahead of them so they can carry on into it while moving. Once they need another, saving waits until the machine is idle
+#define CHECKPOINT_RECORD_SIZE  64
+#define CHECKPOINT_RECORD_COUNT (CHECKPOINT_SIZE / CHECKPOINT_RECORD_SIZE)
+#define CHECKPOINT_SECTOR_RECORDS (FLASH_STORE_SECTOR_SIZE / CHECKPOINT_RECORD_SIZE)
+#define CHECKPOINT_SECTOR_COUNT (CHECKPOINT_SIZE / FLASH_STORE_SECTOR_SIZE)
+
+// Save after this many movements are done while the machine is moving (Always saved once it stops)
+#define CHECKPOINT_INTERVAL     16
+
+// Stored in its own record slot. The valid record with the highest number is the checkpoint
+typedef struct {
+    uint32_t magic;
+    // Job the checkpoint is for (Picked by the host, 0 is no job)
+    uint32_t job_id;
+    // Amount of the job's movements that were done
+    uint32_t done;
+    // Where the axes were when the last of them finished
+    double location[DRV_AXIS_COUNT];
+    // Counts up with every record saved so the newest can be found in either sector
+    uint32_t number;
+    // FNV-1a hash of everything before it
+    uint32_t checksum;
+} checkpoint_record_t;
+
+// Load the last saved checkpoint. Its position can be restored until anything else has been queued
+void checkpoint_load(void);
+// Save the progress of the tracked job when it has changed and erase ahead of the records while idle. Should be called often.
+// Returns true while there is progress that may still need saving
+bool checkpoint_service(void);
+
+// Start tracking a new job (0 stops tracking)
+void checkpoint_start_job(uint32_t job_id);
+// Carry on tracking the last job with done of its movements already done. Fails if no job has been tracked
+bool checkpoint_resume_job(uint32_t done);
+// Move the axes' location to where they were at the saved checkpoint (They don't move. Only after a restart and before anything has been queued)
+bool checkpoint_restore(void);
+// Print the progress of the tracked job as $name=value lines ($saved is the amount of its movements that are saved to flash)
+void checkpoint_print(void);
+
+#endif // CHECKPOINT_H
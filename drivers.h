@@ -0,0 +1,101 @@
+#ifndef DRIVERS_H
+#define DRIVERS_H
+
+// Stepper Driver Profiles
+// The microstep modes, mode pin levels and timing minimums of every supported driver.
+// The driver is picked at compile time with STEPPER_DRIVER (eg. -DSTEPPER_DRIVER=STEPPER_A4988) so the planner,
+// the default machine profile and the step loop are all built for that driver's limits
+
+#define STEPPER_DRV8825      0
+#define STEPPER_A4988        1
+#define STEPPER_TMC2208      2
+
+#ifndef STEPPER_DRIVER
+#ifdef A4988_DRIVER
+#define STEPPER_DRIVER STEPPER_A4988 // Kept for builds that still define the old flag
+#else
+#define STEPPER_DRIVER STEPPER_DRV8825
+#endif
+#endif
+
+// A Microstep Mode. The fraction of a full step and the levels of the mode pins (bit 0 is mode_0, 1 is mode_1, 2 is mode_2)
+typedef struct {
+    double step;
+    unsigned char pins;
+} drv_microstep_t;
+
+/*
+    DRV_MODES           Every microstep mode from the largest step to the smallest
+    DRV_STEP_HIGH_NS    tWH(STEP) Pulse duration, STEP high (min)
+    DRV_STEP_LOW_NS     tWL(STEP) Pulse duration, STEP low (min)
+    DRV_SETUP_NS        tSU(STEP) Setup time, direction & mode before STEP rising (min)
+    DRV_HOLD_NS         tH(STEP) Hold time, direction & mode after STEP rising (min)
+    DRV_WAKE_US         tWAKE Wake up time, enabled to STEP input accepted (min)
+*/
+
+#if STEPPER_DRIVER == STEPPER_DRV8825
+// Data Sheet: https://www.ti.com/lit/gpn/drv8825
+#define DRV_NAME            "DRV8825"
+#define DRV_MODES { \
+    { 1, 0b000 }, { 0.5, 0b100 }, { 0.25, 0b010 }, { 0.125, 0b110 }, { 0.0625, 0b001 }, { 0.03125, 0b111 } \
+}
+#define DRV_MODE_COUNT      6
+#define DRV_MIN_STEP        0.03125
+#define DRV_STEP_HIGH_NS    1900
+#define DRV_STEP_LOW_NS     1900
+#define DRV_SETUP_NS        650
+#define DRV_HOLD_NS         650
+#define DRV_WAKE_US         1700
+
+#elif STEPPER_DRIVER == STEPPER_A4988
+// Allegro A4988 Data Sheet
+#define DRV_NAME            "A4988"
+#define DRV_MODES { \
+    { 1, 0b000 }, { 0.5, 0b001 }, { 0.25, 0b010 }, { 0.125, 0b011 }, { 0.0625, 0b111 } \
+}
+#define DRV_MODE_COUNT      5
+#define DRV_MIN_STEP        0.0625
+#define DRV_STEP_HIGH_NS    1000
+#define DRV_STEP_LOW_NS     1000
+#define DRV_SETUP_NS        200
+#define DRV_HOLD_NS         200
+#define DRV_WAKE_US         1000
+
+#elif STEPPER_DRIVER == STEPPER_TMC2208
+// Standalone mode with MS1 on mode_0 and MS2 on mode_1. There is no full step mode so whole steps are made of half steps
+// Trinamic TMC2208 Data Sheet
+#define DRV_NAME            "TMC2208"
+#define DRV_MODES { \
+    { 0.5, 0b001 }, { 0.25, 0b010 }, { 0.125, 0b000 }, { 0.0625, 0b011 } \
+}
+#define DRV_MODE_COUNT      4
+#define DRV_MIN_STEP        0.0625
+#define DRV_STEP_HIGH_NS    100
+#define DRV_STEP_LOW_NS     100
+#define DRV_SETUP_NS        20
+#define DRV_HOLD_NS         20
+#define DRV_WAKE_US         0 // No sleep mode
+
+#else
+#error "Unknown STEPPER_DRIVER"
+#endif
+
+// Returned by drv_determine_mode when no mode fits the step
+#define DRV_MODE_INVALID    0b1000
+
+// Shortest step delay (each half of a step period) that still gives the driver its STEP high and low times
+#define DRV_STEP_DELAY_MIN_US   (((DRV_STEP_HIGH_NS + DRV_STEP_LOW_NS) / 2 + 999) / 1000)
+// Direction & Mode setup time rounded up to whole microseconds
+#define DRV_SETUP_MIN_US        ((DRV_SETUP_NS + 999) / 1000)
+
+// Clock the STEP high time is counted in cycles of
+#ifndef SYS_CLK_KHZ
+#define SYS_CLK_KHZ 125000
+#endif
+#define DRV_NS_TO_CYCLES(ns)    (((ns) * (SYS_CLK_KHZ / 1000) + 999) / 1000)
+#define DRV_STEP_HIGH_CYCLES    DRV_NS_TO_CYCLES(DRV_STEP_HIGH_NS)
+
+// The direction & mode pins change right after the last low half of a node, which has to cover the hold time
+_Static_assert(DRV_STEP_LOW_NS >= DRV_HOLD_NS, "The STEP low time must cover the direction & mode hold time");
+
+#endif // DRIVERS_H
@@ -2,69 +2,33 @@
 #include <math.h>
 #include "utils.h"
 
+// Every microstep mode of the driver from the largest step to the smallest
+static const drv_microstep_t drv_modes[DRV_MODE_COUNT] = DRV_MODES;
+
 double drv_determine_step(bool mode_0, bool mode_1, bool mode_2)
 {
-    // NOTE: Refer to the Step table in the DRV8825 Datasheet to why these values are being used
-    #ifndef A4988_DRIVER
-    // DRV8825 Steps
-    if(!mode_0 && !mode_1 && !mode_2) 
-        return 1; // Full step (2-phase excitation) with 71% current
-    else if(!mode_0 && !mode_1 && mode_2)
-        return 0.5; // 1/2 step (1-2 phase excitation)
-    else if(!mode_0 && mode_1 && !mode_2)
-        return 0.25; // 1/4 step (W1-2 phase excitation)
-    else if(!mode_0 && mode_1 && mode_2)
-        return 0.125; // 8 microsteps/step
-    else if(mode_0 && !mode_1 && !mode_2)
-        return 0.0625; // 16 microsteps/step
-    else
-        return 0.03125; // 32 microsteps/step
-    #endif
+    // NOTE: Refer to the Step table in the Data Sheet of the driver (drivers.h) to why these values are being used
+    uint8_t pins = mode_0 | (mode_1 << 1) | (mode_2 << 2);
+    for(uint8_t mode = 0; mode < DRV_MODE_COUNT; mode++)
+        if(drv_modes[mode].pins == pins)
+            return drv_modes[mode].step;
 
-    #ifdef A4988_DRIVER
-    // A4988 Steps
-    if(!mode_0 && !mode_1 && !mode_2) 
-        return 1; // Full step (2-phase excitation) with 71% current
-    else if(mode_0 && !mode_1 && !mode_2)
-        return 0.5; // 1/2 step (1-2 phase excitation)
-    else if(!mode_0 && mode_1 && !mode_2)
-        return 0.25; // 1/4 step (W1-2 phase excitation)
-    else if(mode_0 && mode_1 && !mode_2)
-        return 0.125; // 8 microsteps/step
-    else
-        return 0.0625; // 16 microsteps/step
-    #endif
+    // Pin levels that aren't in the table end up in the smallest step (eg. The DRV8825's other 32 microstep levels)
+    return DRV_MIN_STEP;
 }
 uint8_t drv_determine_mode(double step)
 {
     // Get the largest microstep mode that has no remainder
     // Basically the inverse of drv_determine_step
+    for(uint8_t mode = 0; mode < DRV_MODE_COUNT; mode++)
+        if(!fmod(step, drv_modes[mode].step))
+            return mode;
 
-    // bit 1 is mode_2, 
-    // bit 2 is mode_1, 
-    // bit 3 is mode_0, 
-    // bit 4 is invalid step
-
-    if(!fmod(step, 1))
-        return 0b0; 
-    else if(!fmod(step, 0.5))
-        return 0b001;
-    else if(!fmod(step, 0.25))
-        return 0b010;
-     else if(!fmod(step, 0.125))
-        return 0b011;
-    #ifndef A4988_DRIVER
-    else if(!fmod(step, 0.0625))
-        return 0b100;
-    else if(!fmod(step, 0.03125))
-        return 0b111;
-    #else
-    // A4988 only goes down to 1/16th of a step
-    else if(!fmod(step, 0.0625))
-        return 0b111;
-    #endif
-    
-    return 0b1000; // No Valid Step Increment Found
+    return DRV_MODE_INVALID; // No Valid Step Increment Found
+}
+uint8_t drv_mode_pins(uint8_t mode)
+{
+    return drv_modes[mode < DRV_MODE_COUNT ? mode : DRV_MODE_COUNT - 1].pins;
 }
 
 double drv_determine_distance(double step_amount, unsigned int n_steps)
@@ -81,18 +45,9 @@ uint32_t drv_step_amount(double distance, bool mode_0, bool mode_1, bool mode_2)
         steps++;
     return steps;
 }
-uint32_t drv_step_amount_masked(double distance, uint8_t mode_mask)
+uint32_t drv_step_amount_mode(double distance, uint8_t mode)
 {
-    // Extracts the modes from a mask and uses the drv_step_amount above to return the step count
-    return drv_step_amount(distance, 
-        #ifndef A4988_DRIVER
-        GET_BIT_N(mode_mask, 2), 
-        GET_BIT_N(mode_mask, 1), 
-        GET_BIT_N(mode_mask, 0)
-        #else
-        GET_BIT_N(mode_mask, 0), 
-        GET_BIT_N(mode_mask, 1), 
-        GET_BIT_N(mode_mask, 2)
-        #endif
-    );
-}
\ No newline at end of file
+    // Extracts the pins of the mode and uses the drv_step_amount above to return the step count
+    uint8_t pins = drv_mode_pins(mode);
+    return drv_step_amount(distance, GET_BIT_N(pins, 0), GET_BIT_N(pins, 1), GET_BIT_N(pins, 2));
+}
@@ -3,8 +3,8 @@
 
 #include <stdbool.h>
 
-// DRV8825 Related Functions
-// No Dependencies
+// Stepper Driver Related Functions
+// No Dependencies. Built for the driver picked in drivers.h (The DRV8825 by default)
 
 // Data Sheet: https://www.ti.com/lit/gpn/drv8825
 
@@ -19,16 +19,10 @@
     6	tENBL	    Enable time, nENBL active to STEP	            650		        ns
     7	tWAKE	    Wakeup time, nSLEEP inactive high to            1.7	            ms
                     STEP input accepted		
+    (The same timings of the other drivers are in drivers.h)
 */
 
-// A4988 has different microsteps and possibly other things
-// #define A4988_DRIVER
-
-#ifndef A4988_DRIVER
-#define DRV_MIN_STEP 0.03125
-#else
-#define DRV_MIN_STEP 0.0625
-#endif
+#include "drivers.h"
 
 typedef unsigned char uint8_t;
 typedef long unsigned int uint32_t;
@@ -36,16 +30,19 @@ typedef long unsigned int uint32_t;
 // Determine the Percentage of a step based on the active modes
 double drv_determine_step(bool mode_0, bool mode_1, bool mode_2);
 
-// Determine the mode basic mode requried based on the step you want to perform
-// Returns an byte where bit 1 is mode_2, 2 is mode_1, 3 is mode_0, 4 is invalid step
+// Determine the largest mode that the step can be made in
+// Returns the index of the mode in DRV_MODES (larger is a smaller step) or DRV_MODE_INVALID
 uint8_t drv_determine_mode(double step);
 
+// Get the mode pin levels (bit 0 is mode_0, 1 is mode_1, 2 is mode_2) of a mode returned by drv_determine_mode
+uint8_t drv_mode_pins(uint8_t mode);
+
 // Determine the Actual step count based on the number of steps at a certain step
 double drv_determine_distance(double step_amount, unsigned int n_steps);
 
 // Determine the amount of steps required for a certain distance in the provided mode
 uint32_t drv_step_amount(double distance, bool mode_0, bool mode_1, bool mode_2);
-uint32_t drv_step_amount_masked(double distance, uint8_t mode_mask);
+uint32_t drv_step_amount_mode(double distance, uint8_t mode);
 
 
 #endif // DRV8825_H
@@ -0,0 +1,133 @@
+/*
+
+    Content-Addressed Cache of Processed Paths
+
+    Every processed path is kept on disk under a hash of everything that decides it: the source points, the transform
+    that places them on the bed (scale & offset from the machine limits and layout), the pipeline limits and the code
+    that processes them. Repeat runs of the same artwork skip the workers and start streaming straight away.
+    Anything that changes gives a different hash so stale entries are never read. They are pruned once they go unused
+
+*/
+const fs = require('fs');
+const path = require('path');
+const crypto = require('crypto');
+
+// Where the entries are kept (FEED_CACHE_DIR overrides it)
+const CACHE_DIR = process.env.FEED_CACHE_DIR || path.join(__dirname, '.cache');
+// Entries that haven't been used for this long are removed, then the least recently used until the cache fits
+const CACHE_MAX_AGE_DAYS = 30;
+const CACHE_MAX_BYTES = 256 * 1024 * 1024;
+
+// The code that processes the paths. Changing any of it changes every key
+const PROCESSING_SOURCES = ['utils.js', 'layout.js', 'path_worker.js'];
+
+const hash = (value) => crypto.createHash('sha256').update(typeof value === 'string' ? value : JSON.stringify(value)).digest('hex');
+
+let fingerprint;
+const codeFingerprint = () => fingerprint || (fingerprint = hash(PROCESSING_SOURCES.map(file => fs.readFileSync(path.join(__dirname, file), 'utf8')).join('\0')));
+
+const entryPath = (key) => path.join(CACHE_DIR, `${key}.json`);
+
+// Key of a path as it is sent to the pipeline ({ points, transform })
+const cacheKey = ({ points, transform }) => hash({ code: codeFingerprint(), points, transform });
+
+// The cached result ({ processed, scaledLength }) for a key or null if there isn't a valid one. Marks the entry as used
+const readCache = (key) => {
+    const file = entryPath(key);
+    try
+    {
+        const entry = JSON.parse(fs.readFileSync(file, 'utf8'));
+        if(entry.key !== key || !Array.isArray(entry.processed))
+            throw new Error('Invalid Entry');
+        const now = new Date();
+        fs.utimesSync(file, now, now);
+        return entry;
+    }
+    catch(error)
+    {
+        // Missing is a miss. Anything else (eg. a write that was cut off) is removed so it is replaced
+        if(error.code !== 'ENOENT')
+            fs.rmSync(file, { force: true });
+        return null;
+    }
+}
+
+// Store a result. Written to a temporary file first so a reader (or another fleet process) never sees half an entry
+const writeCache = (key, { processed, scaledLength }) => {
+    try
+    {
+        fs.mkdirSync(CACHE_DIR, { recursive: true });
+        const temporary = `${entryPath(key)}.${process.pid}.tmp`;
+        fs.writeFileSync(temporary, JSON.stringify({ key, processed, scaledLength }));
+        fs.renameSync(temporary, entryPath(key));
+    }
+    catch(error)
+    {
+        // The cache is only an optimisation so a full disk just means a miss next time
+    }
+}
+
+// Every entry with its size and when it was last used (Oldest first)
+const listCache = () => {
+    if(!fs.existsSync(CACHE_DIR))
+        return [];
+    return fs.readdirSync(CACHE_DIR)
+        .filter(file => file.endsWith('.json'))
+        .map(file => {
+            const stats = fs.statSync(path.join(CACHE_DIR, file));
+            return { file, bytes: stats.size, used: stats.mtimeMs };
+        })
+        .sort((a, b) => a.used - b.used);
+}
+
+// Remove entries that haven't been used for maxAgeDays then the least recently used until the cache is under maxBytes
+const pruneCache = ({ maxAgeDays = CACHE_MAX_AGE_DAYS, maxBytes = CACHE_MAX_BYTES } = {}) => {
+    const entries = listCache();
+    let bytes = entries.reduce((total, entry) => total + entry.bytes, 0), removed = 0;
+    const oldest = Date.now() - maxAgeDays * 24 * 60 * 60 * 1000;
+    for(const entry of entries)
+    {
+        if(entry.used >= oldest && bytes <= maxBytes)
+            break;
+        fs.rmSync(path.join(CACHE_DIR, entry.file), { force: true });
+        bytes -= entry.bytes;
+        removed++;
+    }
+    return { removed, entries: entries.length - removed, bytes };
+}
+
+// Remove every entry
+const clearCache = () => fs.rmSync(CACHE_DIR, { recursive: true, force: true });
+
+// View, prune or clear the cache
+if(require.main === module)
+{
+    const [command] = process.argv.slice(2);
+    if(command === 'clear')
+    {
+        clearCache();
+        console.log(`Cleared ${CACHE_DIR}`);
+    }
+    else if(command === 'prune')
+    {
+        const { removed, entries, bytes } = pruneCache();
+        console.log(`Removed ${removed} Entries | ${entries} Left (${(bytes / 1024).toFixed(1)}KB)`);
+    }
+    else
+    {
+        const entries = listCache();
+        const bytes = entries.reduce((total, entry) => total + entry.bytes, 0);
+        console.log(`${CACHE_DIR}: ${entries.length} Entries (${(bytes / 1024).toFixed(1)}KB)` +
+            (entries.length ? ` | Last Used: ${new Date(entries[entries.length - 1].used).toLocaleString()}` : ''));
+        console.log('Usage: yarn cache [clear | prune]');
+    }
+}
+
+module.exports = {
+    CACHE_DIR,
+    cacheKey,
+    readCache,
+    writeCache,
+    pruneCache,
+    clearCache
+};
@@ -0,0 +1,245 @@
+/*
+
+    Offline Step Stream Compiler
+
+    Runs the same quantisation and planning as drv_go_to_position (pico.c) and drv8825.c with the driver table of the machine (machine.js)
+    so the PICO only has to play back fully resolved segments (mode, direction mask, step counts, timing)
+    Moves that carry straight on are joined and pen moves are merged into the travel around them the same way drv_merge_nodes does
+
+*/
+const fs = require('fs');
+const { MAX_STEPS_Z, MIN_STEPS_Z, DEFAULT_PROFILE, DRIVERS, DRV_STEP_PERIOD_EXTRA_US } = require('./machine');
+
+// Segment flags (Same as DRV_SEGMENT_ in queue.h). Z steps on the last pulses of the segment instead of the first
+const Z_ALIGN_END = 1 << 0;
+
+// Same as drv_determine_mode. Get the largest microstep mode of the driver that has no remainder
+// Returns the index of the mode in the driver's table (machine.js) or -1 for an invalid step
+const determineMode = (step, driver = DRIVERS[0]) => driver.modes.findIndex(mode => !(step % mode.step));
+
+// Same as drv_step_amount. Counts the steps of the given size that fit into the distance
+const stepAmount = (distance, stepSize) => {
+    let steps = 0;
+    for(let step = 0; step < distance; step += stepSize)
+        steps++;
+    return steps;
+}
+
+// Same as drv_plan_step_delay. The slowest of the profile's step delay and the max rate of every axis that moves
+const planStepDelay = (steps, stepSize, profile = DEFAULT_PROFILE) => {
+    let delay = profile.stepDelayUs;
+    steps.forEach((count, axis) => {
+        if(count && profile.maxRate[axis] > 0)
+            delay = Math.max(delay, stepSize * 1e6 / (2 * profile.maxRate[axis]));
+    });
+    return Math.min(Math.ceil(delay), 0xFFFF);
+}
+
+// Same as drv_go_to_position. Returns the segment that moves the pending position to x, y, z (or null if it is skipped)
+// Plans with the limits and timings of the machine profile (profile.js)
+const planPosition = (pending, position, profile = DEFAULT_PROFILE) => {
+    // Handle Position Overflows & Underflows
+    const target = position.map((value, axis) => Math.min(Math.max(value, profile.minSteps[axis]), profile.maxSteps[axis]));
+
+    const dirs = target.map((value, axis) => pending[axis] <= value);
+    const distances = target.map((value, axis) => Math.abs(pending[axis] - value));
+
+    // Get the Largest Mode (which is the smallest step) as all motors share modes
+    const driver = DRIVERS[profile.driver] || DRIVERS[0];
+    const modes = distances.map(distance => determineMode(distance, driver));
+    if(modes.includes(-1))
+        return null;
+    const { step: stepSize, pins } = driver.modes[Math.max(...modes)];
+
+    // Update the pending locations
+    target.forEach((value, axis) => pending[axis] = value);
+
+    const steps = distances.map(distance => stepAmount(distance, stepSize));
+    if(!steps.some(Boolean))
+        return null; // process_step_queue skips nodes without steps
+
+    const delayUs = planStepDelay(steps, stepSize, profile);
+    return withDuration({
+        mode: pins,
+        dir: dirs.reduce((mask, dir, axis) => mask | (dir << axis), 0),
+        steps,
+        stepSize,
+        delayUs,
+        flags: 0
+    }, profile);
+}
+
+// Time process_step_queue spends on a segment that runs straight after another
+// (The direction & mode pins are set together, enabling the drivers and spinning up the spindle only happen after the queue runs dry)
+const withDuration = (segment, profile = DEFAULT_PROFILE) => ({
+    ...segment,
+    durationUs: Math.max(profile.directionSetupUs, profile.modeSetupUs) + Math.max(...segment.steps) * (segment.delayUs * 2 + DRV_STEP_PERIOD_EXTRA_US)
+});
+
+// Same as drv_node_set_mode. Moves a segment onto an equal or smaller step size, covering the same distance at the same rate
+// (Its delay is shortened by as much, but never below the profile's step delay)
+const toStepSize = (segment, { stepSize, mode }, profile = DEFAULT_PROFILE) => {
+    const ratio = segment.stepSize / stepSize;
+    return {
+        ...segment,
+        steps: segment.steps.map(steps => steps * ratio),
+        stepSize,
+        mode,
+        delayUs: ratio > 1 ? Math.max(Math.ceil(segment.delayUs / ratio), profile.stepDelayUs) : segment.delayUs
+    };
+}
+
+// Same as drv_merge_pen_moves. Z moving towards its minimum lifts the pen.
+// A lift followed by an XY move merges into one segment so the travel starts while the pen is still going up.
+// An XY move followed by a drop has the drop aligned to its end so the pen lands exactly at the start of the path.
+// Returns the segments that replace the pair (or null when they stay as they are, including when merging wouldn't finish sooner)
+const mergePenMoves = (end, segment, profile = DEFAULT_PROFILE) => {
+    const merged = overlapPenMoves(end, segment, profile);
+    const durationUs = (segments) => segments.reduce((total, { durationUs }) => total + durationUs, 0);
+    return merged && durationUs(merged) < durationUs([end, segment]) ? merged : null;
+}
+
+// The pen move overlapped with the travel around it for mergePenMoves (Same as drv_merge_pen_pair)
+const overlapPenMoves = (end, segment, profile = DEFAULT_PROFILE) => {
+    const movesXY = ({ steps }) => steps[0] > 0 || steps[1] > 0;
+    const zDown = ({ dir }) => (dir & 0b100) !== 0;
+    const liftThenTravel = !movesXY(end) && end.steps[2] > 0 && !zDown(end) && movesXY(segment) && !segment.steps[2];
+    const travelThenDrop = movesXY(end) && !(end.flags & Z_ALIGN_END) && !movesXY(segment) && segment.steps[2] > 0 && zDown(segment);
+
+    // A travel with a lift already merged in is split once the lift is done (Nothing to do if the travel is over by then)
+    if(travelThenDrop && end.steps[2] && end.steps[0] <= end.steps[2] && end.steps[1] <= end.steps[2])
+        return null;
+    if(!liftThenTravel && !travelThenDrop)
+        return null;
+
+    // Both step with the smaller of their step sizes and the slower of their step rates in it
+    const fine = end.stepSize <= segment.stepSize ? end : segment;
+    const a = toStepSize(end, fine, profile), b = toStepSize(segment, fine, profile);
+    const delayUs = Math.max(a.delayUs, b.delayUs);
+    const xyDir = (dir) => dir & 0b011, zDir = (dir) => dir & 0b100;
+
+    if(liftThenTravel)
+        return [withDuration({ ...a, steps: [b.steps[0], b.steps[1], a.steps[2]], dir: xyDir(b.dir) | zDir(a.dir), delayUs }, profile)];
+    if(!a.steps[2])
+        return [withDuration({ ...a, steps: [a.steps[0], a.steps[1], b.steps[2]], dir: xyDir(a.dir) | zDir(b.dir), flags: Z_ALIGN_END, delayUs }, profile)];
+
+    // The rest of the travel takes the drop
+    const split = a.steps[2];
+    const rest = [Math.max(a.steps[0] - split, 0), Math.max(a.steps[1] - split, 0)];
+    return [
+        withDuration({ ...a, steps: [a.steps[0] - rest[0], a.steps[1] - rest[1], split] }, profile),
+        withDuration({ ...a, steps: [...rest, b.steps[2]], dir: xyDir(a.dir) | zDir(b.dir), flags: Z_ALIGN_END, delayUs }, profile)
+    ];
+}
+
+// Same as drv_merge_collinear. Joins a segment onto the end segment when pulsing one after the other already steps
+// exactly like the joined segment would: every axis that carries on stepped on every pulse of the end segment
+// (eg. a straight line along an axis or a diagonal split up by the host). Returns the joined segment (or null)
+const mergeCollinear = (end, segment, profile = DEFAULT_PROFILE) => {
+    if((end.flags | segment.flags) & Z_ALIGN_END || end.mode !== segment.mode || end.delayUs !== segment.delayUs)
+        return null;
+    const pulses = Math.max(...end.steps);
+    if(!pulses || !segment.steps.some(Boolean))
+        return null;
+    const carriesOn = segment.steps.every((steps, axis) => !steps || (end.steps[axis] === pulses && ((end.dir ^ segment.dir) >> axis & 1) === 0));
+    if(!carriesOn)
+        return null;
+    return withDuration({ ...end, steps: end.steps.map((steps, axis) => steps + segment.steps[axis]) }, profile);
+}
+
+// Same as drv_merge_nodes. Moves that carry straight on are joined, otherwise pen moves are overlapped with the travel around them
+// Returns the segments that replace the pair (or null when they stay as they are)
+const mergeQueued = (end, segment, profile = DEFAULT_PROFILE) => {
+    const joined = mergeCollinear(end, segment, profile);
+    return joined ? [joined] : mergePenMoves(end, segment, profile);
+}
+
+// Merge every segment that the firmware would merge when they are queued together
+const mergeSegments = (segments, profile = DEFAULT_PROFILE) => {
+    const merged = [];
+    for(const segment of segments)
+    {
+        const replacement = merged.length && mergeQueued(merged[merged.length - 1], segment, profile);
+        if(replacement)
+            merged.splice(merged.length - 1, 1, ...replacement);
+        else
+            merged.push(segment);
+    }
+    return merged;
+}
+
+// Compile processed paths into segments. The same positions are planned as index.js would send them, starting from the origin
+const compilePaths = (paths, penUpZ = MIN_STEPS_Z, penDownZ = MAX_STEPS_Z, profile = DEFAULT_PROFILE) => {
+    const pending = [0, 0, penUpZ];
+    const segments = [];
+    const plan = (x, y, z) => {
+        const segment = planPosition(pending, [x, y, z], profile);
+        if(segment)
+            segments.push(segment);
+    }
+
+    for(const points of paths)
+    {
+        if(!points.length)
+            continue;
+        const [firstX, firstY] = points[0], [lastX, lastY] = points[points.length - 1];
+
+        // Travel with the Pen Up, Place the Pen, Draw the Path and Lift the Pen
+        plan(firstX, firstY, penUpZ);
+        plan(firstX, firstY, penDownZ);
+        for(const [x, y] of points.slice(1))
+            plan(x, y, penDownZ);
+        plan(lastX, lastY, penUpZ);
+    }
+    return mergeSegments(segments, profile);
+}
+
+// Human Readable Listing of exactly what will be pulsed
+const formatSegments = (segments) => {
+    const lines = segments.map((segment, i) =>
+        `#${i} mode=1/${1 / segment.stepSize} dir=${segment.dir.toString(2).padStart(3, '0')} ` +
+        `steps=${segment.steps.join(',')}${segment.flags & Z_ALIGN_END ? ' z@end' : ''} delay=${segment.delayUs}us time=${(segment.durationUs / 1000).toFixed(3)}ms`
+    );
+    const pulses = segments.reduce((total, segment) => total + segment.steps.reduce((a, b) => a + b, 0), 0);
+    const duration = segments.reduce((total, segment) => total + segment.durationUs, 0);
+    lines.push(`Segments: ${segments.length} | Pulses: ${pulses} | Time: ${(duration / 1e6).toFixed(2)}s`);
+    return lines.join('\n');
+}
+
+// Compile a predefined image and write the listing into the compiled folder
+if(require.main === module)
+{
+    const { processImage } = require('./encoding');
+    const predefinedImages = require('./predefined_images');
+    const imageName = process.argv[2];
+    const image = predefinedImages[imageName];
+    if(!image || imageName === 'generate')
+    {
+        console.log(`Run one of the following commands to compile an image:\n${
+            Object.keys(predefinedImages)
+                .filter(image => image !== 'generate')
+                .map(image => `yarn compile ${image}`)
+                .join('\n')
+        }`);
+        return;
+    }
+
+    const listing = formatSegments(compilePaths(processImage(image)));
+    fs.mkdirSync('compiled', { recursive: true });
+    fs.writeFileSync(`compiled/${imageName}.txt`, listing);
+    console.log(listing.split('\n').pop());
+    console.log(`Listing written to compiled/${imageName}.txt`);
+}
+
+module.exports = {
+    determineMode,
+    stepAmount,
+    planStepDelay,
+    planPosition,
+    mergePenMoves,
+    mergeCollinear,
+    mergeQueued,
+    mergeSegments,
+    compilePaths,
+    formatSegments
+};
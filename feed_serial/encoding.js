@@ -0,0 +1,219 @@
+/*
+
+    Compact Job Encoding for the PICO (Decoded by stream_decoder.c)
+
+    Points are sent as zig-zag varint deltas in 1/32 step units (the smallest step of the DRV8825)
+    instead of text doubles. Repeated deltas are run-length coded and the pen has its own tokens.
+    Bytes that match a real-time command are escaped so the stream can't pause or abort the machine.
+
+*/
+const predefinedImages = require('./predefined_images');
+const { processPath } = require('./utils');
+const { getBounds, fitTransform, applyTransform } = require('./layout');
+const { MAX_STEPS_X, MAX_STEPS_Y, MAX_STEPS_Z, MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, REALTIME } = require('./machine');
+
+// Byte that switches the Automated Draw menu from text coordinates to the compact stream
+const STREAM_START = 0x02;
+
+// Tokens (Same as stream_decoder.h)
+const TOKEN = {
+    END: 0x00, // Back to text coordinates
+    PEN_UP: 0x01, // Absolute Z (varint)
+    PEN_DOWN: 0x02, // Absolute Z (varint)
+    MOVE: 0x03, // Relative X & Y (zig-zag varints)
+    REPEAT: 0x04, // Repeat the last MOVE n more times (varint)
+    MOVE_TO: 0x05, // Absolute X & Y (varints)
+    SEGMENT: 0x06 // Planned segment: Dir mask | Mode mask << 3 | Flags << 6, X, Y & Z steps, Step delay in us (varints)
+};
+
+// Bytes that the PICO would take as real-time commands are sent as STREAM_ESCAPE then the byte XOR 0x20 (Same as stream_decoder.h)
+const STREAM_ESCAPE = 0x7D, STREAM_ESCAPE_XOR = 0x20;
+const ESCAPED_BYTES = new Set([...Object.values(REALTIME), STREAM_ESCAPE]);
+
+// Amount of units in a single step
+const UNITS_PER_STEP = 32;
+
+// Limit of a single REPEAT so that a token never queues too many movements at once on the PICO
+// (Longer runs are sent as more REPEAT tokens. The PICO takes a larger count as an invalid stream, STREAM_MAX_REPEAT)
+const MAX_REPEAT = 127;
+
+// Map signed numbers to unsigned so small negative numbers stay small (0, -1, 1, -2 => 0, 1, 2, 3)
+const zigzag = (value) => value >= 0 ? value * 2 : -value * 2 - 1;
+
+// Largest operand the PICO decodes (32 bits)
+const MAX_VARINT = 0xFFFFFFFF;
+
+// Append an unsigned number 7 bits at a time. The high bit is set when more bytes follow
+// (Signed numbers are zig-zag encoded first. Absolute positions can't be negative)
+const pushVarint = (bytes, value) => {
+    if(!Number.isInteger(value) || value < 0 || value > MAX_VARINT)
+        throw new RangeError(`Unable to encode ${value}. Operands are whole numbers from 0 to ${MAX_VARINT}`);
+    do
+    {
+        let byte = value % 128;
+        value = Math.floor(value / 128);
+        if(value) byte |= 0x80;
+        bytes.push(byte);
+    } while(value);
+}
+
+// Escape every byte of a stream (The start byte is never escaped)
+const escapeStream = (bytes) => Buffer.from(bytes.flatMap(byte => ESCAPED_BYTES.has(byte) ? [STREAM_ESCAPE, byte ^ STREAM_ESCAPE_XOR] : [byte]));
+
+const toUnits = (steps) => Math.round(steps * UNITS_PER_STEP);
+
+// Incremental compact encoder for paths that arrive in chunks (eg. point files). Returns the escaped bytes to send after each call:
+// start() opens the stream, points(points, end) adds the next points of the current path (end finishes it) and finish() closes the stream
+const createStreamEncoder = (penUpZ = MIN_STEPS_Z, penDownZ = MAX_STEPS_Z) => {
+    // Position (in units) and the last motion of the path being encoded
+    let inPath = false, x = 0, y = 0, lastDx = 0, lastDy = 0, hasLast = false, repeat = 0;
+
+    const flushRepeat = (bytes) => {
+        if(!repeat)
+            return;
+        bytes.push(TOKEN.REPEAT);
+        pushVarint(bytes, repeat);
+        repeat = 0;
+    }
+
+    const points = (points, end = true) => {
+        const bytes = [];
+        for(const point of points)
+        {
+            if(!inPath)
+            {
+                // Travel to the start of the path with the pen up and place the pen
+                [x, y] = point.map(toUnits);
+                bytes.push(TOKEN.MOVE_TO);
+                pushVarint(bytes, x);
+                pushVarint(bytes, y);
+                bytes.push(TOKEN.PEN_DOWN);
+                pushVarint(bytes, toUnits(penDownZ));
+                inPath = true;
+                lastDx = lastDy = repeat = 0;
+                hasLast = false;
+                continue;
+            }
+
+            const [nextX, nextY] = point.map(toUnits);
+            const dx = nextX - x, dy = nextY - y;
+            x = nextX;
+            y = nextY;
+
+            // Nothing to move
+            if(!dx && !dy)
+                continue;
+
+            // Same motion as last time so just count it
+            if(hasLast && dx === lastDx && dy === lastDy && repeat < MAX_REPEAT)
+            {
+                repeat++;
+                continue;
+            }
+
+            flushRepeat(bytes);
+            bytes.push(TOKEN.MOVE);
+            pushVarint(bytes, zigzag(dx));
+            pushVarint(bytes, zigzag(dy));
+            lastDx = dx;
+            lastDy = dy;
+            hasLast = true;
+        }
+
+        // Lift the pen (An empty path is skipped)
+        if(end && inPath)
+        {
+            flushRepeat(bytes);
+            bytes.push(TOKEN.PEN_UP);
+            pushVarint(bytes, toUnits(penUpZ));
+            inPath = false;
+        }
+        return escapeStream(bytes);
+    }
+
+    return {
+        start: () => escapeStream([STREAM_START]),
+        points,
+        finish: () => escapeStream([TOKEN.END])
+    };
+}
+
+// Encode processed paths (Arrays of [x, y] in steps) into a compact stream
+const encodePaths = (paths, penUpZ = MIN_STEPS_Z, penDownZ = MAX_STEPS_Z) => {
+    const encoder = createStreamEncoder(penUpZ, penDownZ);
+    return Buffer.concat([encoder.start(), ...paths.map(points => encoder.points(points)), encoder.finish()]);
+}
+
+// Encode segments planned by compiler.js. Starts by going to the origin with the pen up as that is where the compiler starts
+// (fromOrigin = false carries on from wherever the machine is, eg. resuming part way through)
+const encodeSegments = (segments, penUpZ = MIN_STEPS_Z, { fromOrigin = true } = {}) => {
+    const bytes = [STREAM_START];
+    if(fromOrigin)
+    {
+        bytes.push(TOKEN.PEN_UP);
+        pushVarint(bytes, toUnits(penUpZ));
+        bytes.push(TOKEN.MOVE_TO);
+        pushVarint(bytes, 0);
+        pushVarint(bytes, 0);
+    }
+
+    for(const segment of segments)
+    {
+        bytes.push(TOKEN.SEGMENT);
+        pushVarint(bytes, segment.dir | (segment.mode << 3) | (segment.flags << 6));
+        for(const steps of segment.steps)
+            pushVarint(bytes, steps);
+        pushVarint(bytes, segment.delayUs);
+    }
+
+    bytes.push(TOKEN.END);
+    return escapeStream(bytes);
+}
+
+// The amount of bytes the same paths take as text coordinates (as sent by index.js)
+const textLength = (paths, penUpZ = MIN_STEPS_Z, penDownZ = MAX_STEPS_Z) => {
+    let length = 0;
+    for(const points of paths)
+    {
+        if(!points.length)
+            continue;
+        const [firstX, firstY] = points[0], [lastX, lastY] = points[points.length - 1];
+        length += `${firstX},${firstY},${penUpZ};`.length + `${firstX},${firstY},${penDownZ};`.length;
+        for(const [x, y] of points.slice(1))
+            length += `${x},${y},${penDownZ};`.length;
+        length += `${lastX},${lastY},${penUpZ};`.length;
+    }
+    return length;
+}
+
+// Scale and Process every path of an image the same way index.js does
+const processImage = (image) => {
+    const transform = fitTransform(getBounds(image), { minX: MIN_STEPS_X, minY: MIN_STEPS_Y, maxX: MAX_STEPS_X, maxY: MAX_STEPS_Y });
+    return Object.values(image).map(points => processPath(applyTransform(points, transform)));
+}
+
+// Report the Compression Ratio of every predefined image
+if(require.main === module)
+{
+    for(const [name, image] of Object.entries(predefinedImages))
+    {
+        if(name === 'generate')
+            continue;
+        const paths = processImage(image);
+        const text = textLength(paths), compact = encodePaths(paths).length;
+        const points = paths.reduce((total, points) => total + points.length, 0);
+        console.log(`${name}: ${points} Points | Text: ${text} Bytes | Compact: ${compact} Bytes | Ratio: ${(text / compact).toFixed(2)}:1`);
+    }
+}
+
+module.exports = {
+    STREAM_START,
+    TOKEN,
+    UNITS_PER_STEP,
+    toUnits,
+    createStreamEncoder,
+    encodePaths,
+    encodeSegments,
+    textLength,
+    processImage
+};
@@ -0,0 +1,175 @@
+/*
+
+    Job Time Estimator
+
+    Models how the firmware actually steps a job: the segments drv_go_to_position plans (compiler.js),
+    the pulse cadence, the direction/mode setup sleep, enabling the drivers and spinning up the spindle
+    after the queue runs dry, how fast the commands arrive over the serial link
+    and which moves get joined or pen moves merged into travel because they were queued before it started
+
+*/
+const { planPosition, mergeQueued } = require('./compiler');
+const { MAX_STEPS_Z, MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, DEFAULT_PROFILE, DRV_STEP_PERIOD_EXTRA_US } = require('./machine');
+
+// Delay between each byte sent by serial.js over the UART
+const BYTE_DELAY_US = 30000;
+// Time for each byte over USB (At worst one 64 byte packet each 1ms frame)
+const USB_BYTE_US = 1000 / 64;
+
+// Rough cost of one iteration of the step loop on top of the pulse sleeps (mask setup & location updates)
+const STEP_LOOP_OVERHEAD_US = 1;
+
+// Estimate a job made of processed paths. format is 'text' (streamed by index.js) or 'replay' (from flash, no link)
+// and transport is how the text is sent ('uart' or 'usb'). The machine is modelled with the limits and timings of its profile (profile.js)
+const estimateJob = (paths, { format = 'text', transport = 'uart', profile = DEFAULT_PROFILE } = {}) => {
+    const byteUs = transport === 'usb' ? USB_BYTE_US : BYTE_DELAY_US;
+    const pending = [MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z];
+    let linkTime = 0; // When the last command finished arriving
+    let machineTime = 0; // When the machine finished the last segment
+
+    // The last segment planned. Until core 1 takes it off the queue the firmware can still merge moves into it
+    let tail = null;
+
+    // Work out when a segment starts and finishes on the machine
+    const time = (segment, from, to, kind) => {
+        // The queue ran dry waiting on the link so the drivers and spindle were turned off and have to be started again
+        const start = Math.max(linkTime, machineTime);
+        const idle = start - machineTime;
+        const enable = idle > 0 || !machineTime ? profile.enableDelayUs + profile.spindleSpinupUs : 0;
+        const record = { kind, from, idleUs: idle };
+        // Core 1 takes a segment that runs straight after another off the queue on the last pulse of that one (process_step_queue),
+        // otherwise as soon as it arrives
+        const taken = idle > 0 || !tail ? start : start - 2 * tail.segment.delayUs - DRV_STEP_PERIOD_EXTRA_US - STEP_LOOP_OVERHEAD_US;
+        tail = { segment, start, taken, enable, record };
+        retime(to);
+        return record;
+    }
+
+    // (Re)work out when the tail finishes, after it was planned or had a move merged into it
+    const retime = (to) => {
+        const { segment, start, enable, record } = tail;
+        const duration = enable + segment.durationUs + Math.max(...segment.steps) * STEP_LOOP_OVERHEAD_US;
+        machineTime = start + duration;
+
+        // Speed across the bed in full steps per second
+        const distance = Math.hypot(to[0] - record.from[0], to[1] - record.from[1]);
+        Object.assign(record, { to, mode: 1 / segment.stepSize, durationUs: duration, speed: distance / (duration / 1e6) });
+    }
+
+    // Where a segment leaves the axes
+    const move = (from, segment) => from.map((value, axis) => value + ((segment.dir >> axis) & 1 ? 1 : -1) * segment.steps[axis] * segment.stepSize);
+
+    // Plan a command and work out when it starts and finishes on the machine
+    const run = (x, y, z, kind) => {
+        const command = `${x},${y},${z};`;
+        if(format === 'text')
+            linkTime += command.length * byteUs;
+
+        const from = pending.slice();
+        const segment = planPosition(pending, [x, y, z], profile);
+        if(!segment)
+            return null;
+
+        // Same as drv_queue_node. The move is merged into the tail if it is still waiting in the queue
+        const merged = tail && linkTime < tail.taken && mergeQueued(tail.segment, segment, profile);
+        if(!merged)
+            return time(segment, from, pending.slice(), kind);
+
+        const [first, rest] = merged;
+        tail.segment = first;
+        if(first.steps[0] || first.steps[1])
+            tail.record.kind = 'travel';
+        if(!rest)
+        {
+            retime(pending.slice());
+            return null;
+        }
+        // The rest of a split travel goes with the drop
+        const split = move(tail.record.from, first);
+        retime(split);
+        return time(rest, split, pending.slice(), 'travel');
+    }
+
+    // Reset the to the Origin (Same as job.js)
+    run(MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, 'travel');
+
+    const estimate = { totalUs: 0, paths: [] };
+    for(const [key, points] of Object.entries(paths))
+    {
+        if(!points.length)
+            continue;
+        const pathStart = machineTime;
+        const segments = [];
+        const push = (segment) => segment && segments.push(segment);
+
+        const [firstX, firstY] = points[0], [lastX, lastY] = points[points.length - 1];
+        push(run(firstX, firstY, MIN_STEPS_Z, 'travel'));
+        push(run(firstX, firstY, MAX_STEPS_Z, 'lift'));
+        for(const [x, y] of points.slice(1))
+            push(run(x, y, MAX_STEPS_Z, 'draw'));
+        push(run(lastX, lastY, MIN_STEPS_Z, 'lift'));
+
+        const sum = (kind) => segments.filter(segment => segment.kind === kind).reduce((total, segment) => total + segment.durationUs, 0);
+        estimate.paths.push({
+            key,
+            totalUs: machineTime - pathStart,
+            drawUs: sum('draw'),
+            travelUs: sum('travel'),
+            liftUs: sum('lift'),
+            idleUs: segments.reduce((total, segment) => total + segment.idleUs, 0),
+            segments
+        });
+    }
+    estimate.totalUs = machineTime;
+    return estimate;
+}
+
+const formatTime = (us) => {
+    const seconds = us / 1e6;
+    return seconds >= 60 ? `${Math.floor(seconds / 60)}m ${(seconds % 60).toFixed(1)}s` : `${seconds.toFixed(2)}s`;
+}
+
+// Print the total and per path breakdown of an estimate
+const printEstimate = (estimate) => {
+    console.log(`Estimated Job Time: ${formatTime(estimate.totalUs)}`);
+    for(const path of estimate.paths)
+    {
+        const speeds = path.segments.filter(segment => segment.kind === 'draw').map(segment => segment.speed);
+        const slowest = speeds.length ? Math.min(...speeds).toFixed(2) : '-';
+        console.log(
+            `  ${path.key}: ${formatTime(path.totalUs)} (Draw ${formatTime(path.drawUs)} | Travel ${formatTime(path.travelUs)} | ` +
+            `Pen ${formatTime(path.liftUs)} | Waiting on Link ${formatTime(path.idleUs)}) ${path.segments.length} Segments, Slowest Draw ${slowest} Steps/s`
+        );
+    }
+}
+
+// Estimate a predefined image
+if(require.main === module)
+{
+    const { processImage } = require('./encoding');
+    const predefinedImages = require('./predefined_images');
+    const args = process.argv.slice(2).filter(arg => !arg.startsWith('--'));
+    const image = predefinedImages[args[0]];
+    if(!image || args[0] === 'generate')
+    {
+        console.log(`Run one of the following commands to estimate an image:\n${
+            Object.keys(predefinedImages)
+                .filter(image => image !== 'generate')
+                .map(image => `yarn estimate ${image} [--replay | --usb]`)
+                .join('\n')
+        }`);
+        return;
+    }
+    const keys = Object.keys(image);
+    const paths = Object.fromEntries(processImage(image).map((points, i) => [keys[i], points]));
+    printEstimate(estimateJob(paths, {
+        format: process.argv.includes('--replay') ? 'replay' : 'text',
+        transport: process.argv.includes('--usb') ? 'usb' : 'uart'
+    }));
+}
+
+module.exports = {
+    estimateJob,
+    printEstimate,
+    formatTime
+};
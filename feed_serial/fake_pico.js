@@ -0,0 +1,285 @@
+/*
+
+    Fake PICO for Testing the Host without a Machine
+
+    Answers the Automated Draw Menu and Headless Mode (menu.h) the way the firmware does: $ commands, text coordinates,
+    compact streams (stream_decoder.h) and the real-time commands a job uses. Movements go into a step queue that empties
+    one every stepMs so a full queue holds the host back like the PICO's does. Positions are in machine coordinates
+    (The work coordinates are taken but not applied) and compiled segments are counted without moving the axes.
+    Run on its own with the paths of pseudo terminals (eg. made with socat) to answer on them, or connect in process with openPort
+
+*/
+const { EventEmitter } = require('events');
+const { STREAM_START, TOKEN, UNITS_PER_STEP } = require('./encoding');
+const { MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, DEFAULT_PROFILE, REALTIME } = require('./machine');
+const { formatProfile } = require('./profile');
+
+// Bytes of a compact stream after STREAM_ESCAPE are XORed with this (Same as stream_decoder.h)
+const STREAM_ESCAPE = 0x7D, STREAM_ESCAPE_XOR = 0x20;
+// Amount of varints after each token
+const OPERANDS = { [TOKEN.END]: 0, [TOKEN.PEN_UP]: 1, [TOKEN.PEN_DOWN]: 1, [TOKEN.MOVE]: 2, [TOKEN.REPEAT]: 1, [TOKEN.MOVE_TO]: 2, [TOKEN.SEGMENT]: 5 };
+// Longest REPEAT the PICO takes (STREAM_MAX_REPEAT)
+const MAX_REPEAT = 127;
+// Longest command (Same as the Automated Draw Menu's buffer)
+const COMMAND_LIMIT = 64;
+
+// Map zig-zag varints back to signed numbers (0, 1, 2, 3 => 0, -1, 1, -2)
+const unzigzag = (value) => value % 2 ? -(value + 1) / 2 : value / 2;
+
+// A fake PICO. capacity is the size of its step queue (QUEUE_CAPACITY) and stepMs how long each movement takes.
+// Every movement it has queued is kept in movements ({ x, y, z } in steps, null for a compiled segment)
+const createFakePico = ({ capacity = 128, stepMs = 1 } = {}) => {
+    const output = new EventEmitter();
+    const pico = {
+        headless: false,
+        recording: false,
+        job: 0,
+        done: 0,
+        name: null,
+        location: [MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z],
+        movements: [],
+        queue: []
+    };
+
+    let buffer = '';
+    // Compact stream being decoded (null when taking text)
+    let stream = null;
+
+    // The PICO's stdio sends every newline as CRLF (PICO_STDIO_DEFAULT_CRLF)
+    const send = (text) => output.emit('data', Buffer.from(text.replace(/\n/g, '\r\n'), 'latin1'));
+
+    // Same as print_status
+    const status = (ok) => {
+        if(!pico.headless)
+            return send(ok ? 'ok\n' : 'error\n');
+        const [x, y, z] = pico.location;
+        const free = Math.max(capacity - pico.queue.length, 0);
+        send(`${ok ? 'ok' : 'error'} x=${x.toFixed(5)} y=${y.toFixed(5)} z=${z.toFixed(5)} a=0.00000 queue=${pico.queue.length} free=${free}\n`);
+    }
+
+    const queueMovement = (target) => {
+        pico.movements.push(target);
+        pico.queue.push(target);
+    }
+
+    // Steps one movement from the queue at a time
+    const timer = setInterval(() => {
+        const target = pico.queue.shift();
+        if(target)
+            pico.location = [target.x, target.y, target.z];
+        if(target !== undefined && pico.job)
+            pico.done++;
+    }, stepMs);
+    timer.unref();
+
+    // Same as handle_machine_command (Only the commands the host sends during a job)
+    const command = (text) => {
+        send('\n');
+        const [name, value] = text.split('=');
+        let ok = true, leave = false;
+        if(!text)
+            send(formatProfile(DEFAULT_PROFILE).split('\n').map(line => `$${line}\n`).join(''));
+        else if(name === 'record')
+            pico.recording = true;
+        else if(name === 'recording')
+            send(`$recording=${+pico.recording}\n$record_ready=${+pico.recording}\n`);
+        else if(name === 'job')
+            [pico.job, pico.done] = [+value, 0];
+        else if(name === 'progress')
+            send(`$job=${pico.job}\n$done=${pico.done}\n`);
+        else if(name === 'menu')
+            ok = leave = pico.headless;
+        else if(!['status', 'wcs_reset'].includes(name) && !(name.startsWith('wcs_') && value !== undefined))
+            ok = false;
+        status(ok);
+        if(leave)
+            pico.headless = false;
+    }
+
+    // Same as the Automated Draw Menu's text coordinates (x,y,z; in work coordinates) and the end of a recording (#name;)
+    const line = (text) => {
+        if(text[0] === '$')
+            return command(text.slice(1));
+        if(text[0] === '#')
+        {
+            pico.name = pico.recording ? text.slice(1) : pico.name;
+            pico.recording = false;
+        }
+        else
+        {
+            const [x, y, z] = text.split(',').map(Number);
+            queueMovement({ x, y, z });
+        }
+        if(pico.headless)
+            status(true);
+    }
+
+    // Same as stream_decoder.c. Returns false once the stream has ended (ended is set if it was by its end token)
+    const decode = (byte) => {
+        if(byte === STREAM_ESCAPE && !stream.escaped)
+            return stream.escaped = true;
+        if(stream.escaped)
+            [byte, stream.escaped] = [byte ^ STREAM_ESCAPE_XOR, false];
+
+        if(stream.token === null)
+        {
+            if(OPERANDS[byte] === undefined)
+                return false;
+            [stream.token, stream.operands, stream.value, stream.shift] = [byte, [], 0, 1];
+        }
+        else
+        {
+            stream.value += (byte & 0x7F) * stream.shift;
+            stream.shift *= 128;
+            if(byte & 0x80)
+                return true;
+            stream.operands.push(stream.value);
+            [stream.value, stream.shift] = [0, 1];
+        }
+        if(stream.operands.length < OPERANDS[stream.token])
+            return true;
+
+        const { token, operands } = stream;
+        stream.token = null;
+        const [x, y, z] = stream.position;
+        if(token === TOKEN.END)
+            return !(stream.ended = true);
+        if(token === TOKEN.PEN_UP || token === TOKEN.PEN_DOWN)
+            stream.position = [x, y, operands[0]];
+        else if(token === TOKEN.MOVE)
+            stream.position = [x + unzigzag(operands[0]), y + unzigzag(operands[1]), z];
+        else if(token === TOKEN.MOVE_TO)
+            stream.position = [operands[0], operands[1], z];
+        if(token === TOKEN.SEGMENT)
+            queueMovement(null);
+        else if(token === TOKEN.REPEAT)
+        {
+            if(!stream.last || operands[0] > MAX_REPEAT)
+                return false;
+            for(let i = 0; i < operands[0]; i++)
+            {
+                stream.position = stream.position.map((value, axis) => value + stream.last[axis]);
+                queueMovement(toSteps(stream.position));
+            }
+        }
+        else
+            queueMovement(toSteps(stream.position));
+        stream.last = token === TOKEN.MOVE ? [unzigzag(operands[0]), unzigzag(operands[1]), 0] : token === TOKEN.REPEAT ? stream.last : null;
+        return true;
+    }
+
+    // Where the axes end up once the queue has been stepped
+    const queuedLocation = () => {
+        const target = pico.queue.filter(Boolean).pop();
+        return target ? [target.x, target.y, target.z] : pico.location;
+    }
+
+    const toSteps = ([x, y, z]) => ({ x: x / UNITS_PER_STEP, y: y / UNITS_PER_STEP, z: z / UNITS_PER_STEP });
+
+    const receive = (byte) => {
+        // Real-time commands are taken anywhere (A stream escapes them)
+        if(byte === REALTIME.HEADLESS)
+        {
+            [buffer, stream, pico.headless] = ['', null, true];
+            return status(true);
+        }
+        if(byte === REALTIME.ABORT)
+        {
+            [buffer, stream, pico.queue] = ['', null, []];
+            return;
+        }
+        if(Object.values(REALTIME).includes(byte))
+            return;
+
+        if(stream)
+        {
+            // A stream that stopped anywhere but its end token was invalid
+            if(!decode(byte))
+            {
+                if(pico.headless)
+                    status(!!stream.ended);
+                stream = null;
+            }
+            return;
+        }
+
+        const ch = String.fromCharCode(byte);
+        if(byte === STREAM_START && !buffer)
+            stream = { token: null, escaped: false, ended: false, position: queuedLocation().map(value => Math.round(value * UNITS_PER_STEP)), last: null };
+        else if(ch === ';')
+        {
+            line(buffer);
+            buffer = '';
+        }
+        else if(ch === '\n' || ch === '\r')
+        {
+            // The menus aren't drawn. Selecting from them is only followed as far as the Stored Jobs Menu's Record New Job (ss then enter)
+            if(buffer === 'ss')
+                pico.recording = true;
+            buffer = '';
+        }
+        else
+            buffer = (buffer + ch).slice(0, COMMAND_LIMIT);
+    }
+
+    pico.receive = (data) => {
+        for(const byte of data)
+            receive(byte);
+    }
+
+    // A port for createConnection (The same calls as a serialport). Writes are answered straight away
+    pico.openPort = () => {
+        const port = new EventEmitter();
+        const forward = (data) => setImmediate(() => port.emit('data', data));
+        port.open = (callback) => {
+            output.on('data', forward);
+            setImmediate(callback);
+        }
+        port.write = (data, callback) => {
+            pico.receive(Buffer.from(data));
+            if(callback)
+                setImmediate(callback);
+            return true;
+        }
+        port.drain = (callback) => setImmediate(callback);
+        port.close = (callback) => {
+            output.off('data', forward);
+            setImmediate(() => {
+                port.emit('close');
+                if(callback)
+                    callback();
+            });
+        }
+        return port;
+    }
+
+    // Answer on a serial device (eg. one end of a socat pseudo terminal pair)
+    pico.listen = (devicePath) => {
+        const SerialPort = require('serialport');
+        const port = new SerialPort(devicePath, { baudRate: 115200 });
+        port.on('data', pico.receive);
+        output.on('data', (data) => port.write(data));
+        return port;
+    }
+
+    return pico;
+}
+
+// Answer on every device path given
+if(require.main === module)
+{
+    const devicePaths = process.argv.slice(2);
+    if(!devicePaths.length)
+        console.log('Usage: yarn fake <device> [<device> ...]\n' +
+            'eg. socat pty,raw,echo=0,link=/tmp/pico0 pty,raw,echo=0,link=/tmp/pico0-host & yarn fake /tmp/pico0\n' +
+            '    PICO_PORTS=/tmp/pico0-host yarn fleet circle');
+    for(const devicePath of devicePaths)
+    {
+        createFakePico().listen(devicePath);
+        console.log(`Answering on ${devicePath}`);
+    }
+}
+
+module.exports = {
+    createFakePico
+};
@@ -0,0 +1,67 @@
+/*
+
+    Runs Jobs on Two Fake PICOs at once through runJob (As fleet.js does) and checks every movement got to them.
+    Each is in Headless Mode with a small step queue so the host has to wait on its replies and for room in the queue
+
+*/
+const assert = require('assert');
+const { createConnection } = require('./serial');
+const { createFakePico } = require('./fake_pico');
+const { runJob, pathCommands } = require('./job');
+const { MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, MAX_STEPS_Z } = require('./machine');
+
+// A square, a single line and a spiral long enough to fill the queue many times over (In 1/32 steps so the compact stream is exact)
+const round = (value) => Math.round(value * 32) / 32;
+const PATHS = [
+    [[1, 1], [2, 1], [2, 2], [1, 2], [1, 1]],
+    [[3, 3], [4.5, 3.25]],
+    Array.from({ length: 200 }, (_, i) => [round(5 + Math.cos(i / 10) * i / 50), round(5 + Math.sin(i / 10) * i / 50)])
+];
+
+const wait = (ms) => new Promise(res => setTimeout(res, ms));
+
+// Run a job on a fake PICO and wait for its queue to empty
+const runFake = async (devicePath, options) => {
+    const pico = createFakePico({ capacity: 24, stepMs: 2 });
+    const connection = createConnection(devicePath, 'usb', () => pico.openPort());
+    await connection.open();
+    await runJob(connection, PATHS, { headless: true, ...options });
+    while(pico.queue.length)
+        await wait(10);
+    await connection.close();
+    return pico;
+}
+
+const sameLocation = (movement, [x, y, z]) => movement.x === x && movement.y === y && movement.z === z;
+
+(async () => {
+    const [text, compact] = await Promise.all([
+        runFake('fake0', { format: 'text', record: true, name: 'test' }),
+        runFake('fake1', { format: 'compact' })
+    ]);
+
+    // Text: the origin then every coordinate of every path, in order
+    const commands = [`${MIN_STEPS_X},${MIN_STEPS_Y},${MIN_STEPS_Z};`, ...PATHS.flatMap(pathCommands)];
+    assert.deepStrictEqual(text.movements, commands.map(command => {
+        const [x, y, z] = command.slice(0, -1).split(',').map(Number);
+        return { x, y, z };
+    }));
+    assert.strictEqual(text.name, 'test');
+    assert.strictEqual(text.recording, false);
+
+    // Compact: the pen goes down at the start of every path and visits each of its points in order (A point that doesn't move isn't sent)
+    const drawn = compact.movements.filter(movement => movement.z === MAX_STEPS_Z);
+    assert.deepStrictEqual(drawn, PATHS.flatMap(points => points
+        .filter(([x, y], i) => !i || x !== points[i - 1][0] || y !== points[i - 1][1])
+        .map(([x, y]) => ({ x, y, z: MAX_STEPS_Z }))));
+
+    // Both end with the pen lifted at the end of the last path
+    const [lastX, lastY] = PATHS[PATHS.length - 1].slice(-1)[0];
+    for(const pico of [text, compact])
+        assert.ok(sameLocation({ x: pico.location[0], y: pico.location[1], z: pico.location[2] }, [lastX, lastY, MIN_STEPS_Z]));
+
+    console.log(`fake_pico_test: Passed (${text.movements.length} Text and ${compact.movements.length} Compact Movements)`);
+})().catch(error => {
+    console.log(`fake_pico_test: Failed\n${error.stack}`);
+    process.exitCode = 1;
+});
@@ -0,0 +1,209 @@
+/*
+
+    Hatch Fill Engine
+
+    Fills the closed paths of an image with parallel hatch lines (even-odd, so a path inside another is a hole).
+    The lines are ordered boustrophedon-style (alternating direction) and joined into continuous pen-down runs
+    wherever the join between neighbouring lines stays inside the shape, so the pen lifts and travels as little as possible
+
+*/
+const { getBounds, fitTransform, applyTransform } = require('./layout');
+
+// Default distance between hatch lines (Steps on the bed) and their angle (Degrees from the X axis)
+const FILL_SPACING = 0.25;
+const FILL_ANGLE = 45;
+// Paths whose ends are within this fraction of the image's size of each other are closed
+const FILL_CLOSE_TOLERANCE = 0.05;
+
+const rotate = ([x, y], cos, sin) => [x * cos - y * sin, x * sin + y * cos];
+
+// Closed paths of the image as rings of numeric points. Open paths (eg. a single line) have no inside so they are skipped
+const closedRings = (paths, tolerance) => Object.values(paths)
+    .filter(points => points.length >= 3)
+    .map(points => points.map(([x, y]) => [+x, +y]))
+    .filter(ring => Math.hypot(ring[0][0] - ring[ring.length - 1][0], ring[0][1] - ring[ring.length - 1][1]) <= tolerance);
+
+// Every edge of the rings (Each ring is closed from its last point back to the first)
+const ringEdges = (rings) => rings.flatMap(ring => ring.map((a, i) => [a, ring[(i + 1) % ring.length]]));
+
+// Even-odd test of a point against the edges
+const isInside = ([x, y], edges) => {
+    let inside = false;
+    for(const [a, b] of edges)
+    {
+        if((a[1] <= y) !== (b[1] <= y) && x < a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]))
+            inside = !inside;
+    }
+    return inside;
+}
+
+// Does the segment p-q cross any edge. The joins start and finish on the outline so meeting an edge
+// right at either end (give or take rounding) doesn't count
+const crossesEdge = (p, q, edges) => {
+    const cross = (u, v) => u[0] * v[1] - u[1] * v[0];
+    const pq = [q[0] - p[0], q[1] - p[1]];
+    return edges.some(([a, b]) => {
+        const ab = [b[0] - a[0], b[1] - a[1]], pa = [a[0] - p[0], a[1] - p[1]];
+        const denominator = cross(pq, ab);
+        if(Math.abs(denominator) <= 1e-9 * Math.hypot(...pq) * Math.hypot(...ab))
+            return false; // Parallel
+        const t = cross(pa, ab) / denominator, u = cross(pa, pq) / denominator;
+        return t > 1e-6 && t < 1 - 1e-6 && u >= 0 && u <= 1;
+    });
+}
+
+// Is the point on one of the edges (Within a tiny distance for rounding)
+const isOnEdge = ([x, y], edges) => edges.some(([a, b]) => {
+    const dx = b[0] - a[0], dy = b[1] - a[1];
+    const t = Math.max(0, Math.min(1, ((x - a[0]) * dx + (y - a[1]) * dy) / (dx * dx + dy * dy)));
+    return Math.hypot(a[0] + t * dx - x, a[1] + t * dy - y) <= 1e-9 * (Math.abs(x) + Math.abs(y) + 1);
+});
+
+// A join between the end of one hatch line and the start of the next has to stay inside the shape (Running along the outline is fine)
+const canJoin = (p, q, edges) => {
+    const middle = [(p[0] + q[0]) / 2, (p[1] + q[1]) / 2];
+    return !crossesEdge(p, q, edges) && (isInside(middle, edges) || isOnEdge(middle, edges));
+}
+
+// Spans of each horizontal scanline inside the edges ([{ y, x0, x1 }] per line, left to right)
+const scanSpans = (edges, spacing) => {
+    const ys = edges.flatMap(([a, b]) => [a[1], b[1]]);
+    const minY = Math.min(...ys), maxY = Math.max(...ys);
+    const lines = [];
+    for(let y = minY + spacing / 2; y < maxY; y += spacing)
+    {
+        // Half open so a vertex on the scanline is only counted once
+        const xs = edges
+            .filter(([a, b]) => (a[1] <= y) !== (b[1] <= y))
+            .map(([a, b]) => a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]))
+            .sort((a, b) => a - b);
+        const spans = [];
+        for(let i = 0; i + 1 < xs.length; i += 2)
+        {
+            if(xs[i + 1] > xs[i])
+                spans.push({ y, x0: xs[i], x1: xs[i + 1], used: false });
+        }
+        lines.push(spans);
+    }
+    return lines;
+}
+
+// Chain the spans into runs. Each run goes along a span, joins to the closest span of the next line it can reach
+// and comes back along it in the other direction
+const chainSpans = (lines, edges) => {
+    const runs = [];
+    for(const [start, spans] of lines.entries())
+    {
+        for(const first of spans)
+        {
+            if(first.used)
+                continue;
+
+            const run = [];
+            let span = first, forwards = true;
+            for(let line = start; span; line++)
+            {
+                span.used = true;
+                run.push(forwards ? [span.x0, span.y] : [span.x1, span.y], forwards ? [span.x1, span.y] : [span.x0, span.y]);
+
+                // The next span starts at whichever end is on the side this one finished
+                const end = run[run.length - 1];
+                forwards = !forwards;
+                const startOf = (next) => forwards ? [next.x0, next.y] : [next.x1, next.y];
+                span = (lines[line + 1] || [])
+                    .filter(next => !next.used && canJoin(end, startOf(next), edges))
+                    .sort((a, b) => Math.abs(startOf(a)[0] - end[0]) - Math.abs(startOf(b)[0] - end[0]))[0];
+            }
+            runs.push(run);
+        }
+    }
+    return runs;
+}
+
+// Order the runs so each starts closest to where the last finished (Runs can be drawn in either direction)
+const orderRuns = (runs) => {
+    const ordered = [];
+    const remaining = [...runs];
+    let position = remaining.length ? remaining[0][0] : [0, 0];
+    while(remaining.length)
+    {
+        let best = 0, bestReversed = false, bestDistance = Infinity;
+        for(const [i, run] of remaining.entries())
+        {
+            const toStart = Math.hypot(run[0][0] - position[0], run[0][1] - position[1]);
+            const toEnd = Math.hypot(run[run.length - 1][0] - position[0], run[run.length - 1][1] - position[1]);
+            if(toStart < bestDistance)
+                [best, bestReversed, bestDistance] = [i, false, toStart];
+            if(toEnd < bestDistance)
+                [best, bestReversed, bestDistance] = [i, true, toEnd];
+        }
+        const [run] = remaining.splice(best, 1);
+        ordered.push(bestReversed ? run.reverse() : run);
+        position = ordered[ordered.length - 1][run.length - 1];
+    }
+    return ordered;
+}
+
+// Hatch the closed paths of an image ({ key: points }). spacing is in the units of the points.
+// Returns the pen-down runs in drawing order as { fill_1: points, fill_2: points, ... }
+const hatchImage = (paths, { spacing, angle = FILL_ANGLE, tolerance } = {}) => {
+    const { maxX, maxY, lowX, lowY } = getBounds(paths);
+    const size = Math.max(maxX - lowX, maxY - lowY);
+    const rings = closedRings(paths, tolerance === undefined ? size * FILL_CLOSE_TOLERANCE : tolerance);
+    if(!rings.length || !(spacing > 0))
+        return {};
+
+    // Turn the shape so the hatch lines are horizontal, hatch it then turn the runs back
+    const radians = angle * Math.PI / 180, cos = Math.cos(radians), sin = Math.sin(radians);
+    const edges = ringEdges(rings.map(ring => ring.map(point => rotate(point, cos, -sin))))
+        .filter(([a, b]) => a[1] !== b[1] || a[0] !== b[0]);
+    const runs = orderRuns(chainSpans(scanSpans(edges, spacing), edges));
+
+    return Object.fromEntries(runs.map((run, i) => [`fill_${i + 1}`, run.map(point => rotate(point, cos, sin))]));
+}
+
+// Pen-down length and travel of runs drawn in order (Travel is the distance between the end of a run and the start of the next)
+const measureRuns = (runs) => {
+    const length = (points) => points.reduce((total, point, i) => i ? total + Math.hypot(point[0] - points[i - 1][0], point[1] - points[i - 1][1]) : 0, 0);
+    return {
+        draw: runs.reduce((total, run) => total + length(run), 0),
+        travel: runs.reduce((total, run, i) => i ? total + length([runs[i - 1][runs[i - 1].length - 1], run[0]]) : 0, 0)
+    };
+}
+
+if(require.main === module)
+{
+    const predefinedImages = require('./predefined_images');
+    const { MAX_STEPS_X, MAX_STEPS_Y, MIN_STEPS_X, MIN_STEPS_Y } = require('./machine');
+    const flags = process.argv.slice(2).filter(arg => arg.startsWith('--'));
+    const args = process.argv.slice(2).filter(arg => !arg.startsWith('--'));
+    const flagValue = (name, fallback) => {
+        const flag = flags.find(flag => flag.startsWith(`--${name}=`));
+        return flag && Number.isFinite(+flag.split('=')[1]) ? +flag.split('=')[1] : fallback;
+    }
+    const spacing = flagValue('fill', FILL_SPACING), angle = flagValue('angle', FILL_ANGLE);
+    const names = args.length ? args : Object.keys(predefinedImages).filter(name => name !== 'generate');
+
+    // Compare the joined runs against drawing every hatch line on its own
+    for(const name of names)
+    {
+        const image = predefinedImages[name];
+        if(!image || name === 'generate')
+        {
+            console.log(`Unknown Image: ${name}`);
+            continue;
+        }
+        const transform = fitTransform(getBounds(image), { minX: MIN_STEPS_X, minY: MIN_STEPS_Y, maxX: MAX_STEPS_X, maxY: MAX_STEPS_Y });
+        const runs = Object.values(hatchImage(image, { spacing: spacing / transform.scale, angle })).map(run => applyTransform(run, transform));
+        const lines = runs.flatMap(run => run.flatMap((point, i) => i % 2 ? [[run[i - 1], point]] : []));
+        const joined = measureRuns(runs), separate = measureRuns(orderRuns(lines));
+        console.log(`${name}: ${lines.length} Hatch Lines in ${runs.length} Runs | Lifts: ${runs.length} (Separate: ${lines.length}) | ` +
+            `Travel: ${joined.travel.toFixed(1)} Steps (Separate: ${separate.travel.toFixed(1)}) | Drawn: ${joined.draw.toFixed(1)} Steps`);
+    }
+}
+
+module.exports = {
+    FILL_SPACING,
+    FILL_ANGLE,
+    hatchImage
+};
@@ -0,0 +1,95 @@
+/*
+
+    Feeds a Queue of Jobs to every attached PICO at once
+
+    Each PICO gets its own connection (with its own pacing) and takes the next job from the queue when it finishes one.
+    Set PICO_PORTS to a comma separated list of devices (eg. socat pseudo terminals) to use them instead of discovered Picos
+
+*/
+const predefinedImages = require('./predefined_images');
+const { getPicoPaths, createConnection } = require('./serial');
+const { processImage } = require('./encoding');
+const { runJob } = require('./job');
+
+// How often the per machine report is printed
+const REPORT_INTERVAL_MS = 5000;
+
+// Print the Utilisation and Throughput of every Machine
+const report = (machines, startTime) => {
+    const elapsed = Math.max(Date.now() - startTime, 1);
+    for(const machine of machines)
+    {
+        const { connection } = machine;
+        // Time spent on jobs, including the one in progress
+        const busyMs = machine.busyMs + (machine.jobStart ? Date.now() - machine.jobStart : 0);
+        console.log(
+            `${connection.path}: ${machine.jobsDone} Jobs (${machine.current || 'idle'}) | ` +
+            `Utilisation: ${(busyMs / elapsed * 100).toFixed(1)}% | ` +
+            `Throughput: ${(connection.bytesWritten / (elapsed / 1000)).toFixed(1)} B/s, ${(machine.points / (elapsed / 1000)).toFixed(2)} Points/s`
+        );
+    }
+}
+
+(async () => {
+
+    // Handle the Command Arguments
+    const flags = process.argv.slice(2).filter(arg => arg.startsWith('--'));
+    const args = process.argv.slice(2).filter(arg => !arg.startsWith('--'));
+    const copiesFlag = flags.find(flag => flag.startsWith('--copies='));
+    const copies = copiesFlag ? Math.max(+copiesFlag.split('=')[1] || 1, 1) : 1;
+    const format = flags.includes('--compiled') ? 'compiled' : flags.includes('--compact') ? 'compact' : 'text';
+
+    const imageNames = args.filter(name => predefinedImages[name] && name !== 'generate');
+    if(!imageNames.length)
+    {
+        console.log(`Run with one or more images to queue them:\nyarn fleet <image> [<image> ...] [--copies=N] [--compact | --compiled]\nImages: ${
+            Object.keys(predefinedImages).filter(image => image !== 'generate').join(', ')
+        }`);
+        return;
+    }
+
+    // Build the Job Queue (Images are processed once and shared by their copies)
+    const processed = Object.fromEntries(imageNames.map(name => [name, processImage(predefinedImages[name])]));
+    const queue = [];
+    for(let copy = 0; copy < copies; copy++)
+        for(const name of imageNames)
+            queue.push({ name, paths: processed[name] });
+
+    // Discover every Machine
+    const devicePaths = await getPicoPaths();
+    if(!devicePaths.length)
+    {
+        console.log('No Picos Found');
+        return;
+    }
+    console.log(`Feeding ${queue.length} Jobs to ${devicePaths.length} Machines: ${devicePaths.join(', ')}`);
+
+    const machines = devicePaths.map(path => ({ connection: createConnection(path), jobsDone: 0, points: 0, busyMs: 0, current: null, jobStart: 0 }));
+    await Promise.all(machines.map(machine => machine.connection.open()));
+
+    const startTime = Date.now();
+    const reportTimer = setInterval(() => report(machines, startTime), REPORT_INTERVAL_MS);
+
+    // Every Machine takes the next job off the queue until it is empty
+    await Promise.all(machines.map(async (machine) => {
+        while(queue.length)
+        {
+            const job = queue.shift();
+            machine.current = job.name;
+            machine.jobStart = Date.now();
+            await runJob(machine.connection, job.paths, { format, name: job.name });
+            const jobMs = Date.now() - machine.jobStart;
+            console.log(`${machine.connection.path}: Finished ${job.name} in ${(jobMs / 1000).toFixed(1)}s`);
+            machine.busyMs += jobMs;
+            machine.jobStart = 0;
+            machine.current = null;
+            machine.jobsDone++;
+            machine.points += job.paths.reduce((total, points) => total + points.length, 0);
+        }
+    }));
+
+    clearInterval(reportTimer);
+    console.log('All Jobs Sent');
+    report(machines, startTime);
+    await Promise.all(machines.map(machine => machine.connection.close()));
+})();
@@ -4,150 +4,333 @@
 
 */
 const fs = require('fs');
+const path = require('path');
 const predefinedImages = require('./predefined_images');
-const { write, open } = require('./serial');
-const { scalePoints } = require('./utils');
+const { getPicoPaths, createConnection } = require('./serial');
+const { jobId, startJob, sendPath, sendStream, sendPathChunks, sendBatch, finishJob, sendRealtime, resumeJob } = require('./job');
+const { getBounds, nestImages, fitTransform } = require('./layout');
+const { MAX_STEPS_X, MAX_STEPS_Y, MAX_STEPS_Z, MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, REALTIME } = require('./machine');
+const { runPipeline, printTimings } = require('./pipeline');
+const { estimateJob, printEstimate } = require('./estimator');
+const { FILL_SPACING, FILL_ANGLE, hatchImage } = require('./fill');
+const { scanPointFile, processPointFile } = require('./point_file');
+const { LIVE_PORT, LIVE_HOST, createStallTracker, startTelemetry, serveLive } = require('./telemetry');
 
-// Set the Min and Max Steps for the PICO board (Same as in pico.h)
-const MAX_STEPS_X = 10, MAX_STEPS_Y = 10, MAX_STEPS_Z = 1, MIN_STEPS_X = 0, MIN_STEPS_Y = 0, MIN_STEPS_Z = 0;
+// The arguments and id of the last job that was started so it can be resumed with --resume
+const CHECKPOINT_FILE = 'checkpoint.json';
+
+// Keys that send Real-Time Commands while a job is being sent
+const REALTIME_KEYS = {
+    '!': REALTIME.FEED_HOLD,
+    '~': REALTIME.CYCLE_START,
+    '+': REALTIME.FEED_OVERRIDE_PLUS,
+    '-': REALTIME.FEED_OVERRIDE_MINUS,
+    '=': REALTIME.FEED_OVERRIDE_RESET
+};
+
+// Forward Key Presses to the PICO as Real-Time Commands. Ctrl+C aborts the job on the PICO before exiting
+const listenForRealtimeKeys = (connection) => {
+    if(!process.stdin.isTTY)
+        return () => {};
+
+    process.stdin.setRawMode(true);
+    process.stdin.resume();
+    const onKey = async (data) => {
+        const key = data.toString('latin1');
+        if(key === '\u0003')
+        {
+            console.log('Aborting...');
+            await sendRealtime(connection, REALTIME.ABORT);
+            process.exit(1);
+        }
+        if(REALTIME_KEYS[key] !== undefined)
+            await sendRealtime(connection, REALTIME_KEYS[key]);
+    }
+    process.stdin.on('data', onKey);
+    console.log('Keys: ! - Hold | ~ - Resume | + / - / = - Feed Override | Ctrl+C - Abort');
+
+    // Stop Listening
+    return () => {
+        process.stdin.off('data', onKey);
+        process.stdin.setRawMode(false);
+        process.stdin.pause();
+    }
+}
+
+// The area the drawing is laid out in. The bed is kept inside the travel limits of the PICO
+const getBed = (profile) => {
+    const bed = {
+        minX: Math.max(MIN_STEPS_X, profile.minSteps[0]),
+        minY: Math.max(MIN_STEPS_Y, profile.minSteps[1]),
+        maxX: Math.min(MAX_STEPS_X, profile.maxSteps[0]),
+        maxY: Math.min(MAX_STEPS_Y, profile.maxSteps[1])
+    };
+    if(profile.stepsPerMm[0] && profile.stepsPerMm[1])
+        console.log(`Bed: ${((bed.maxX - bed.minX) / profile.stepsPerMm[0]).toFixed(1)}mm x ${((bed.maxY - bed.minY) / profile.stepsPerMm[1]).toFixed(1)}mm`);
+    return bed;
+}
+
+// Watch the job as it runs (--live[=[host:]port]). Serves live.html with the planned paths and turns on telemetry
+// (Has to be in the Automated Draw Menu). finish waits for the PICO to stop moving then turns it off
+const watchLive = async (connection, liveFlag, plan) => {
+    if(!liveFlag)
+        return { setPlan: () => {}, finish: async () => {} };
+
+    const [host, port] = liveFlag.includes(':') ? liveFlag.split('=')[1].split(':') : [LIVE_HOST, liveFlag.split('=')[1]];
+    const live = serveLive({ host: host || LIVE_HOST, port: +port || LIVE_PORT, plan });
+    let sending = true, last = null, lastAt = 0, stalls = 0;
+    const track = createStallTracker({ isSending: () => sending });
+    const stop = await startTelemetry(connection, (frame) => {
+        frame = track(frame);
+        if(frame.stalled && !(last && last.stalled))
+            stalls++;
+        last = frame;
+        lastAt = Date.now();
+        live.publish(frame);
+    });
+    if(!stop)
+        console.log('The PICO didn\'t turn on Telemetry');
+
+    return {
+        setPlan: (paths) => live.setPlan({ ...plan, paths }),
+        finish: async () => {
+            sending = false;
+            // Stops waiting if the frames stop coming
+            while(stop && last && last.flags.moving && Date.now() - lastAt < 2000)
+                await new Promise(res => setTimeout(res, 100));
+            if(stop)
+                await stop();
+            live.close();
+            console.log(`Live View: ${stalls} Stalls`);
+        }
+    };
+}
+
+// The plan live.html draws the trail over. Pen down is anywhere past halfway to MAX_STEPS_Z (after the work offset)
+const livePlan = (bed, workCoordinates, paths = []) => ({
+    paths,
+    bed,
+    workCoordinates,
+    penDownZ: (MIN_STEPS_Z + MAX_STEPS_Z) / 2 + (workCoordinates.z || 0)
+});
+
+// Plot a Point File (point_file.js) without ever holding the whole drawing. The first pass finds its bounds,
+// the second processes and sends it a chunk at a time so memory stays the same however large it is
+const plotPointFile = async (file, { format, record, workCoordinates, liveFlag, headless, batch }) => {
+    if(format === 'compiled')
+    {
+        console.log('Point Files are sent as text or --compact (Compiling needs every path up front)');
+        return;
+    }
+    if(!fs.existsSync(file))
+    {
+        console.log(`No Point File at ${file}`);
+        return;
+    }
+
+    const start = Date.now();
+    const { bounds, paths, points } = await scanPointFile(file);
+    console.log(`${file}: ${paths} Paths | ${points} Points | MAX_X: ${bounds.maxX}, MAX_Y: ${bounds.maxY}, LOW_X: ${bounds.lowX}, LOW_Y: ${bounds.lowY}`);
+
+    const connection = createConnection((await getPicoPaths())[0]);
+    await connection.open();
+    await startJob(connection, { record, workCoordinates, headless });
+    const stopListening = listenForRealtimeKeys(connection);
+
+    const { profile } = connection;
+    console.log(connection.profileFetched ? 'Using the Machine Profile of the PICO' : 'No Machine Profile from the PICO. Using the Defaults');
+    const bed = getBed(profile);
+    const transform = fitTransform(bounds, bed);
+    console.log(`Scale: ${transform.scale}`);
+
+    // Only the trail is drawn (The planned paths aren't held)
+    const live = await watchLive(connection, liveFlag, livePlan(bed, workCoordinates));
+
+    let peakHeap = 0;
+    const chunks = (async function* () {
+        for await (const chunk of processPointFile(file, transform))
+        {
+            peakHeap = Math.max(peakHeap, process.memoryUsage().heapUsed);
+            yield chunk;
+        }
+    })();
+    // The paths aren't held so the whole file is one batch (It still only waits for its prefix)
+    let sent = 0;
+    await sendBatch(connection, batch, async () => {
+        sent = await sendPathChunks(connection, chunks, format, format === 'text' ? console.log : () => {});
+    }, console.log);
+
+    await finishJob(connection, { record, name: path.basename(file) });
+    await live.finish();
+    stopListening();
+    console.log(`Sent ${sent} Steps (Originally: ${points} Points) in ${((Date.now() - start) / 1000).toFixed(1)}s | Peak Heap: ${(peakHeap / 1024 / 1024).toFixed(1)}MB`);
+}
 
 (async () => {
 
-    // Handle the Command Arguments
-    const args = process.argv.slice(2);
+    // Handle the Command Arguments. Resuming runs the last job again with the same arguments
+    const resume = process.argv.includes('--resume');
+    if(resume && !fs.existsSync(CHECKPOINT_FILE))
+    {
+        console.log('No Job to Resume');
+        return;
+    }
+    const argv = resume ? JSON.parse(fs.readFileSync(CHECKPOINT_FILE, 'utf8')).argv : process.argv.slice(2);
+    const flags = argv.filter(arg => arg.startsWith('--'));
+    const args = argv.filter(arg => !arg.startsWith('--'));
     const dumpImage = (args[0] || '').toLowerCase() === 'dump';
-    const image = predefinedImages[dumpImage ? args[1] : args[0]];
-    if(!image)
+    const recordJob = flags.includes('--record');
+    const compactStream = flags.includes('--compact');
+    const compiledStream = flags.includes('--compiled');
+    const useCache = !flags.includes('--no-cache');
+    const format = compiledStream ? 'compiled' : compactStream ? 'compact' : 'text';
+    const imageNames = dumpImage ? args.slice(1) : args;
+    const copiesFlag = flags.find(flag => flag.startsWith('--copies='));
+    const copies = copiesFlag ? Math.max(+copiesFlag.split('=')[1] || 1, 1) : 1;
+    const spacingFlag = flags.find(flag => flag.startsWith('--spacing='));
+    const spacing = spacingFlag ? +spacingFlag.split('=')[1] || 0 : 0.25;
+    const fillFlag = flags.find(flag => flag === '--fill' || flag.startsWith('--fill='));
+    const fillSpacing = fillFlag && fillFlag.includes('=') && Number.isFinite(+fillFlag.split('=')[1]) ? +fillFlag.split('=')[1] : FILL_SPACING;
+    const angleFlag = flags.find(flag => flag.startsWith('--angle='));
+    const fillAngle = angleFlag && Number.isFinite(+angleFlag.split('=')[1]) ? +angleFlag.split('=')[1] : FILL_ANGLE;
+    const fileFlag = flags.find(flag => flag.startsWith('--file='));
+    const liveFlag = flags.find(flag => flag === '--live' || flag.startsWith('--live='));
+    const headless = flags.includes('--headless');
+    // Stage each path (or stream) as a batch that starts once this many movements are queued (0 is as many as the PICO holds)
+    const batchFlag = flags.find(flag => flag === '--batch' || flag.startsWith('--batch='));
+    const batch = batchFlag ? (batchFlag.includes('=') ? Math.max(Math.round(+batchFlag.split('=')[1]) || 0, 0) : 0) : undefined;
+
+    // Where the PICO places the job on the bed (Its work coordinates). The job itself is processed the same way wherever it goes
+    const flagNumber = (name) => {
+        const flag = flags.find(flag => flag.startsWith(`--${name}=`));
+        return flag && Number.isFinite(+flag.split('=')[1]) ? +flag.split('=')[1] : undefined;
+    }
+    const placeFlag = flags.find(flag => flag.startsWith('--place='));
+    const [placeX, placeY] = placeFlag ? placeFlag.split('=')[1].split(',').map(value => +value || 0) : [];
+    const workCoordinates = Object.fromEntries(Object.entries({ x: placeX, y: placeY, scale: flagNumber('scale'), rotation: flagNumber('rotate') })
+        .filter(([, value]) => value !== undefined));
+    if(format === 'compiled' && Object.keys(workCoordinates).length)
+    {
+        console.log('Compiled Jobs are planned in machine steps so they can\'t be placed with --place, --scale or --rotate');
+        return;
+    }
+
+    // Point Files are streamed on their own (No dump, nesting, fill, cache or resume as nothing is held whole)
+    if(fileFlag)
+    {
+        await plotPointFile(fileFlag.slice('--file='.length), { format, record: recordJob, workCoordinates, liveFlag, headless, batch });
+        return;
+    }
+    if(!imageNames.length || imageNames.some(name => !predefinedImages[name] || name === 'generate'))
     {
         console.log(`Invalid Image Provided\nRun one of the following commands to run the script:\n${
             Object.keys(predefinedImages)
                 .filter(image => image !== 'generate')
                 .map(image => `yarn start ${image}`)
                 .join('\n')
-        }`);
+        }\nSeveral images (or --copies=N) are nested onto the bed in one job (--spacing=S steps between them)` +
+        `\nClosed paths are hatched with --fill[=S] (S steps between lines) at --angle=A degrees` +
+        `\nThe PICO places the job with --place=X,Y (steps), --scale=S and --rotate=A (degrees) without processing it again` +
+        `\nA job that was cut off carries on from where it got to with yarn start --resume` +
+        `\nVery large drawings are streamed from a point file with yarn start --file=<path> (yarn points)` +
+        `\nWatch the job as it runs with --live[=port] (http://localhost:${LIVE_PORT})` +
+        `\nSkip the PICO's menus with --headless (Every command gets a status line instead)` +
+        `\nStage each path with --batch[=N] so it only starts once N movements are queued (Default is as many as the PICO holds)`);
         return;
     }
+    const imageName = imageNames.join('+');
+
+    // Everything that decides the movements of the job. The PICO tracks its progress under this id
+    const id = jobId({ images: imageNames, copies, spacing, fill: fillFlag ? [fillSpacing, fillAngle] : false, format, workCoordinates });
+    if(!dumpImage && !resume)
+        fs.writeFileSync(CHECKPOINT_FILE, JSON.stringify({ argv: argv.filter(arg => arg !== '--record'), id }));
 
     // Open Serial Connection
-    await open();
+    const connection = createConnection((await getPicoPaths())[0]);
+    await connection.open();
 
-    // Get to the Automated Draw Menu
-    await write("s\n");
-    
-    // Reset the to the Origin
-    await write(`${MIN_STEPS_X},${MIN_STEPS_Y},${MIN_STEPS_Z};`);
+    // Get to the Automated Draw Menu (or start recording) and Reset to the Origin
+    // (When resuming, everything is processed first so the PICO can be asked where the job got to)
+    if(!resume)
+        await startJob(connection, { record: recordJob, id: dumpImage ? 0 : id, workCoordinates, headless });
+    const stopListening = dumpImage ? () => {} : listenForRealtimeKeys(connection);
 
     // Process Points
-    const paths = image;
     const dump = {};
-    
-    // As there are multiple paths with are not connected we need to iterate through each of them seperately to get a good scale
-    const pathIterator = Object.entries(paths);
-    
-    // Setup Scale Variables
-    let maxX = 0, maxY = 0, lowX = Number.MAX_SAFE_INTEGER, lowY = Number.MAX_SAFE_INTEGER;
-    
-    console.log(`Processing ${pathIterator.length} Paths...`)
-    for(const [, pathPoints] of pathIterator)
+
+    // Lay out every image (and copy) on the bed with a uniform scale
+    const { profile } = connection;
+    console.log(connection.profileFetched ? 'Using the Machine Profile of the PICO' : 'No Machine Profile from the PICO. Using the Defaults');
+    const bed = getBed(profile);
+    if(liveFlag && resume)
+        console.log('The Live View starts with the job so it isn\'t shown when resuming');
+    const live = await watchLive(connection, !dumpImage && !resume && liveFlag, livePlan(bed, workCoordinates));
+    const images = [];
+    for(let copy = 0; copy < copies; copy++)
+        for(const name of imageNames)
+            images.push({ name: images.length < imageNames.length ? name : `${name}#${copy + 1}`, paths: predefinedImages[name] });
+    const transforms = nestImages(images.map(image => image.paths), bed, { spacing });
+
+    // Hatch the closed paths of every image before its outlines. The spacing is in steps on the bed so it is scaled into the image
+    if(fillFlag)
     {
-        // Get the Scale of the Current Points   
-        for(const [x, y] of pathPoints)
-        {
-            if(x > maxX) maxX = +x;
-            if(x < lowX) lowX = +x;
-            if(y > maxY) maxY = +y;
-            if(y < lowY) lowY = +y;
-        }
+        for(const [i, image] of images.entries())
+            image.paths = { ...hatchImage(image.paths, { spacing: fillSpacing / transforms[i].scale, angle: fillAngle }), ...image.paths };
     }
-    console.log(`MAX_X: ${maxX}, MAX_Y: ${maxY}, LOW_X: ${lowX}, LOW_Y: ${lowY}`);
 
-    for(const [i, [key, points]] of pathIterator.entries())
+    // As there are multiple paths with are not connected we need to iterate through each of them seperately
+    const entries = images.flatMap((image, i) => Object.entries(image.paths).map(([key, points]) => ({
+        key: images.length > 1 ? `${image.name}/${key}` : key,
+        points,
+        transform: transforms[i]
+    })));
+
+    console.log(`Processing ${entries.length} Paths...`)
+    for(const [i, image] of images.entries())
     {
-        console.log(`Normalising & Scaling Path: ${key} (#${i + 1} / ${pathIterator.length})`);
-        // Normalise, Scale the Points
-        const scaled = scalePoints(points, maxX, maxY, lowX, lowY, MAX_STEPS_X, MAX_STEPS_Y, MIN_STEPS_X, MIN_STEPS_Y);
-        
-        // Dump this path so we can visualise it
-        // dump[key] = scaled;
-
-        // Round so the pico can process
-        // Sometimes the rounded number does not match what it should be. Using Higher Maxes Fixes This
-        const processedPoints = scaled.map(([x, y], i, arr) => {
-            const roundedX = +(Math.round(x * 32.) / 32.).toFixed(5),
-                roundedY = +(Math.round(y * 32.) / 32.).toFixed(5);
-
-            // Bascially If there is no difference in 3 points sequentially remove the middle point
-            if(i > 0 && i < scaled.length - 1)
-            {
-                let previousIndex = i - 1;
-                let [previousX, previousY] = arr[previousIndex];
-                const [nextX, nextY] = scaled[i + 1];
-                
-
-                // If the Previous Step was Removed go back another step
-                while(previousX === MIN_STEPS_X - 1 && previousY === MIN_STEPS_Y - 1)
-                {
-                    [previousX, previousY] = arr[--previousIndex];
-                }
-                    
-                // All Points Match. Remove Middle Element all together
-                if(
-                    (previousX === roundedX && previousY === roundedY) &&
-                    (nextX === roundedX && nextY === roundedY)
-                ) 
-                    return [MIN_STEPS_X - 1, MIN_STEPS_Y - 1];
-
-                // BEWARE: Below will probably fattern out any sharp deviations that stay on one of the same axis
-                // Like: ___/\/\_____
-                // Would Become: _________
-
-                // Remove Redundant Y Movement Instructions
-                if(previousX === roundedX && nextX === roundedX)
-                {
-                    arr[previousIndex][1] = previousY + roundedY - previousY; // Add the extra y 
-                    return [MIN_STEPS_X - 1, MIN_STEPS_Y - 1];
-                }
-                // Remove Redundant X Movement Instructions
-                if(previousY === roundedY && nextY === roundedY)
-                {
-                    arr[previousIndex][0] = previousX + roundedX - previousX; // Add the extra x 
-                    return [MIN_STEPS_X - 1, MIN_STEPS_Y - 1];
-                }
-            }
-            return [roundedX, roundedY];
-        }).filter(([x, y]) => x !== MIN_STEPS_X - 1 && y !== MIN_STEPS_Y - 1);
-        
+        const { maxX, maxY, lowX, lowY } = getBounds(image.paths);
+        console.log(`${image.name}: MAX_X: ${maxX}, MAX_Y: ${maxY}, LOW_X: ${lowX}, LOW_Y: ${lowY} | Scale: ${transforms[i].scale}`);
+    }
+
+    // Normalise, Scale & Round the Paths in Worker Threads while the Earlier Paths are Sent
+    let pathIndex = 0, totalUnderruns = 0;
+    const timings = await runPipeline(entries, async (key, processedPoints, scaledLength) => {
+        console.log(`Normalised & Scaled Path: ${key} (#${++pathIndex} / ${entries.length})`);
         dump[key] = processedPoints;
+        live.setPlan(Object.values(dump));
 
         // Send All the Scaled Points to the PICO
-        console.log(`Sending: ${processedPoints.length} Steps (Originally: ${scaled.length} Steps)`);
+        console.log(`Sending: ${processedPoints.length} Steps (Originally: ${scaledLength} Steps)`);
         
-        if(dumpImage)
-            continue; // Skip the Serial Transmission so we can dump
+        if(dumpImage || resume || format !== 'text')
+            return; // Skip the Serial Transmission so we can dump, resume or send every path at once
         
-        // Get the First and Last Step of the Path so we can handle the Z Lift Accordingly
-        const [firstElementX, firstElementY] = processedPoints.shift(), 
-            [lastElementX, lastElementY] = processedPoints.pop();
+        const underruns = await sendBatch(connection, batch, () => sendPath(connection, processedPoints, console.log), console.log);
+        totalUnderruns += underruns || 0;
+    }, { cache: useCache });
 
-        // Setup the Inital X & Y
-        await write(`${firstElementX},${firstElementY},${MIN_STEPS_Z};`);
-        // Place the Z
-        await write(`${firstElementX},${firstElementY},${MAX_STEPS_Z};`);
+    // Send the rest of the Job from where the PICO got to
+    if(resume && !dumpImage)
+        await resumeJob(connection, Object.values(dump), { id, format, workCoordinates, log: console.log });
+    // Send Every Path as a Compact Stream or as Compiled Segments
+    else if(format !== 'text' && !dumpImage)
+        totalUnderruns += await sendBatch(connection, batch, () => sendStream(connection, Object.values(dump), format, console.log), console.log) || 0;
+    if(batch !== undefined && !dumpImage && !resume)
+        console.log(`Underruns: ${totalUnderruns}`);
 
-        // Iterate Over All the Other Points
-        for(const [i, [x, y]] of processedPoints.entries())
-        {
-            const stepInstruction = `${x},${y},${MAX_STEPS_Z};`
-            await write(stepInstruction);
-            console.log(`${stepInstruction} (#${i + 1})`);
-        }
+    // Finish the Recording and name it after the image
+    if(!dumpImage && !resume)
+        await finishJob(connection, { record: recordJob, name: imageName });
+    await live.finish();
+    stopListening();
 
-        // Handle the Last Element
-        await write(`${lastElementX},${lastElementY},${MAX_STEPS_Z};`);
-        // Lift the Z
-        await write(`${lastElementX},${lastElementY},${MIN_STEPS_Z};`);
-    }
-    fs.writeFileSync('dump.js', `var obj = ${JSON.stringify(dump)}; var loaded = true;`);
+    printTimings(timings);
+
+    // Estimate how long the machine takes (Compact streams are small enough that the link isn't the limit)
+    const estimate = estimateJob(dump, { format: format === 'text' ? 'text' : 'replay', transport: connection.transport, profile });
+    printEstimate(estimate);
+
+    fs.writeFileSync('dump.js', `var obj = ${JSON.stringify(dump)}; var estimate = ${JSON.stringify(estimate)}; var loaded = true;`);
 })();
 
 
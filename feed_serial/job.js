@@ -0,0 +1,432 @@
+/*
+
+    Sends a Processed Job (Paths of [x, y] in steps) over a Serial Connection
+
+    Jobs started with an id are tracked by the PICO (checkpoint.h). It counts every movement of the job that is done
+    and saves the count to flash so a job that was cut off (disconnect or power loss) can carry on from there
+
+*/
+const { encodePaths, encodeSegments, textLength, toUnits, createStreamEncoder } = require('./encoding');
+const { compilePaths } = require('./compiler');
+const { STATUS_PATTERN, fetchProfile, sendCommand, parseValues, parseStatus } = require('./profile');
+const { MAX_STEPS_Z, MIN_STEPS_X, MIN_STEPS_Y, MIN_STEPS_Z, DEFAULT_PROFILE, REALTIME } = require('./machine');
+
+// Headless Mode waits for this much room in the PICO's step queue once it has filled (Its free space, see print_status)
+const QUEUE_REFILL = 16;
+// How often a full queue is asked about again
+const QUEUE_POLL_MS = 50;
+// Longest wait for the reply to a movement (Its status line)
+const REPLY_TIMEOUT_MS = 10000;
+// Most movements in each compact or compiled stream sent in Headless Mode (A path is never split)
+const STREAM_MOVEMENTS = 32;
+
+// Id of a job from everything that decides its movements (FNV-1a of the settings, never 0 as that is no job)
+const jobId = (settings) => {
+    let hash = 2166136261;
+    for(const byte of Buffer.from(JSON.stringify(settings)))
+        hash = Math.imul(hash ^ byte, 16777619) >>> 0;
+    return hash || 1;
+}
+
+// Plan with the Machine Profile of this PICO (Fetched once per connection, the defaults are used if it doesn't reply)
+const loadProfile = async (connection) => {
+    if(connection.profile)
+        return;
+    const profile = await fetchProfile(connection);
+    connection.profile = profile || DEFAULT_PROFILE;
+    connection.profileFetched = !!profile;
+}
+
+// Place the job on the bed with the PICO's work coordinates (wcs.h) so a processed job can be moved, resized or rotated without processing it again.
+// workCoordinates is { x, y, z, scale, rotation } (The work origin on the bed in steps, 1 is unchanged, anticlockwise degrees).
+// Starts from the machine coordinates so anything left out is the same as them
+const setWorkCoordinates = async (connection, workCoordinates = {}) => {
+    await sendCommand(connection, 'wcs_reset');
+    for(const [name, value] of Object.entries(workCoordinates))
+    {
+        if(value !== undefined)
+            await sendCommand(connection, `wcs_${name}=${value}`);
+    }
+}
+
+// Stop the PICO drawing its menus (Headless Mode, menu.h) so every command gets a status line instead.
+// Resolves with the status ({ ok, x, y, z, queue, free }) or null if it didn't reply
+const enterHeadless = async (connection) => {
+    connection.clearReceived();
+    await connection.writeBytes(Buffer.from([REALTIME.HEADLESS]));
+    const reply = await connection.readUntil(STATUS_PATTERN);
+    connection.headless = !!reply;
+    return reply && parseStatus(reply);
+}
+
+// Wait for the status line replying to what was just sent (Headless Mode) then, if the PICO's step queue is full, until it has room again.
+// The queue grows on the PICO's heap so the host is held back by its replies rather than only by the pace of the link.
+// Throws if the PICO replied with an error (A movement it refused or an invalid stream) so the rest of the job isn't sent from the wrong place
+const awaitQueue = async (connection) => {
+    let status = parseStatus(await connection.readUntil(STATUS_PATTERN, REPLY_TIMEOUT_MS) || '');
+    if(status && !status.ok)
+        throw new Error(`${connection.path}: The PICO Refused a Movement`);
+    if(status && !status.free)
+    {
+        do
+        {
+            await new Promise(res => setTimeout(res, QUEUE_POLL_MS));
+            status = parseStatus(await sendCommand(connection, 'status') || '');
+        } while(status && status.free < QUEUE_REFILL);
+    }
+    if(!status)
+        throw new Error(`${connection.path}: No Reply to a Movement`);
+    return status;
+}
+
+// Send a text movement. In Headless Mode it waits for its reply and for room in the queue (The menus don't reply so only the link paces them)
+const sendMovement = async (connection, command) => {
+    if(!connection.headless)
+        return connection.write(command);
+    connection.clearReceived();
+    await connection.write(command);
+    return awaitQueue(connection);
+}
+
+// Send a whole compact or compiled stream. Its end token is replied to in Headless Mode so it waits the same way as a movement
+const sendStreamBytes = async (connection, stream) => {
+    if(!connection.headless)
+        return connection.writeBytes(stream);
+    connection.clearReceived();
+    await connection.writeBytes(stream);
+    return awaitQueue(connection);
+}
+
+// Wait for the PICO to erase the slot it records into. Flash is only erased while the machine is idle, so the job is held back
+// until it has (Movements recorded before then wait in the PICO's RAM and stop the recording if they fill it)
+const awaitRecording = async (connection) => {
+    for(;;)
+    {
+        const values = parseValues(await sendCommand(connection, 'recording') || '');
+        if(!values.recording)
+            throw new Error(`${connection.path}: The PICO isn't Recording`);
+        if(values.record_ready)
+            return;
+        await new Promise(res => setTimeout(res, QUEUE_POLL_MS));
+    }
+}
+
+// Get to the Automated Draw Menu (or Headless Mode) and Reset to the Origin. A job with an id is tracked from here on
+const startJob = async (connection, { record = false, id = 0, workCoordinates = {}, headless = false } = {}) => {
+    if(headless)
+    {
+        // Takes the same commands as the Automated Draw Menu without any menu to get to
+        if(!await enterHeadless(connection))
+            throw new Error(`${connection.path}: No Reply to Headless Mode`);
+        if(record && !(await sendCommand(connection, 'record') || '').includes('\nok'))
+            throw new Error(`${connection.path}: No Free Job Slots. Erase a Job First`);
+    }
+    else if(record)
+    {
+        // Get to the Stored Jobs Menu and Start Recording (Which Opens the Automated Draw Menu)
+        await connection.write("ss\n\n");
+    }
+    else
+    {
+        // Get to the Automated Draw Menu
+        await connection.write("s\n");
+    }
+
+    if(record)
+        await awaitRecording(connection);
+
+    // Reset the to the Origin (In machine coordinates)
+    await setWorkCoordinates(connection);
+    await sendMovement(connection, `${MIN_STEPS_X},${MIN_STEPS_Y},${MIN_STEPS_Z};`);
+
+    await loadProfile(connection);
+
+    // Coordinates from here on are in the job's work coordinates
+    if(Object.keys(workCoordinates).length)
+        await setWorkCoordinates(connection, workCoordinates);
+
+    // Movements queued from here on are counted as part of the job
+    if(id)
+        await sendCommand(connection, `job=${id}`);
+}
+
+// The Text Coordinates of a Single Path, Lifting the Pen around it
+const pathCommands = (points) => {
+    if(!points.length)
+        return [];
+
+    // Get the First and Last Step of the Path so we can handle the Z Lift Accordingly
+    const [firstElementX, firstElementY] = points[0], 
+        [lastElementX, lastElementY] = points[points.length - 1];
+
+    return [
+        // Setup the Inital X & Y then Place the Z
+        `${firstElementX},${firstElementY},${MIN_STEPS_Z};`,
+        `${firstElementX},${firstElementY},${MAX_STEPS_Z};`,
+        // All the Other Points (Including the Last Element)
+        ...points.slice(1).map(([x, y]) => `${x},${y},${MAX_STEPS_Z};`),
+        // Lift the Z
+        `${lastElementX},${lastElementY},${MIN_STEPS_Z};`
+    ];
+}
+
+// Send a Single Path as Text Coordinates, Lifting the Pen around it
+const sendPath = async (connection, points, log = () => {}) => {
+    const commands = pathCommands(points);
+    for(const [i, command] of commands.entries())
+    {
+        await sendMovement(connection, command);
+        if(i > 1 && i < commands.length - 1)
+            log(`${command} (#${i - 1})`);
+    }
+}
+
+// Send compiled segments as a stream (Starting from the origin unless fromOrigin is false, see encodeSegments).
+// Headless Mode splits it into streams of STREAM_MOVEMENTS so the host can wait for room in the queue between them
+const sendSegments = async (connection, segments, fromOrigin = true) => {
+    const size = connection.headless ? STREAM_MOVEMENTS : Math.max(segments.length, 1);
+    for(let start = 0; start < segments.length || !start; start += size)
+        await sendStreamBytes(connection, encodeSegments(segments.slice(start, start + size), MIN_STEPS_Z, { fromOrigin: fromOrigin && !start }));
+}
+
+// Send paths as a compact stream. Headless Mode splits it between paths (Each starts with an absolute MOVE_TO) so the host
+// can wait for room in the queue. A path is about a movement per point with 3 more to get to it and lift the pen
+const sendCompactPaths = async (connection, paths) => {
+    let group = [], movements = 0;
+    for(const points of paths)
+    {
+        if(connection.headless && group.length && movements + points.length + 3 > STREAM_MOVEMENTS)
+        {
+            await sendStreamBytes(connection, encodePaths(group, MIN_STEPS_Z, MAX_STEPS_Z));
+            group = [];
+            movements = 0;
+        }
+        group.push(points);
+        movements += points.length + 3;
+    }
+    await sendStreamBytes(connection, encodePaths(group, MIN_STEPS_Z, MAX_STEPS_Z));
+}
+
+// Send Every Path at once as a Compact Stream or as Segments Compiled on the host
+const sendStream = async (connection, paths, format, log = () => {}) => {
+    if(format === 'compiled')
+    {
+        // Plan Every Segment Here and Send them so the PICO only has to Step them
+        const segments = compilePaths(paths, MIN_STEPS_Z, MAX_STEPS_Z, connection.profile);
+        const stream = encodeSegments(segments, MIN_STEPS_Z);
+        log(`Sending Compiled Stream: ${segments.length} Segments in ${stream.length} Bytes`);
+        await sendSegments(connection, segments);
+    }
+    else
+    {
+        const stream = encodePaths(paths, MIN_STEPS_Z, MAX_STEPS_Z);
+        const text = textLength(paths, MIN_STEPS_Z, MAX_STEPS_Z);
+        log(`Sending Compact Stream: ${stream.length} Bytes (Text: ${text} Bytes, Ratio: ${(text / stream.length).toFixed(2)}:1)`);
+        await sendCompactPaths(connection, paths);
+    }
+}
+
+// Send Paths that arrive in chunks ({ points, end }, end is set on the last chunk of a path) as they come so no path is held whole.
+// format is 'text' or 'compact' (Compiling needs every path up front). Resolves with the amount of points sent
+const sendPathChunks = async (connection, chunks, format = 'text', log = () => {}) => {
+    let sent = 0;
+    if(format === 'compact')
+    {
+        // Headless Mode ends the stream after a path once it holds STREAM_MOVEMENTS and waits for room in the queue before the next
+        const encoder = createStreamEncoder(MIN_STEPS_Z, MAX_STEPS_Z);
+        let movements = 0;
+        await connection.writeBytes(encoder.start());
+        for await (const { points, end } of chunks)
+        {
+            await connection.writeBytes(encoder.points(points, end));
+            sent += points.length;
+            movements += points.length + (end ? 3 : 0);
+            if(connection.headless && end && movements >= STREAM_MOVEMENTS)
+            {
+                await sendStreamBytes(connection, encoder.finish());
+                await connection.writeBytes(encoder.start());
+                movements = 0;
+            }
+        }
+        await sendStreamBytes(connection, encoder.finish());
+        return sent;
+    }
+
+    // Same coordinates as pathCommands. The first point of a path places the pen and the last lifts it
+    let last = null;
+    for await (const { points, end } of chunks)
+    {
+        for(const [x, y] of points)
+        {
+            if(!last)
+                await sendMovement(connection, `${x},${y},${MIN_STEPS_Z};`);
+            const command = `${x},${y},${MAX_STEPS_Z};`;
+            await sendMovement(connection, command);
+            if(last)
+                log(`${command} (#${sent})`);
+            last = [x, y];
+            sent++;
+        }
+        if(end && last)
+        {
+            await sendMovement(connection, `${last[0]},${last[1]},${MIN_STEPS_Z};`);
+            last = null;
+        }
+    }
+    return sent;
+}
+
+// Stage what send queues as one batch so the PICO only starts it once prefix movements are queued (0 waits for as many
+// as its queue should hold) and a slow link can't starve it part way through. Resolves with the underruns of the batch
+// (The times it ran out of movements part way through) or null if it wasn't staged (prefix undefined or the PICO refused it)
+const sendBatch = async (connection, prefix, send, log = () => {}) => {
+    if(prefix === undefined || !(await sendCommand(connection, `batch=${prefix}`) || '').includes('\nok'))
+    {
+        await send();
+        return null;
+    }
+    await send();
+    const reply = await sendCommand(connection, 'commit');
+    if(!reply || !reply.includes('\nok'))
+        return null;
+    const { batch, batch_underruns: underruns } = parseValues(reply);
+    log(`Batch #${batch}: ${underruns} Underruns`);
+    return underruns;
+}
+
+// Finish the Recording and name it (Without any characters the PICO would take as real-time commands)
+const finishJob = async (connection, { record = false, name = '' } = {}) => {
+    if(record)
+        await connection.write(`#${name.replace(/[!~]/g, '').slice(0, 15)};`);
+}
+
+// Send a Real-Time Command (REALTIME in machine.js). It is acted on straight away, even part way through a job
+const sendRealtime = async (connection, command) => connection.writeBytes(Buffer.from([command]));
+
+// What is left of a job once done of its movements (as counted by the PICO) have been done. Resolves with null if the job is complete.
+// Every format is resent from the movement it was cut off at. repeated is the amount of movements at the start that were already
+// done (eg. placing the pen again part way through a path), they go nowhere as the machine is already there
+const remainingJob = (paths, format, profile, done) => {
+    if(format === 'text')
+    {
+        // Every coordinate is a movement
+        const commands = paths.flatMap(pathCommands).slice(done);
+        return commands.length ? { repeated: 0, send: async (connection) => {
+            for(const command of commands)
+                await sendMovement(connection, command);
+        } } : null;
+    }
+
+    if(format === 'compiled')
+    {
+        // The stream goes to the origin with the pen up (2 movements) then every segment is a movement
+        const segments = compilePaths(paths, MIN_STEPS_Z, MAX_STEPS_Z, profile);
+        if(done >= segments.length + 2)
+            return null;
+        const fromOrigin = done < 2;
+        return { repeated: fromOrigin ? done : 0, send: async (connection) =>
+            sendSegments(connection, fromOrigin ? segments : segments.slice(done - 2), fromOrigin) };
+    }
+
+    // Compact. Every path is a MOVE_TO, a PEN_DOWN, a movement for every point that moves (see encodePaths) and a PEN_UP
+    const movements = [];
+    for(const [path, points] of paths.entries())
+    {
+        if(!points.length)
+            continue;
+        movements.push({ path, point: 0, penDown: false }, { path, point: 0, penDown: true });
+        for(const [point, [x, y]] of points.entries())
+        {
+            if(point && (toUnits(x) !== toUnits(points[point - 1][0]) || toUnits(y) !== toUnits(points[point - 1][1])))
+                movements.push({ path, point, penDown: true });
+        }
+        movements.push({ path: path + 1, point: 0, penDown: false, lift: true });
+    }
+    if(done >= movements.length)
+        return null;
+
+    // Carry on from the point the last movement that was done got to. The path is started again from there
+    // (MOVE_TO and PEN_DOWN repeat as the machine is already there) unless the pen hadn't been placed yet
+    const last = done ? movements[done - 1] : { path: 0, point: 0, lift: true };
+    const rest = last.lift ? paths.slice(last.path) : [paths[last.path].slice(last.point), ...paths.slice(last.path + 1)];
+    const repeated = last.lift ? 0 : last.penDown ? 2 : 1;
+    return { repeated, send: async (connection) => sendCompactPaths(connection, rest) };
+}
+
+// Progress of the job the PICO is tracking ({ job, done, x, y, z, location_x, location_y, location_z, saved, restorable, busy }) or null if it didn't reply
+const fetchProgress = async (connection) => {
+    const reply = await sendCommand(connection, 'progress');
+    return reply && reply.includes('\nok') ? parseValues(reply) : null;
+}
+
+// Carry on with a job that was cut off. Resolves with false if the PICO has no progress for the job
+const resumeJob = async (connection, paths, { id, format = 'text', workCoordinates = {}, log = () => {} } = {}) => {
+    // Stop anything left over from before (and get out of a compact stream that was cut off) then get to the Automated Draw Menu
+    await sendRealtime(connection, REALTIME.ABORT);
+    await new Promise(res => setTimeout(res, 500));
+    await connection.write("s\n");
+    await loadProfile(connection);
+
+    const progress = await fetchProgress(connection);
+    if(!progress || progress.job !== id)
+    {
+        log(progress ? `The PICO was last tracking a different job (${progress.job})` : 'No Progress from the PICO');
+        return false;
+    }
+    const remaining = remainingJob(paths, format, connection.profile, progress.done);
+    if(!remaining)
+    {
+        log(`The job has already finished (${progress.done} Movements)`);
+        return true;
+    }
+    log(`Resuming after ${progress.done} Movements`);
+
+    // After a restart the PICO only knows where the axes are from the checkpoint (The steppers were off so assume they didn't move)
+    const restored = !!progress.restorable && (await sendCommand(connection, 'restore') || '').includes('\nok');
+    const [x, y] = restored ? [progress.x, progress.y] : [progress.location_x, progress.location_y];
+
+    // Lift the pen where it is (An abort can stop part way through a movement), travel back to where the last movement that was done
+    // left the axes and put the pen back. The progress is in machine coordinates
+    await setWorkCoordinates(connection);
+    await sendMovement(connection, `${x},${y},${MIN_STEPS_Z};`);
+    await sendMovement(connection, `${progress.x},${progress.y},${MIN_STEPS_Z};`);
+    await sendMovement(connection, `${progress.x},${progress.y},${progress.z};`);
+
+    // Count the rest of the job on from there (Placed on the bed the same way as before)
+    await sendCommand(connection, `resume=${progress.done - remaining.repeated}`);
+    if(Object.keys(workCoordinates).length)
+        await setWorkCoordinates(connection, workCoordinates);
+    await remaining.send(connection, log);
+    return true;
+}
+
+// Send a Whole Job. format is 'text', 'compact' or 'compiled'. Headless Mode waits for the reply to every movement
+const runJob = async (connection, paths, { format = 'text', record = false, name = '', headless = false, log = () => {} } = {}) => {
+    await startJob(connection, { record, headless });
+    if(format === 'text')
+    {
+        for(const points of paths)
+            await sendPath(connection, points, log);
+    }
+    else
+        await sendStream(connection, paths, format, log);
+    await finishJob(connection, { record, name });
+}
+
+module.exports = {
+    jobId,
+    enterHeadless,
+    setWorkCoordinates,
+    startJob,
+    pathCommands,
+    sendPath,
+    sendStream,
+    sendPathChunks,
+    sendBatch,
+    finishJob,
+    sendRealtime,
+    fetchProgress,
+    remainingJob,
+    resumeJob,
+    runJob
+};
@@ -0,0 +1,128 @@
+/*
+
+    Layout Engine
+
+    Fits images onto the bed with a single uniform (aspect preserving) transform worked out from their bounds,
+    and nests several images (or copies of them) onto the bed so they can be plotted in one job.
+    Has no dependencies so visualise.html can load it too
+
+*/
+
+// Get the Bounds of all the Points in every Path of an Image
+const getBounds = (paths) => {
+    let maxX = 0, maxY = 0, lowX = Number.MAX_SAFE_INTEGER, lowY = Number.MAX_SAFE_INTEGER;
+    for(const pathPoints of Object.values(paths))
+    {
+        for(const [x, y] of pathPoints)
+        {
+            if(x > maxX) maxX = +x;
+            if(x < lowX) lowX = +x;
+            if(y > maxY) maxY = +y;
+            if(y < lowY) lowY = +y;
+        }
+    }
+    return { maxX, maxY, lowX, lowY };
+}
+
+// Uniform scale and offset that fits the bounds inside the area ({ minX, minY, maxX, maxY }), centred
+const fitTransform = (bounds, area) => {
+    const width = bounds.maxX - bounds.lowX, height = bounds.maxY - bounds.lowY;
+    const areaWidth = area.maxX - area.minX, areaHeight = area.maxY - area.minY;
+
+    // A flat image (eg. a single line) only constrains the scale on one axis
+    const scales = [];
+    if(width > 0) scales.push(areaWidth / width);
+    if(height > 0) scales.push(areaHeight / height);
+    const scale = scales.length ? Math.min(...scales) : 1;
+
+    return {
+        scale,
+        offsetX: area.minX + (areaWidth - width * scale) / 2 - bounds.lowX * scale,
+        offsetY: area.minY + (areaHeight - height * scale) / 2 - bounds.lowY * scale
+    };
+}
+
+const applyTransform = (points, { scale, offsetX, offsetY }) =>
+    points.map(([x, y]) => [+x * scale + offsetX, +y * scale + offsetY]);
+
+// Place rectangles ({ width, height }) on shelves across the bed at the given scale.
+// Returns the position of each rectangle or null if they don't all fit
+const shelfPack = (sizes, bed, scale, spacing) => {
+    const bedWidth = bed.maxX - bed.minX, bedHeight = bed.maxY - bed.minY;
+
+    // Tallest first keeps the shelves tight
+    const order = sizes.map((size, i) => i).sort((a, b) => sizes[b].height - sizes[a].height);
+    const positions = new Array(sizes.length);
+    let shelfY = 0, shelfHeight = 0, x = 0;
+    for(const i of order)
+    {
+        const width = sizes[i].width * scale, height = sizes[i].height * scale;
+        if(width > bedWidth)
+            return null;
+
+        // Start a new shelf when this one is full
+        if(x > 0 && x + width > bedWidth)
+        {
+            shelfY += shelfHeight + spacing;
+            x = 0;
+            shelfHeight = 0;
+        }
+        if(shelfY + height > bedHeight)
+            return null;
+
+        positions[i] = { x: bed.minX + x, y: bed.minY + shelfY };
+        x += width + spacing;
+        shelfHeight = Math.max(shelfHeight, height);
+    }
+    return positions;
+}
+
+// Nest images (Objects of paths) onto the bed. Each image is normalised so its longest side is the same length,
+// then they share the largest scale that fits them all. Returns a transform for each image in the same order
+const nestImages = (images, bed, { spacing = 0 } = {}) => {
+    const bounds = images.map(getBounds);
+
+    // A single image just needs to fit (and stays centred)
+    if(images.length === 1)
+        return [fitTransform(bounds[0], bed)];
+
+    const normals = bounds.map(b => 1 / (Math.max(b.maxX - b.lowX, b.maxY - b.lowY) || 1));
+    const sizes = bounds.map((b, i) => ({ width: (b.maxX - b.lowX) * normals[i], height: (b.maxY - b.lowY) * normals[i] }));
+
+    // Every image is at most as large as the bed
+    let high = Math.min(bed.maxX - bed.minX, bed.maxY - bed.minY), low = 0;
+    let positions = shelfPack(sizes, bed, high, spacing);
+    if(!positions)
+    {
+        if(!shelfPack(sizes, bed, 0, spacing))
+            throw new Error(`Unable to nest ${images.length} images with a spacing of ${spacing}`);
+
+        // Binary search the largest scale that packs
+        for(let i = 0; i < 40; i++)
+        {
+            const scale = (low + high) / 2;
+            if(shelfPack(sizes, bed, scale, spacing))
+                low = scale;
+            else
+                high = scale;
+        }
+        high = low;
+        positions = shelfPack(sizes, bed, low, spacing);
+    }
+
+    return bounds.map((b, i) => ({
+        scale: high * normals[i],
+        offsetX: positions[i].x - b.lowX * high * normals[i],
+        offsetY: positions[i].y - b.lowY * high * normals[i]
+    }));
+}
+
+if(typeof module !== 'undefined')
+{
+    module.exports = {
+        getBounds,
+        fitTransform,
+        applyTransform,
+        nestImages
+    };
+}
@@ -0,0 +1,74 @@
+// The Area Images are Drawn in and the Pen Up / Down Heights in Steps (Kept inside the travel limits of the machine profile)
+const MAX_STEPS_X = 10, MAX_STEPS_Y = 10, MAX_STEPS_Z = 1, MIN_STEPS_X = 0, MIN_STEPS_Y = 0, MIN_STEPS_Z = 0;
+
+// Stepper Drivers the firmware can be built for, indexed by STEPPER_DRIVER (drivers.h)
+// Microstep modes from the largest step to the smallest with their mode pin levels (bit 0 is mode_0) and timing minimums
+const DRIVERS = [
+    {
+        name: 'DRV8825',
+        modes: [{ step: 1, pins: 0b000 }, { step: 0.5, pins: 0b100 }, { step: 0.25, pins: 0b010 }, { step: 0.125, pins: 0b110 }, { step: 0.0625, pins: 0b001 }, { step: 0.03125, pins: 0b111 }],
+        stepHighNs: 1900, stepLowNs: 1900, setupNs: 650, holdNs: 650, wakeUs: 1700
+    },
+    {
+        name: 'A4988',
+        modes: [{ step: 1, pins: 0b000 }, { step: 0.5, pins: 0b001 }, { step: 0.25, pins: 0b010 }, { step: 0.125, pins: 0b011 }, { step: 0.0625, pins: 0b111 }],
+        stepHighNs: 1000, stepLowNs: 1000, setupNs: 200, holdNs: 200, wakeUs: 1000
+    },
+    {
+        name: 'TMC2208', // Standalone, no full step mode
+        modes: [{ step: 0.5, pins: 0b001 }, { step: 0.25, pins: 0b010 }, { step: 0.125, pins: 0b000 }, { step: 0.0625, pins: 0b011 }],
+        stepHighNs: 100, stepLowNs: 100, setupNs: 20, holdNs: 20, wakeUs: 0
+    }
+];
+
+// Half of the shortest step period of a driver (DRV_STEP_DELAY_MIN_US) and its setup time in whole microseconds (DRV_SETUP_MIN_US)
+const stepDelayMinUs = (driver) => Math.ceil((driver.stepHighNs + driver.stepLowNs) / 2 / 1000);
+const setupMinUs = (driver) => Math.ceil(driver.setupNs / 1000);
+
+// Fastest the default driver can be stepped. Each step period is never shorter than 2 of these (pico.h)
+const DRV_STEP_DELAY_US = stepDelayMinUs(DRIVERS[0]);
+// The step loop waits for one more whole microsecond every step period so it is never short (DRV_STEP_PERIOD_EXTRA_US)
+const DRV_STEP_PERIOD_EXTRA_US = 1;
+
+// The Machine Profile the PICO uses when none has been saved (profile.h & pico.h). Index 0 = X, 1 = Y, 2 = Z, 3 = A (Rotary)
+// The profile of a connected PICO is fetched when a job is started (profile.js)
+const DEFAULT_PROFILE = {
+    driver: 0, // Index into DRIVERS (Read only, the firmware is built for it)
+    stepsPerMm: [0, 0, 0, 0], // Not calibrated
+    maxSteps: [100, 100, 100, 200], // Travel Limits every position is clamped to (A is one turn)
+    minSteps: [0, 0, 0, 0],
+    maxRate: [0, 0, 0, 0], // Full steps per second (0 is only limited by stepDelayUs)
+    acceleration: [0, 0, 0, 0], // Full steps per second^2
+    stepDelayUs: DRV_STEP_DELAY_US, // Each half of a step pulse at full speed
+    directionSetupUs: setupMinUs(DRIVERS[0]), // After setting the direction & mode pins
+    modeSetupUs: setupMinUs(DRIVERS[0]),
+    enableDelayUs: DRIVERS[0].wakeUs, // After enabling the drivers
+    spindleSpinupUs: 200000, // Every time the spindle is turned on
+    waitForInterrupt: true,
+    headless: false // Start in Headless Mode
+};
+
+// Real-Time Commands. Single bytes the PICO acts on straight away (RT_* in pico.h)
+const REALTIME = {
+    FEED_HOLD: 0x21, // '!'
+    CYCLE_START: 0x7E, // '~'
+    ABORT: 0x18, // Ctrl+X
+    FEED_OVERRIDE_RESET: 0x90,
+    FEED_OVERRIDE_PLUS: 0x91,
+    FEED_OVERRIDE_MINUS: 0x92,
+    HEADLESS: 0x93 // Stop drawing the menus and reply to every command (menu.h)
+};
+
+module.exports = {
+    MAX_STEPS_X,
+    MAX_STEPS_Y,
+    MAX_STEPS_Z,
+    MIN_STEPS_X,
+    MIN_STEPS_Y,
+    MIN_STEPS_Z,
+    DRIVERS,
+    DRV_STEP_DELAY_US,
+    DRV_STEP_PERIOD_EXTRA_US,
+    DEFAULT_PROFILE,
+    REALTIME
+};
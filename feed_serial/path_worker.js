@@ -0,0 +1,19 @@
+/*
+
+    Worker Thread that Scales and Processes Paths for pipeline.js
+
+*/
+const { parentPort } = require('worker_threads');
+const { performance } = require('perf_hooks');
+const { processPath } = require('./utils');
+const { applyTransform } = require('./layout');
+
+parentPort.on('message', ({ id, points, transform }) => {
+    const start = performance.now();
+
+    // Place the Points on the Bed then Round so the pico can process and remove redundant points
+    const scaled = applyTransform(points, transform);
+    const processed = processPath(scaled);
+
+    parentPort.postMessage({ id, processed, scaledLength: scaled.length, ms: performance.now() - start });
+});
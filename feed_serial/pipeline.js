@@ -0,0 +1,218 @@
+/*
+
+    Staged Pipeline that Prepares Paths in Worker Threads while Earlier Paths are Streaming
+
+    layout (main thread) -> prepare (worker pool) -> [bounded buffer] -> stream (main thread)
+
+    Paths that have been prepared before are taken from the cache (cache.js) instead of the workers
+
+*/
+const os = require('os');
+const path = require('path');
+const { Worker } = require('worker_threads');
+const { performance } = require('perf_hooks');
+const { cacheKey, readCache, writeCache, pruneCache } = require('./cache');
+
+// Default amount of prepared paths that can wait to be streamed
+const BUFFER_SIZE = 4;
+
+// FIFO that makes producers wait when it is full and consumers wait when it is empty
+class BoundedBuffer {
+    constructor(capacity)
+    {
+        this.capacity = capacity;
+        this.items = [];
+        this.closed = false;
+        this.waiting = []; // Resolvers of whoever is waiting for the buffer to change
+    }
+
+    notify()
+    {
+        const waiting = this.waiting;
+        this.waiting = [];
+        waiting.forEach(res => res());
+    }
+
+    async put(item)
+    {
+        while(this.items.length >= this.capacity)
+            await new Promise(res => this.waiting.push(res));
+        this.items.push(item);
+        this.notify();
+    }
+
+    // Returns undefined once the buffer is closed and empty
+    async take()
+    {
+        while(!this.items.length && !this.closed)
+            await new Promise(res => this.waiting.push(res));
+        const item = this.items.shift();
+        this.notify();
+        return item;
+    }
+
+    close()
+    {
+        this.closed = true;
+        this.notify();
+    }
+}
+
+// Fixed Pool of Workers that each run one task at a time
+class WorkerPool {
+    constructor(size)
+    {
+        this.idle = [];
+        this.tasks = [];
+        this.callbacks = new Map();
+        this.nextId = 0;
+        this.workers = Array.from({ length: size }, () => {
+            const worker = new Worker(path.join(__dirname, 'path_worker.js'));
+            worker.on('message', (result) => {
+                const callback = this.callbacks.get(result.id);
+                this.callbacks.delete(result.id);
+                this.release(worker);
+                callback.res(result);
+            });
+            worker.on('error', (error) => {
+                for(const callback of this.callbacks.values())
+                    callback.rej(error);
+                this.callbacks.clear();
+            });
+            this.idle.push(worker);
+            return worker;
+        });
+    }
+
+    run(task)
+    {
+        return new Promise((res, rej) => {
+            const id = this.nextId++;
+            this.callbacks.set(id, { res, rej });
+            this.tasks.push({ ...task, id });
+            this.dispatch();
+        });
+    }
+
+    release(worker)
+    {
+        this.idle.push(worker);
+        this.dispatch();
+    }
+
+    dispatch()
+    {
+        while(this.idle.length && this.tasks.length)
+            this.idle.pop().postMessage(this.tasks.shift());
+    }
+
+    async destroy()
+    {
+        await Promise.all(this.workers.map(worker => worker.terminate()));
+    }
+}
+
+// Run paths ([{ key, points, transform }] where transform comes from layout.js) through the pipeline.
+// stream(key, processedPoints, scaledLength) is awaited for each path in order
+const runPipeline = async (entries, stream, { workers = Math.max(os.cpus().length - 1, 1), bufferSize = BUFFER_SIZE, cache = true } = {}) => {
+    const timings = { prepare: 0, prepareWall: 0, producerBlocked: 0, stream: 0, streamStarved: 0, total: 0, cacheHits: 0, cacheMisses: 0 };
+    const startTime = performance.now();
+
+    // The workers are only started once a path misses the cache
+    const poolSize = Math.min(workers, Math.max(entries.length, 1));
+    let pool;
+    const buffer = new BoundedBuffer(bufferSize);
+
+    // Stage 2: Prepare the paths in parallel (or take them from the cache), handing them on in order
+    const produce = async () => {
+        const prepareStart = performance.now();
+        const inFlight = [];
+        let next = 0;
+        const submit = () => {
+            const { key, points, transform } = entries[next++];
+            const hash = cache ? cacheKey({ points, transform }) : null;
+            const cached = hash && readCache(hash);
+            if(cached)
+            {
+                timings.cacheHits++;
+                inFlight.push(Promise.resolve({ key, processed: cached.processed, scaledLength: cached.scaledLength, ms: 0 }));
+                return;
+            }
+            if(cache)
+                timings.cacheMisses++;
+            pool = pool || new WorkerPool(poolSize);
+            inFlight.push(pool.run({ points, transform }).then(result => {
+                if(cache)
+                    writeCache(hash, result);
+                return { key, ...result };
+            }));
+        }
+
+        while(next < entries.length && inFlight.length < poolSize)
+            submit();
+        while(inFlight.length)
+        {
+            const result = await inFlight.shift();
+            timings.prepare += result.ms;
+            if(next < entries.length)
+                submit();
+
+            const blockedStart = performance.now();
+            await buffer.put(result);
+            timings.producerBlocked += performance.now() - blockedStart;
+        }
+        buffer.close();
+        timings.prepareWall = performance.now() - prepareStart;
+    }
+
+    // Stage 3: Stream each path as soon as it is ready
+    const consume = async () => {
+        while(true)
+        {
+            const starvedStart = performance.now();
+            const result = await buffer.take();
+            timings.streamStarved += performance.now() - starvedStart;
+            if(!result)
+                break;
+
+            const streamStart = performance.now();
+            await stream(result.key, result.processed, result.scaledLength);
+            timings.stream += performance.now() - streamStart;
+        }
+    }
+
+    try
+    {
+        await Promise.all([produce(), consume()]);
+    }
+    finally
+    {
+        if(pool)
+            await pool.destroy();
+    }
+
+    // Keep the cache from growing forever
+    if(cache)
+        pruneCache();
+    timings.total = performance.now() - startTime;
+    return timings;
+}
+
+// Print how long each stage took and where the time was lost
+const printTimings = (timings) => {
+    const ms = (value) => `${value.toFixed(1)}ms`;
+    console.log(`Pipeline Timings (Total ${ms(timings.total)}):`);
+    console.log(`  Prepare: ${ms(timings.prepare)} of Worker Time over ${ms(timings.prepareWall)} | Blocked on a Full Buffer: ${ms(timings.producerBlocked)}`);
+    console.log(`  Stream:  ${ms(timings.stream)} | Starved by an Empty Buffer: ${ms(timings.streamStarved)}`);
+    if(timings.cacheHits || timings.cacheMisses)
+        console.log(`  Cache:   ${timings.cacheHits} Hits | ${timings.cacheMisses} Misses`);
+    // Whichever stage spent longer working (rather than waiting on the other) held up the pipeline
+    const prepareActive = timings.prepareWall - timings.producerBlocked;
+    console.log(`  Bottleneck: ${timings.stream >= prepareActive ? 'Stream' : 'Prepare'}`);
+}
+
+module.exports = {
+    BoundedBuffer,
+    runPipeline,
+    printTimings
+};
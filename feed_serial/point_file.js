@@ -0,0 +1,188 @@
+/*
+
+    Point Files
+
+    Large drawings are read from point files a chunk at a time instead of being held in memory as JS arrays.
+    One point per line as "x,y" (or "x y"), a blank line between paths and # for comments.
+    A first pass finds the bounds so the drawing can be fitted to the bed, the second streams the paths through the
+    same rounding & filtering as the pipeline (createPathProcessor) so memory stays the same whatever the size of the drawing
+
+*/
+const fs = require('fs');
+const { once } = require('events');
+const { getBounds, fitTransform, applyTransform } = require('./layout');
+const { createPathProcessor } = require('./utils');
+
+// Most points handed on at once and the size of each block read from the file
+const POINT_CHUNK_SIZE = 4096;
+const READ_BLOCK_BYTES = 64 * 1024;
+
+// The lines of a file, a block at a time (The line cut off at the end of a block is carried into the next)
+async function* readLines(file)
+{
+    let rest = '';
+    for await (const block of fs.createReadStream(file, { encoding: 'utf8', highWaterMark: READ_BLOCK_BYTES }))
+    {
+        const lines = (rest + block).split('\n');
+        rest = lines.pop();
+        yield lines;
+    }
+    yield [rest];
+}
+
+// The points of a file as chunks ({ points, end }) of up to chunkSize points. end is set on the last chunk of each path
+async function* readPointFile(file, { chunkSize = POINT_CHUNK_SIZE } = {})
+{
+    let points = [], inPath = false, lineNumber = 0;
+    for await (const lines of readLines(file))
+    {
+        for(const line of lines)
+        {
+            lineNumber++;
+            const text = line.trim();
+            if(text.startsWith('#'))
+                continue;
+
+            // A blank line finishes the path
+            if(!text)
+            {
+                if(inPath)
+                    yield { points, end: true };
+                points = [];
+                inPath = false;
+                continue;
+            }
+
+            const [x, y] = text.split(/[\s,]+/).map(Number);
+            if(!Number.isFinite(x) || !Number.isFinite(y))
+                throw new Error(`${file}:${lineNumber}: Expected a point (x,y) but got "${text}"`);
+            points.push([x, y]);
+            inPath = true;
+
+            if(points.length >= chunkSize)
+            {
+                yield { points, end: false };
+                points = [];
+            }
+        }
+    }
+    if(inPath)
+        yield { points, end: true };
+}
+
+// First Pass. The bounds of every point (Same as getBounds) and the amount of paths and points
+const scanPointFile = async (file) => {
+    let bounds = null, paths = 0, points = 0;
+    for await (const chunk of readPointFile(file))
+    {
+        const chunkBounds = getBounds([chunk.points]);
+        bounds = bounds ? {
+            maxX: Math.max(bounds.maxX, chunkBounds.maxX),
+            maxY: Math.max(bounds.maxY, chunkBounds.maxY),
+            lowX: Math.min(bounds.lowX, chunkBounds.lowX),
+            lowY: Math.min(bounds.lowY, chunkBounds.lowY)
+        } : chunkBounds;
+        points += chunk.points.length;
+        if(chunk.end)
+            paths++;
+    }
+    return { bounds: bounds || getBounds([]), paths, points };
+}
+
+// Second Pass. The chunks of a file placed on the bed by the transform, rounded and filtered (Same as processPath)
+async function* processPointFile(file, transform, options)
+{
+    const processor = createPathProcessor();
+    for await (const { points, end } of readPointFile(file, options))
+    {
+        const processed = processor.push(applyTransform(points, transform));
+        yield { points: end ? [...processed, ...processor.end()] : processed, end };
+    }
+}
+
+// Write paths (Arrays of [x, y] or a generator of them) to a point file. Waits whenever the file can't keep up
+const writePointFile = async (file, paths) => {
+    const stream = fs.createWriteStream(file);
+    const write = async (text) => {
+        if(!stream.write(text))
+            await once(stream, 'drain');
+    }
+    let first = true;
+    for(const points of paths)
+    {
+        if(!first)
+            await write('\n');
+        first = false;
+        for(const [x, y] of points)
+            await write(`${x},${y}\n`);
+    }
+    stream.end();
+    await once(stream, 'finish');
+}
+
+// A spiral with the given amount of points, one turn every 1000 points (To try out very large drawings)
+function* spiralPaths(count)
+{
+    const turn = 1000;
+    function* points()
+    {
+        for(let i = 0; i < count; i++)
+        {
+            const angle = i / turn * 2 * Math.PI, radius = 1 + i / turn;
+            yield [+(radius * Math.cos(angle)).toFixed(4), +(radius * Math.sin(angle)).toFixed(4)];
+        }
+    }
+    yield points();
+}
+
+// Convert a predefined image to a point file, generate a large one or report what a point file holds once processed
+if(require.main === module)
+{
+    (async () => {
+        const predefinedImages = require('./predefined_images');
+        const { MAX_STEPS_X, MAX_STEPS_Y, MIN_STEPS_X, MIN_STEPS_Y } = require('./machine');
+        const flags = process.argv.slice(2).filter(arg => arg.startsWith('--'));
+        const args = process.argv.slice(2).filter(arg => !arg.startsWith('--'));
+        const spiralFlag = flags.find(flag => flag.startsWith('--spiral='));
+
+        if(args.length === 2 && predefinedImages[args[0]] && args[0] !== 'generate')
+        {
+            await writePointFile(args[1], Object.values(predefinedImages[args[0]]));
+            console.log(`Wrote ${args[0]} to ${args[1]}`);
+            return;
+        }
+        if(args.length === 1 && spiralFlag)
+        {
+            const count = Math.max(+spiralFlag.split('=')[1] || 0, 1);
+            await writePointFile(args[0], spiralPaths(count));
+            console.log(`Wrote a spiral of ${count} Points to ${args[0]}`);
+            return;
+        }
+        if(args.length !== 1 || !fs.existsSync(args[0]))
+        {
+            console.log('Usage: yarn points <shape> <file> | yarn points --spiral=N <file> | yarn points <file>');
+            return;
+        }
+
+        const start = Date.now();
+        let peakHeap = 0;
+        const { bounds, paths, points } = await scanPointFile(args[0]);
+        const transform = fitTransform(bounds, { minX: MIN_STEPS_X, minY: MIN_STEPS_Y, maxX: MAX_STEPS_X, maxY: MAX_STEPS_Y });
+        let processed = 0;
+        for await (const chunk of processPointFile(args[0], transform))
+        {
+            processed += chunk.points.length;
+            peakHeap = Math.max(peakHeap, process.memoryUsage().heapUsed);
+        }
+        console.log(`${args[0]}: ${paths} Paths | ${points} Points (${processed} once Processed) | Scale: ${transform.scale}`);
+        console.log(`Took ${Date.now() - start}ms | Peak Heap: ${(peakHeap / 1024 / 1024).toFixed(1)}MB`);
+    })();
+}
+
+module.exports = {
+    POINT_CHUNK_SIZE,
+    readPointFile,
+    scanPointFile,
+    processPointFile,
+    writePointFile
+};
@@ -0,0 +1,119 @@
+/*
+
+    Machine Profile of a PICO (profile.h)
+
+    The travel limits, rates and driver timings are read over serial with $ commands in the Automated Draw menu
+    so the host plans and estimates with the same values as the machine. Run on its own to view or change them
+
+*/
+const { DEFAULT_PROFILE } = require('./machine');
+
+const AXES = ['x', 'y', 'z', 'a'];
+
+// Reply lines sent for every value ($name=value) and the line that ends a reply
+// (In Headless Mode the line goes on with the position and queue space, see parseStatus)
+const VALUE_PATTERN = /\$(\w+)=(-?[\d.]+(?:e[-+]?\d+)?)/g;
+const REPLY_END_PATTERN = /(?:^|\n)(ok|error)( [^\r\n]*)?\r?\n/;
+const STATUS_PATTERN = /(?:^|\n)(ok|error) x=(\S+) y=(\S+) z=(\S+)(?: a=(\S+))? queue=(\d+) free=(\d+)\r?\n/;
+
+// The Names used by the PICO are snake case and end with the axis (max_steps_x => maxSteps[0])
+const toField = (name) => name.replace(/_(\w)/g, (match, letter) => letter.toUpperCase());
+const toName = (field, axis) => field.replace(/[A-Z]/g, letter => `_${letter.toLowerCase()}`) + (axis === undefined ? '' : `_${AXES[axis]}`);
+
+// The $name=value lines of a reply as { name: value }
+const parseValues = (text) => Object.fromEntries([...text.matchAll(VALUE_PATTERN)].map(([, name, value]) => [name, +value]));
+
+// The last Headless Mode status line of a reply as { ok, x, y, z, queue, free } or null if there isn't one
+const parseStatus = (text) => {
+    const match = [...text.matchAll(new RegExp(STATUS_PATTERN, 'g'))].pop();
+    if(!match)
+        return null;
+    const [, status, x, y, z, a = 0, queue, free] = match;
+    return { ok: status === 'ok', x: +x, y: +y, z: +z, a: +a, queue: +queue, free: +free };
+}
+
+// Build a profile from the $name=value lines of a reply. Anything missing keeps its default
+const parseProfile = (text) => {
+    const profile = JSON.parse(JSON.stringify(DEFAULT_PROFILE));
+    for(const [, name, value] of text.matchAll(VALUE_PATTERN))
+    {
+        const axis = AXES.indexOf(name.slice(-1));
+        if(name[name.length - 2] === '_' && axis >= 0 && Array.isArray(profile[toField(name.slice(0, -2))]))
+            profile[toField(name.slice(0, -2))][axis] = +value;
+        else if(typeof profile[toField(name)] === 'boolean')
+            profile[toField(name)] = value !== '0';
+        else if(toField(name) in profile)
+            profile[toField(name)] = +value;
+    }
+    return profile;
+}
+
+// Send a $ command and wait for the PICO to finish replying. Resolves with the reply or null if there was none
+const sendCommand = async (connection, command, timeoutMs = 2000) => {
+    connection.clearReceived();
+    await connection.write(`$${command};`);
+    return connection.readUntil(REPLY_END_PATTERN, timeoutMs);
+}
+
+// Fetch the profile of the PICO (Has to be in the Automated Draw Menu). Resolves with null if it didn't reply
+const fetchProfile = async (connection) => {
+    const reply = await sendCommand(connection, '');
+    if(!reply || !reply.includes('\nok'))
+        return null;
+    return parseProfile(reply);
+}
+
+// Save the profile to the PICO's flash (Refused while it is moving)
+const saveProfile = async (connection) => {
+    const reply = await sendCommand(connection, 'save', 5000);
+    return !!reply && reply.includes('\nok');
+}
+
+// Every value of a profile as name=value lines
+const formatProfile = (profile) => Object.entries(profile)
+    .flatMap(([field, value]) => Array.isArray(value) ? value.map((axisValue, axis) => `${toName(field, axis)}=${axisValue}`) : [`${toName(field)}=${+value}`])
+    .join('\n');
+
+// View or change the profile of the first PICO
+if(require.main === module)
+{
+    (async () => {
+        const { getPicoPaths, createConnection } = require('./serial');
+        const flags = process.argv.slice(2).filter(arg => arg.startsWith('--'));
+        const changes = process.argv.slice(2).filter(arg => !arg.startsWith('--'));
+        if(changes.some(change => !/^\w+=[-\d.]+$/.test(change)))
+        {
+            console.log('Usage: yarn profile [name=value ...] [--save]\nRun without any values to view the profile (eg. yarn profile max_rate_x=200 max_rate_y=200 --save)');
+            return;
+        }
+
+        const connection = createConnection((await getPicoPaths())[0]);
+        await connection.open();
+        // Get to the Automated Draw Menu
+        await connection.write("s\n");
+
+        for(const change of changes)
+        {
+            const [name, value] = change.split('=');
+            const reply = await sendCommand(connection, `${name}=${value}`);
+            console.log(`${name}=${value}: ${reply && reply.includes('\nok') ? 'ok' : 'error'}`);
+        }
+        if(flags.includes('--save'))
+            console.log(`Save: ${await saveProfile(connection) ? 'ok' : 'error'}`);
+
+        const profile = await fetchProfile(connection);
+        console.log(profile ? formatProfile(profile) : 'No Reply from the PICO');
+        await connection.close();
+    })();
+}
+
+module.exports = {
+    STATUS_PATTERN,
+    parseValues,
+    parseStatus,
+    parseProfile,
+    sendCommand,
+    fetchProfile,
+    saveProfile,
+    formatProfile
+};
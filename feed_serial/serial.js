@@ -1,45 +1,303 @@
+/*
+
+    Serial Connections to the PICOs
+
+    Commands go over the PICO's own USB CDC (pico_stdio_usb) when it is attached, otherwise over UART0 through a probe
+    or USB to serial adapter. The PICO replies (and sends telemetry) over whichever one the last command came from.
+    Run on its own to measure the sustained movement throughput of every attached PICO over each transport
+
+*/
 const SerialPort = require('serialport')
 
 let serialPort;
 
+// Speed of the UART (PICO_BAUD_RATE). 10 bits a byte with the start and stop bits
+const BAUD_RATE = 115200;
+
+// Delay between each byte that is sent over the UART
+// NOTE: This timeout is required so that the pico can actually read all the characters being passed
+const BYTE_DELAY_MS = 30;
+
+// Product Id of the PICO's own USB CDC (The Pico SDK's stdio USB). Anything else from Raspberry Pi (eg. a Picoprobe) is a UART bridge.
+// Over USB the PICO reads whole packets and holds the host back itself (USB flow control) so nothing is paced
+const USB_PRODUCT_ID = '000a';
+
+// Most received text kept waiting to be read
+const RECEIVE_LIMIT = 64 * 1024;
+
+// Transport of every path that has been found ('usb' or 'uart')
+const transports = new Map();
+
+// Every attached Pico port as { path, transport }. A Pico attached over both shows up once for each
+// PICO_PORTS (comma separated) overrides discovery so pseudo terminals can stand in for Picos (Paced like the UART unless PICO_TRANSPORT=usb)
+const listPicos = async () => {
+    const picos = process.env.PICO_PORTS
+        ? process.env.PICO_PORTS.split(',').filter(Boolean).map(path => ({ path, transport: process.env.PICO_TRANSPORT || 'uart' }))
+        : (await SerialPort.list())
+            .filter(device => device.manufacturer === 'Raspberry Pi')
+            .map(device => ({ path: device.path, transport: (device.productId || '').toLowerCase() === USB_PRODUCT_ID ? 'usb' : 'uart' }));
+    for(const { path, transport } of picos)
+        transports.set(path, transport);
+    return picos;
+}
+
+// Gets the Serial Device Paths of every attached Pico. USB is used when any are attached over it
+// (PICO_TRANSPORT=uart or usb picks one instead)
+const getPicoPaths = async () => {
+    const picos = await listPicos();
+    const transport = process.env.PICO_TRANSPORT || (picos.some(pico => pico.transport === 'usb') ? 'usb' : 'uart');
+    return picos.filter(pico => pico.transport === transport).map(pico => pico.path);
+}
+
 // Gets the Serial Device Path for Our Pico
 const getPicoPath = async () => {
-    const devices = await SerialPort.list();
-    return devices.find(device => device.manufacturer === 'Raspberry Pi').path;
+    const [path] = await getPicoPaths();
+    return path;
 }
 
-// Async function that data (characters in our case) over the Serial Connection with a pause
-// NOTE: This timeout is required so that the pico can actually read all the characters being passed
-const _write = async (data) => {
-    return new Promise(res => setTimeout(() => serialPort.write(data, res), 30));
-}
+// Opens the serial port of a connection (A test can open a fake PICO's instead, see fake_pico.js)
+const openSerialPort = (devicePath, options) => new SerialPort(devicePath, options);
+
+// A Connection to a single Pico. Each connection paces its own writes so several can stream at once
+const createConnection = (devicePath, transport = transports.get(devicePath) || 'uart', openPort = openSerialPort) => {
+    let port;
+    const connection = {
+        path: devicePath,
+        transport,
+        // Amount of bytes sent and the time spent sending them
+        bytesWritten: 0,
+        busyMs: 0,
+        // Is the PICO in Headless Mode (Set by job.js). Movements then wait for their reply and for room in its step queue
+        headless: false
+    };
+
+    // Everything the PICO has sent that hasn't been read yet (Menu drawing included)
+    let received = '';
+    let onReceived = () => {};
+    // Filters get every chunk of bytes before it is taken as text and return the bytes that are text (eg. telemetry.js)
+    const filters = new Set();
+
+    // Async function that data (characters in our case) over the Serial Connection with a pause
+    const _write = async (data) => {
+        return new Promise(res => setTimeout(() => port.write(data, res), BYTE_DELAY_MS));
+    }
+
+    // Write each byte on its own and keep track of how long the connection was busy for
+    const writeEach = async (bytes) => {
+        const start = Date.now();
+        for(const byte of bytes)
+            await _write(Buffer.from([byte]));
+        connection.bytesWritten += bytes.length;
+        connection.busyMs += Date.now() - start;
+    }
+
+    // Write every byte at once and wait for them to be taken (USB)
+    const writeAll = async (bytes) => {
+        const start = Date.now();
+        await new Promise(res => port.write(bytes, () => port.drain(res)));
+        connection.bytesWritten += bytes.length;
+        connection.busyMs += Date.now() - start;
+    }
+
+    const send = (bytes) => transport === 'usb' ? writeAll(bytes) : writeEach(bytes);
+
+    // Async function that Sends a string as characters over the Serial Connection
+    // NOTE: Over the UART the Pico only seems to like recieving 1 byte at a time within the given time frame. Even though the Serial Connection is configured for this
+    connection.write = async (data) => send(Buffer.from(data, 'latin1'));
+
+    // Async function that Sends raw bytes (eg. a compact stream) over the Serial Connection
+    connection.writeBytes = async (buffer) => send(buffer);
 
-// Async function that Sends a string as characters over the Serial Connection
-// NOTE: The Pico only seems to like recieving 1 byte at a time within the given time frame. Even though the Serial Connection is configured for this
-const write = async (data) => {
-    for(const ch of data)
-        await _write(ch);
+    // Send a string all at once even over the UART. Only as much as the PICO's UART FIFO holds (32 bytes) should be waiting on
+    // a reply at any time as it can't read while it is replying (see measureThroughput)
+    connection.writeUnpaced = async (data) => writeAll(Buffer.from(data, 'latin1'));
+
+    // Async function that opens the Serial Connection with a Delay
+    connection.open = async () => {
+        port = openPort(devicePath, {
+            baudRate: BAUD_RATE,
+            dataBits: 8,
+            stopBits: 1,
+            parity: "none",
+            autoOpen: true
+        });
+
+        port.on('data', (data) => {
+            for(const filter of filters)
+                data = filter(data);
+            received = (received + data.toString('latin1')).slice(-RECEIVE_LIMIT);
+            onReceived();
+        });
+
+        port.on('close', (e) => {
+            console.log(`Closed Serial Connection ${devicePath} (${transport.toUpperCase()}, Error ${!!e})`);
+        });
+
+        return new Promise(res => port.open(() => setTimeout(res, 1000)));
+    }
+
+    // Add a filter for the received bytes. Returns a function that removes it
+    connection.addFilter = (filter) => {
+        filters.add(filter);
+        return () => filters.delete(filter);
+    }
+
+    // Forget everything that has been received so far
+    connection.clearReceived = () => {
+        received = '';
+    }
+
+    // Wait until the received text matches the pattern. Resolves with the text up to and including the match
+    // (which is removed from what has been received) or null if nothing matched within the timeout
+    connection.readUntil = async (pattern, timeoutMs = 2000) => new Promise(res => {
+        const check = () => {
+            const match = pattern.exec(received);
+            if(!match)
+                return false;
+            const end = match.index + match[0].length;
+            const text = received.slice(0, end);
+            received = received.slice(end);
+            finish(text);
+            return true;
+        }
+        const timer = setTimeout(() => finish(null), timeoutMs);
+        const finish = (text) => {
+            clearTimeout(timer);
+            onReceived = () => {};
+            res(text);
+        }
+        if(!check())
+            onReceived = check;
+    });
+
+    connection.close = async () => new Promise(res => port.close(() => res()));
+
+    return connection;
 }
 
-// Async function that opens the Serial Connection with a Delay
+// Async function that opens the Serial Connection to the first Pico
 const open = async () => {
-    const devicePath = await getPicoPath();
-    serialPort = new SerialPort(devicePath, {
-        baudRate: 115200,
-        dataBits: 8,
-        stopBits: 1,
-        parity: "none",
-        autoOpen: true
-    });
+    serialPort = createConnection(await getPicoPath());
+    return serialPort.open();
+}
 
-    serialPort.on('close', (e) => {
-        console.log(`Closed Serial Connection (Error ${!!e})`);
-    });
+const write = async (data) => serialPort.write(data);
+
+const writeBytes = async (buffer) => serialPort.writeBytes(buffer);
+
+// Sustained command throughput of a connection. Movements are sent in Headless Mode and every status line is waited for,
+// for about seconds. They go back and forth by the smallest step along Y where the axes are, so each one turns around, never
+// merges and queues a node of its own. Over USB they are sent in batches. Over the UART they aren't paced: each is sent at the
+// full baud rate and waits for its reply before the next (The PICO's FIFO can't hold a batch while it replies).
+// Resolves with { commands, seconds, sent, received } (Bytes)
+const measureThroughput = async (connection, { seconds = 5, batch = 16 } = {}) => {
+    const { STATUS_PATTERN, parseStatus } = require('./profile');
+    const { REALTIME } = require('./machine');
+    const usb = connection.transport === 'usb';
+    const send = usb ? connection.write : connection.writeUnpaced;
+    if(!usb)
+        batch = 1;
+
+    // Every command gets a status line in Headless Mode
+    connection.clearReceived();
+    await connection.writeBytes(Buffer.from([REALTIME.HEADLESS]));
+    if(!await connection.readUntil(STATUS_PATTERN))
+        throw new Error(`${connection.path}: No Reply to Headless Mode`);
+    const sendCommand = async (command) => {
+        connection.clearReceived();
+        await connection.write(`$${command};`);
+        return connection.readUntil(STATUS_PATTERN);
+    }
+
+    // Movements are in work coordinates so start from the machine coordinates
+    await sendCommand('wcs_reset');
+    let status = parseStatus(await sendCommand('status') || '');
+    if(!status)
+        throw new Error(`${connection.path}: No Reply to $status;`);
+    const { x, y, z } = status;
+    const movements = [`${x},${y},${z};`, `${x},${y >= 1 ? y - 1 / 32 : y + 1 / 32},${z};`];
+
+    let commands = 0, received = 0, polled = 0;
+    const sentBefore = connection.bytesWritten;
+    const start = Date.now();
+    while(Date.now() - start < seconds * 1000)
+    {
+        let text = '';
+        for(let i = 0; i < batch; i++)
+            text += movements[(commands + i + 1) % 2];
+        await send(text);
+        for(let i = 0; i < batch; i++)
+        {
+            const reply = await connection.readUntil(STATUS_PATTERN, 10000);
+            if(!reply)
+                throw new Error(`${connection.path}: Missed a Reply after ${commands} Commands`);
+            received += reply.length;
+            commands++;
+            status = parseStatus(reply) || status;
+        }
+
+        // Wait for room in the step queue (Its status polls aren't counted)
+        while(status.free < batch)
+        {
+            await new Promise(res => setTimeout(res, 10));
+            const reply = await sendCommand('status');
+            if(!reply)
+                throw new Error(`${connection.path}: No Reply to $status;`);
+            status = parseStatus(reply);
+            polled += reply.length;
+        }
+    }
+    const elapsed = (Date.now() - start) / 1000;
+
+    await connection.write('$menu;');
+    await connection.readUntil(STATUS_PATTERN);
+    return { commands, seconds: elapsed, sent: connection.bytesWritten - sentBefore, received: received + polled };
+}
+
+// Measure every attached PICO over each transport it is attached by and compare them
+if(require.main === module)
+{
+    (async () => {
+        const secondsFlag = process.argv.find(arg => arg.startsWith('--seconds='));
+        const seconds = secondsFlag ? Math.max(+secondsFlag.split('=')[1] || 0, 1) : 5;
+        const picos = await listPicos();
+        if(!picos.length)
+        {
+            console.log('No PICOs Found. Usage: yarn throughput [--seconds=N]');
+            return;
+        }
 
-    return new Promise(res => serialPort.open(() => setTimeout(res, 1000)));
+        const rates = {};
+        for(const { path, transport } of picos)
+        {
+            const connection = createConnection(path, transport);
+            await connection.open();
+            try
+            {
+                const result = await measureThroughput(connection, { seconds });
+                const rate = result.commands / result.seconds;
+                rates[transport] = Math.max(rates[transport] || 0, rate);
+                console.log(`${path} (${transport.toUpperCase()}${transport === 'usb' ? '' : ` at ${BAUD_RATE} baud, ${BAUD_RATE / 10}B/s`}): ` +
+                    `${result.commands} Movements in ${result.seconds.toFixed(1)}s | ${rate.toFixed(1)} Movements/s | ` +
+                    `Sent ${(result.sent / result.seconds).toFixed(0)}B/s | Received ${(result.received / result.seconds).toFixed(0)}B/s`);
+            }
+            catch(error)
+            {
+                console.log(error.message);
+            }
+            await connection.close();
+        }
+        if(rates.usb && rates.uart)
+            console.log(`USB Sustained ${(rates.usb / rates.uart).toFixed(1)}x the Movements of the UART`);
+    })();
 }
 
 module.exports = {
     open,
-    write
-};
\ No newline at end of file
+    write,
+    writeBytes,
+    listPicos,
+    getPicoPaths,
+    createConnection,
+    measureThroughput
+};
@@ -0,0 +1,206 @@
+/*
+
+    Live Telemetry
+
+    While telemetry is on ($telemetry=<hz>;) the PICO sends a small binary frame (telemetry.h) at a fixed rate with where
+    the axes are, how full the step queue is, which movement is being stepped and the state of the machine.
+    Frames are mixed in with the text replies so they are split back out of what is received. A frame that fails its
+    checksum (eg. a reply was printed part way through it) is left as text and dropped.
+    serveLive serves live.html which draws the trail the machine actually took over the planned paths as the frames arrive,
+    with the points where it stalled or ran out of movements marked
+
+*/
+const fs = require('fs');
+const path = require('path');
+const http = require('http');
+const { sendCommand } = require('./profile');
+
+// Frame Layout (telemetry.h)
+const TELEMETRY_SYNC = [0xA5, 0x5A];
+const TELEMETRY_VERSION = 1;
+const TELEMETRY_FRAME_SIZE = 38;
+const TELEMETRY_MAX_RATE_HZ = 50;
+// Positions are in units of 1/32 step (STREAM_UNITS_PER_STEP)
+const TELEMETRY_UNITS_PER_STEP = 32;
+// TELEMETRY_FLAG_ bits in order
+const TELEMETRY_FLAGS = ['moving', 'hold', 'aborting', 'spindle', 'jogging', 'replaying', 'recording', 'drivers'];
+
+// Frames per second while a job is watched
+const TELEMETRY_RATE_HZ = 20;
+// Moving (and not held) without the position changing for this long is a stall
+const STALL_MS = 250;
+// Port live.html is served on
+const LIVE_PORT = 8080;
+// Only this machine can open the live view unless another address is asked for (eg. 0.0.0.0 for every interface)
+const LIVE_HOST = '127.0.0.1';
+
+// Fletcher-16 (Same as telemetry_checksum)
+const checksum = (bytes) => {
+    let sum0 = 0, sum1 = 0;
+    for(const byte of bytes)
+    {
+        sum0 = (sum0 + byte) % 255;
+        sum1 = (sum1 + sum0) % 255;
+    }
+    return (sum1 << 8) | sum0;
+}
+
+// Decode the frame at the start of the bytes or null if it isn't a valid one
+const decodeFrame = (bytes) => {
+    if(bytes.length < TELEMETRY_FRAME_SIZE || bytes[0] !== TELEMETRY_SYNC[0] || bytes[1] !== TELEMETRY_SYNC[1] || bytes[2] !== TELEMETRY_VERSION)
+        return null;
+    if(bytes.readUInt16LE(TELEMETRY_FRAME_SIZE - 2) !== checksum(bytes.subarray(0, TELEMETRY_FRAME_SIZE - 2)))
+        return null;
+
+    const flags = bytes[3];
+    return {
+        flags: Object.fromEntries(TELEMETRY_FLAGS.map((name, bit) => [name, !!(flags & (1 << bit))])),
+        timeMs: bytes.readUInt32LE(4),
+        // In steps
+        x: bytes.readInt32LE(8) / TELEMETRY_UNITS_PER_STEP,
+        y: bytes.readInt32LE(12) / TELEMETRY_UNITS_PER_STEP,
+        z: bytes.readInt32LE(16) / TELEMETRY_UNITS_PER_STEP,
+        queueLength: bytes.readUInt16LE(20),
+        feedOverride: bytes.readUInt16LE(22),
+        sequenceActive: bytes.readUInt32LE(24),
+        sequenceDone: bytes.readUInt32LE(28),
+        sequenceQueued: bytes.readUInt32LE(32)
+    };
+}
+
+// A filter for the received bytes (connection.addFilter) that calls onFrame with every valid frame and returns the rest.
+// Bytes that could be the start of a frame are held back until the rest of it arrives
+const createTelemetryReader = (onFrame) => {
+    let pending = Buffer.alloc(0);
+    return (data) => {
+        const bytes = pending.length ? Buffer.concat([pending, data]) : data;
+        const text = [];
+        let start = 0, i = 0;
+        pending = Buffer.alloc(0);
+        while(i < bytes.length)
+        {
+            if(bytes[i] !== TELEMETRY_SYNC[0])
+            {
+                i++;
+                continue;
+            }
+            // Wait for the rest (A lone sync byte at the end could still be a frame too)
+            if(bytes.length - i < TELEMETRY_FRAME_SIZE && (i + 1 === bytes.length || bytes[i + 1] === TELEMETRY_SYNC[1]))
+            {
+                pending = Buffer.from(bytes.subarray(i));
+                break;
+            }
+            const frame = decodeFrame(bytes.subarray(i, i + TELEMETRY_FRAME_SIZE));
+            if(!frame)
+            {
+                i++;
+                continue;
+            }
+            text.push(bytes.subarray(start, i));
+            onFrame(frame);
+            i += TELEMETRY_FRAME_SIZE;
+            start = i;
+        }
+        text.push(bytes.subarray(start, i));
+        return Buffer.concat(text);
+    }
+}
+
+// Marks frames where the machine stalled (moving without getting anywhere) or was starved (nothing queued while the
+// host still has movements to send, eg. the link can't keep up). Returns a function that adds stalled / starved to a frame
+const createStallTracker = ({ stallMs = STALL_MS, isSending = () => false } = {}) => {
+    let last = null, stillSinceMs = 0;
+    return (frame) => {
+        const still = last && last.x === frame.x && last.y === frame.y && last.z === frame.z;
+        if(!still)
+            stillSinceMs = frame.timeMs;
+        last = frame;
+        const held = frame.flags.hold || frame.flags.aborting;
+        return {
+            ...frame,
+            stalled: frame.flags.moving && !held && (frame.timeMs - stillSinceMs) >>> 0 >= stallMs,
+            starved: !frame.flags.moving && !held && isSending()
+        };
+    }
+}
+
+// Turn telemetry on ($telemetry=<hz>;, has to be in the Automated Draw Menu) and call onFrame with every frame.
+// Resolves with a function that turns it off again or null if the PICO didn't take the rate
+const startTelemetry = async (connection, onFrame, { rate = TELEMETRY_RATE_HZ } = {}) => {
+    const removeFilter = connection.addFilter(createTelemetryReader(onFrame));
+    const reply = await sendCommand(connection, `telemetry=${Math.min(Math.max(Math.round(rate), 1), TELEMETRY_MAX_RATE_HZ)}`);
+    if(!reply || !reply.includes('\nok'))
+    {
+        removeFilter();
+        return null;
+    }
+    return async () => {
+        await sendCommand(connection, 'telemetry=0');
+        removeFilter();
+    }
+}
+
+// Serve live.html. The planned paths ({ paths, bed, workCoordinates, penDownZ }) are fetched from /plan and frames are
+// pushed to /events as Server-Sent Events as they are published
+const serveLive = ({ port = LIVE_PORT, host = LIVE_HOST, plan = {} } = {}) => {
+    const clients = new Set();
+    const files = { '/': 'live.html', '/layout.js': 'layout.js' };
+    const server = http.createServer((request, response) => {
+        const url = request.url.split('?')[0];
+        if(url === '/plan')
+        {
+            response.writeHead(200, { 'Content-Type': 'application/json' });
+            response.end(JSON.stringify(plan));
+        }
+        else if(url === '/events')
+        {
+            response.writeHead(200, { 'Content-Type': 'text/event-stream', 'Cache-Control': 'no-cache', Connection: 'keep-alive' });
+            response.write('\n');
+            clients.add(response);
+            request.on('close', () => clients.delete(response));
+        }
+        else if(files[url])
+        {
+            response.writeHead(200, { 'Content-Type': url.endsWith('.js') ? 'text/javascript' : 'text/html' });
+            fs.createReadStream(path.join(__dirname, files[url])).pipe(response);
+        }
+        else
+        {
+            response.writeHead(404);
+            response.end();
+        }
+    });
+    server.listen(port, host);
+    console.log(`Live View: http://${host === LIVE_HOST ? 'localhost' : host}:${port}`);
+
+    return {
+        // Replace the planned paths (Pages that are open reload them)
+        setPlan: (next) => {
+            plan = next;
+            for(const client of clients)
+                client.write('event: plan\ndata: {}\n\n');
+        },
+        publish: (frame) => {
+            const event = `data: ${JSON.stringify(frame)}\n\n`;
+            for(const client of clients)
+                client.write(event);
+        },
+        close: () => {
+            for(const client of clients)
+                client.end();
+            server.close();
+        }
+    };
+}
+
+module.exports = {
+    TELEMETRY_FRAME_SIZE,
+    TELEMETRY_RATE_HZ,
+    LIVE_PORT,
+    LIVE_HOST,
+    decodeFrame,
+    createTelemetryReader,
+    createStallTracker,
+    startTelemetry,
+    serveLive
+};
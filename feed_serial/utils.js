@@ -1,4 +1,5 @@
 const { transform } = require('pathologist');
+const { getBounds } = require('./layout');
 
 
 // Apply All Transforms to the SVG paths
@@ -16,32 +17,56 @@ const rescale = (value, maxCurrentScale, minCurrentScale, maxNewScale, minNewSca
     return minNewScale + (value - minCurrentScale) * ((maxNewScale - minNewScale) / (maxCurrentScale - minCurrentScale))
 }
  
-// Scale an Array of Points From their previous scale to a new scale
-const scalePoints = (points, maxX, maxY, minX, minY, maxXBounds, maxYBounds, minXBounds, minYBounds) => {
-    const scaledPoints = [];
-    for(const [x, y] of points)
-    {
-        const scaledX = rescale(+x, maxX, minX, maxXBounds, minXBounds);
-        const scaledY = rescale(+y, maxY, minY, maxYBounds, minYBounds);
-
-        // If the scale is outside of scope reduce that axis bounds by 10%
-        if(scaledX > maxXBounds || scaledX < minXBounds)
-        {
-            return scalePoints(points, maxX, maxY, minX, minY, 
-                maxXBounds - (maxXBounds * 0.1), maxYBounds, minXBounds + (minXBounds * 0.1), minYBounds);
-        }
-        if(scaledY > maxYBounds || scaledY < minYBounds)
-        {
-            return scalePoints(points, maxX, maxY, minX, minY, 
-                maxXBounds, maxYBounds - (maxYBounds * 0.1), minXBounds, minYBounds + (minYBounds * 0.1));
+// Round a Scaled Value to the Smallest Step the PICO can take (1/32)
+// Sometimes the rounded number does not match what it should be. Using Higher Maxes Fixes This
+const roundToStep = (value) => +(Math.round(value * 32.) / 32.).toFixed(5);
+
+// Does middle lie on the line between previous and next and carry on the same way (eg. along an edge, not back on itself)
+const isStraight = (previous, middle, next) => [0, 1].some(axis =>
+    previous[axis] === middle[axis] && middle[axis] === next[axis] &&
+    Math.sign(middle[1 - axis] - previous[1 - axis]) === Math.sign(next[1 - axis] - middle[1 - axis]));
+
+// Round Scaled Points to the Smallest Step the PICO can take (1/32) and remove redundant points, for a path that can arrive
+// in chunks (eg. from a point file) so the whole path is never held. Points that round to the same step as the one before them
+// are dropped, then a point is dropped when it is on a straight X or Y run between the last point kept and the next one.
+// A point where the direction changes (a corner) is always kept. Only the last point kept and the one waiting on its next are held.
+// push(points) returns the points that are final so far and end() returns the rest once the path is finished
+const createPathProcessor = () => {
+    let last = null, current = null;
+    return {
+        push: (scaled) => {
+            const processed = [];
+            for(const [x, y] of scaled)
+            {
+                const next = [roundToStep(x), roundToStep(y)];
+                if(current && next[0] === current[0] && next[1] === current[1])
+                    continue;
+                // The first point is always kept
+                if(current && !(last && isStraight(last, current, next)))
+                    processed.push(last = current);
+                current = next;
+            }
+            return processed;
+        },
+        // The last point is always kept
+        end: () => {
+            const processed = current ? [current] : [];
+            last = current = null;
+            return processed;
         }
-        scaledPoints.push([scaledX, scaledY]);
-    }
-    return scaledPoints;
+    };
+}
+
+// Process a whole path at once (Same as createPathProcessor)
+const processPath = (scaled) => {
+    const processor = createPathProcessor();
+    return [...processor.push(scaled), ...processor.end()];
 }
 
 module.exports = {
-    scalePoints,
+    getBounds,
+    processPath,
+    createPathProcessor,
     rescale,
     pathologiseSVG
 };
\ No newline at end of file
@@ -0,0 +1,46 @@
+/*
+
+    Checks the Rounding and Filtering of Paths (processPath and createPathProcessor)
+
+*/
+const assert = require('assert');
+const predefinedImages = require('./predefined_images');
+const { processImage } = require('./encoding');
+const { processPath, createPathProcessor } = require('./utils');
+
+// Rectangles traced a step at a time come out as their corners
+assert.deepStrictEqual(processImage(predefinedImages.multi_rect), [
+    [[0, 0], [10, 0], [10, 10], [0, 10], [0, 0]],
+    [[2.5, 2.5], [7.5, 2.5], [7.5, 7.5], [2.5, 7.5], [2.5, 2.5]]
+]);
+
+// Points that round to the same step are one point, and the corner after them is kept
+assert.deepStrictEqual(processPath([[0, 0], [1, 0], [1.001, 0.001], [1, 1]]), [[0, 0], [1, 0], [1, 1]]);
+
+// A run that turns back on itself keeps the point it turns at
+assert.deepStrictEqual(processPath([[0, 0], [2, 0], [1, 0], [3, 0]]), [[0, 0], [2, 0], [1, 0], [3, 0]]);
+
+// A path that never moves is a single point
+assert.deepStrictEqual(processPath([[1, 1], [1, 1], [1.01, 1]]), [[1, 1]]);
+assert.deepStrictEqual(processPath([]), []);
+
+// A path processed in chunks of any size comes out the same as when processed whole
+const paths = [
+    ...Object.values(predefinedImages.multi_rect).map(points => points.map(([x, y]) => [x / 100, y / 100])),
+    predefinedImages.rabbit.rabbit_path.map(([x, y]) => [x / 60, y / 60]),
+    Array.from({ length: 500 }, (_, i) => [Math.round(Math.cos(i) * 3) / 8, Math.round(Math.sin(i / 3) * 3) / 8])
+];
+for(const points of paths)
+{
+    for(const size of [1, 2, 3, 7, 64, points.length])
+    {
+        const processor = createPathProcessor();
+        const chunked = [];
+        for(let start = 0; start < points.length; start += size)
+            chunked.push(...processor.push(points.slice(start, start + size)));
+        chunked.push(...processor.end());
+        assert.deepStrictEqual(chunked, processPath(points), `Chunks of ${size}`);
+    }
+}
+
+console.log('utils_test: Passed');
@@ -0,0 +1,126 @@
+#include "flash_store.h"
+#include <string.h>
+
+#if PICO_ON_DEVICE
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#else
+// RAM Backed Stand-In for Host Builds
+static uint8_t flash_store_ram[FLASH_STORE_SIZE];
+static bool flash_store_ram_initialized;
+
+static void flash_store_ram_init(void)
+{
+    // Fresh flash reads as erased
+    if(!flash_store_ram_initialized)
+    {
+        memset(flash_store_ram, FLASH_STORE_ERASED, FLASH_STORE_SIZE);
+        flash_store_ram_initialized = true;
+    }
+}
+#endif
+
+void flash_store_erase(uint32_t offset, uint32_t length)
+{
+    #if PICO_ON_DEVICE
+    // Core 1 runs from flash so it has to be parked while the flash is busy
+    // and no interrupts may run on this core either (they also live in flash)
+    multicore_lockout_start_blocking();
+    uint32_t interrupts = save_and_disable_interrupts();
+    flash_range_erase(FLASH_STORE_OFFSET + offset, length);
+    restore_interrupts(interrupts);
+    multicore_lockout_end_blocking();
+    #else
+    flash_store_ram_init();
+    memset(flash_store_ram + offset, FLASH_STORE_ERASED, length);
+    #endif
+}
+
+void flash_store_program(uint32_t offset, const uint8_t *data, uint32_t length)
+{
+    #if PICO_ON_DEVICE
+    multicore_lockout_start_blocking();
+    uint32_t interrupts = save_and_disable_interrupts();
+    flash_range_program(FLASH_STORE_OFFSET + offset, data, length);
+    restore_interrupts(interrupts);
+    multicore_lockout_end_blocking();
+    #else
+    // Programming can only clear bits, same as the real flash
+    flash_store_ram_init();
+    for(uint32_t i = 0; i < length; i++)
+        flash_store_ram[offset + i] &= data[i];
+    #endif
+}
+
+const uint8_t *flash_store_read(uint32_t offset)
+{
+    #if PICO_ON_DEVICE
+    return (const uint8_t *)(XIP_BASE + FLASH_STORE_OFFSET + offset);
+    #else
+    flash_store_ram_init();
+    return flash_store_ram + offset;
+    #endif
+}
+
+bool flash_writer_open(flash_writer_t *writer, uint32_t offset, uint32_t length)
+{
+    // Only whole sectors can be erased
+    if(offset % FLASH_STORE_SECTOR_SIZE || length % FLASH_STORE_SECTOR_SIZE || offset + length > FLASH_STORE_SIZE)
+        return false;
+
+    flash_store_erase(offset, length);
+    return flash_writer_begin(writer, offset, length);
+}
+
+bool flash_writer_begin(flash_writer_t *writer, uint32_t offset, uint32_t length)
+{
+    // Pages are programmed in place so the region has to start on one
+    if(offset % FLASH_STORE_PAGE_SIZE || offset + length > FLASH_STORE_SIZE)
+        return false;
+
+    writer->start = offset;
+    writer->length = length;
+    writer->position = 0;
+    memset(writer->page, FLASH_STORE_ERASED, FLASH_STORE_PAGE_SIZE);
+    return true;
+}
+
+bool flash_writer_write(flash_writer_t *writer, const void *data, uint32_t length)
+{
+    if(writer->position + length > writer->length)
+        return false;
+
+    const uint8_t *bytes = (const uint8_t *)data;
+    while(length)
+    {
+        // Fill what is left of the current page
+        uint32_t page_index = writer->position % FLASH_STORE_PAGE_SIZE;
+        uint32_t amount = FLASH_STORE_PAGE_SIZE - page_index;
+        if(amount > length) amount = length;
+
+        memcpy(writer->page + page_index, bytes, amount);
+        writer->position += amount;
+        bytes += amount;
+        length -= amount;
+
+        // Program the page once it is full
+        if(page_index + amount == FLASH_STORE_PAGE_SIZE)
+        {
+            flash_store_program(writer->start + writer->position - FLASH_STORE_PAGE_SIZE, writer->page, FLASH_STORE_PAGE_SIZE);
+            memset(writer->page, FLASH_STORE_ERASED, FLASH_STORE_PAGE_SIZE);
+        }
+    }
+    return true;
+}
+
+void flash_writer_close(flash_writer_t *writer)
+{
+    // Program the partial page. Unused bytes are left as erased
+    uint32_t page_index = writer->position % FLASH_STORE_PAGE_SIZE;
+    if(page_index)
+    {
+        flash_store_program(writer->start + writer->position - page_index, writer->page, FLASH_STORE_PAGE_SIZE);
+        memset(writer->page, FLASH_STORE_ERASED, FLASH_STORE_PAGE_SIZE);
+    }
+}
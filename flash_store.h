@@ -0,0 +1,53 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+// Persistent Storage in a Reserved Region at the end of the PICO's Flash
+// On the PICO this is the QSPI flash. On host builds (PICO_ON_DEVICE == 0) a RAM buffer stands in for it
+// so the writer can be exercised without hardware. Both follow NOR flash rules (erase to 0xFF, program clears bits)
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+// Size and Offset (from the start of flash) of the Reserved Region. Must be a multiple of the sector size
+// Holds the job checkpoints (checkpoint.h) in the first two sectors, the machine profile (profile.h) in the third
+// followed by the job slots (jobs.h). The first checkpoint sector was added in front so everything else stayed where it was
+#define FLASH_STORE_SIZE            (524 * 1024)
+#define FLASH_STORE_OFFSET          (PICO_FLASH_SIZE_BYTES - FLASH_STORE_SIZE)
+
+// Smallest Erasable and Programmable Units of the Flash
+#define FLASH_STORE_SECTOR_SIZE     4096
+#define FLASH_STORE_PAGE_SIZE       256
+
+// Value of a byte after it has been erased
+#define FLASH_STORE_ERASED          0xFF
+
+// Buffers writes into whole pages so that data of any length can be streamed into a region
+typedef struct {
+    uint32_t start; // Offset of the region being written (relative to the start of the store)
+    uint32_t length; // Length of the region being written
+    uint32_t position; // The amount of bytes written into the region (including those still in the page buffer)
+    uint8_t page[FLASH_STORE_PAGE_SIZE]; // Data waiting to be programmed
+} flash_writer_t;
+
+// Erase a sector aligned region of the store
+void flash_store_erase(uint32_t offset, uint32_t length);
+// Program a page aligned region of the store. The region should have been erased first
+void flash_store_program(uint32_t offset, const uint8_t *data, uint32_t length);
+// Returns a pointer to the data stored at the offset (Memory mapped, so it can be read directly)
+const uint8_t *flash_store_read(uint32_t offset);
+
+// Erase the region and prepare the writer to fill it. Returns false if the region is not sector aligned or is out of bounds
+bool flash_writer_open(flash_writer_t *writer, uint32_t offset, uint32_t length);
+// Prepare the writer to fill a region without erasing it (The caller erases each part before the writer reaches it).
+// Doesn't touch the flash so it can be called from anywhere. Returns false if the region is not page aligned or is out of bounds
+bool flash_writer_begin(flash_writer_t *writer, uint32_t offset, uint32_t length);
+// Append data to the region. Returns false if the data does not fit in what is left of the region
+bool flash_writer_write(flash_writer_t *writer, const void *data, uint32_t length);
+// Program any partially filled page left in the buffer
+void flash_writer_close(flash_writer_t *writer);
+
+#endif // FLASH_STORE_H
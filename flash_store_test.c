@@ -0,0 +1,112 @@
+#include "flash_store.h"
+#include <stdio.h>
+#include <string.h>
+
+// Host Test of the Flash Store (Built with PICO_PLATFORM=host, see CMakeLists.txt)
+// Runs against the RAM backed stand-in, which follows the same NOR flash rules as the PICO's flash
+
+static int failures;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if(condition)
+        return;
+    printf("flash_store_test.c:%d: %s\n", line, text);
+    failures++;
+}
+
+// Is every byte of the region erased
+static bool is_erased(uint32_t offset, uint32_t length)
+{
+    const uint8_t *bytes = flash_store_read(offset);
+    for(uint32_t i = 0; i < length; i++)
+        if(bytes[i] != FLASH_STORE_ERASED)
+            return false;
+    return true;
+}
+
+static void test_program_and_erase(void)
+{
+    // Fresh flash reads as erased
+    CHECK(is_erased(0, FLASH_STORE_SIZE));
+
+    // Programming can only clear bits
+    uint8_t page[FLASH_STORE_PAGE_SIZE];
+    memset(page, 0xF0, FLASH_STORE_PAGE_SIZE);
+    flash_store_program(FLASH_STORE_SECTOR_SIZE, page, FLASH_STORE_PAGE_SIZE);
+    CHECK(flash_store_read(FLASH_STORE_SECTOR_SIZE)[0] == 0xF0);
+    memset(page, 0x3C, FLASH_STORE_PAGE_SIZE);
+    flash_store_program(FLASH_STORE_SECTOR_SIZE, page, FLASH_STORE_PAGE_SIZE);
+    CHECK(flash_store_read(FLASH_STORE_SECTOR_SIZE)[FLASH_STORE_PAGE_SIZE - 1] == 0x30);
+    CHECK(is_erased(FLASH_STORE_SECTOR_SIZE + FLASH_STORE_PAGE_SIZE, FLASH_STORE_SECTOR_SIZE - FLASH_STORE_PAGE_SIZE));
+
+    // Erasing a sector leaves the ones around it alone
+    flash_store_program(0, page, FLASH_STORE_PAGE_SIZE);
+    flash_store_program(2 * FLASH_STORE_SECTOR_SIZE, page, FLASH_STORE_PAGE_SIZE);
+    flash_store_erase(FLASH_STORE_SECTOR_SIZE, FLASH_STORE_SECTOR_SIZE);
+    CHECK(is_erased(FLASH_STORE_SECTOR_SIZE, FLASH_STORE_SECTOR_SIZE));
+    CHECK(flash_store_read(0)[0] == 0x3C);
+    CHECK(flash_store_read(2 * FLASH_STORE_SECTOR_SIZE)[0] == 0x3C);
+
+    flash_store_erase(0, 3 * FLASH_STORE_SECTOR_SIZE);
+    CHECK(is_erased(0, 3 * FLASH_STORE_SECTOR_SIZE));
+}
+
+static void test_writer(void)
+{
+    flash_writer_t writer;
+
+    // Regions have to be aligned and inside the store
+    CHECK(!flash_writer_open(&writer, FLASH_STORE_PAGE_SIZE, FLASH_STORE_SECTOR_SIZE));
+    CHECK(!flash_writer_open(&writer, 0, FLASH_STORE_PAGE_SIZE));
+    CHECK(!flash_writer_open(&writer, FLASH_STORE_SIZE, FLASH_STORE_SECTOR_SIZE));
+    CHECK(!flash_writer_begin(&writer, 1, FLASH_STORE_PAGE_SIZE));
+    CHECK(flash_writer_begin(&writer, FLASH_STORE_PAGE_SIZE, FLASH_STORE_PAGE_SIZE));
+
+    // Opening erases what was there before
+    uint32_t offset = 4 * FLASH_STORE_SECTOR_SIZE;
+    uint8_t page[FLASH_STORE_PAGE_SIZE];
+    memset(page, 0, FLASH_STORE_PAGE_SIZE);
+    flash_store_program(offset + FLASH_STORE_SECTOR_SIZE, page, FLASH_STORE_PAGE_SIZE);
+    CHECK(flash_writer_open(&writer, offset, 2 * FLASH_STORE_SECTOR_SIZE));
+    CHECK(is_erased(offset, 2 * FLASH_STORE_SECTOR_SIZE));
+
+    // Writes of any length are buffered into whole pages, across page boundaries
+    uint8_t data[1000];
+    for(uint32_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 7 + 1);
+    uint32_t written = 0, sizes[] = { 1, 37, 255, 256, 300, 151 };
+    for(uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        CHECK(flash_writer_write(&writer, data + written, sizes[i]));
+        written += sizes[i];
+    }
+    CHECK(written == sizeof(data));
+    CHECK(writer.position == sizeof(data));
+
+    // Only whole pages are programmed until the writer is closed
+    CHECK(!memcmp(flash_store_read(offset), data, 3 * FLASH_STORE_PAGE_SIZE));
+    CHECK(is_erased(offset + 3 * FLASH_STORE_PAGE_SIZE, FLASH_STORE_PAGE_SIZE));
+    flash_writer_close(&writer);
+    CHECK(!memcmp(flash_store_read(offset), data, sizeof(data)));
+    CHECK(is_erased(offset + sizeof(data), 2 * FLASH_STORE_SECTOR_SIZE - sizeof(data)));
+
+    // Nothing is written past the end of the region
+    CHECK(flash_writer_begin(&writer, offset + 4 * FLASH_STORE_PAGE_SIZE, FLASH_STORE_PAGE_SIZE));
+    CHECK(!flash_writer_write(&writer, data, FLASH_STORE_PAGE_SIZE + 1));
+    CHECK(flash_writer_write(&writer, data, FLASH_STORE_PAGE_SIZE));
+    CHECK(!flash_writer_write(&writer, data, 1));
+    CHECK(!memcmp(flash_store_read(offset + 4 * FLASH_STORE_PAGE_SIZE), data, FLASH_STORE_PAGE_SIZE));
+    CHECK(is_erased(offset + 5 * FLASH_STORE_PAGE_SIZE, FLASH_STORE_PAGE_SIZE));
+}
+
+int main(void)
+{
+    test_program_and_erase();
+    test_writer();
+
+    printf(failures ? "flash_store_test: %d Failed\n" : "flash_store_test: Passed\n", failures);
+    return failures ? 1 : 0;
+}
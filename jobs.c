@@ -0,0 +1,267 @@
+#include "jobs.h"
+#include "pico.h"
+#include "hardware/sync.h"
+#include <string.h>
+
+// Recording State. job_recording_slot is set from the start of a recording until job_record_service has written all of it
+static flash_writer_t job_writer;
+static job_header_t job_recording_header;
+static volatile int job_recording_slot = -1;
+// Set while segments are being recorded
+static volatile bool job_recording;
+// Segments waiting to be written. job_record_node (The UART IRQ) adds them and the main loop writes them, so each count has one writer
+static drv_segment_t job_record_buffer[JOB_RECORD_BUFFER_SEGMENTS];
+static volatile uint32_t job_record_added, job_record_written;
+// How much of the slot has been erased. Sectors are erased ahead of the recording while the machine is idle
+static uint32_t job_record_erased;
+
+// Slots waiting to be erased (Bit n is slot n). They are empty from when job_erase is called
+static volatile uint32_t job_erase_pending;
+
+// Replay State
+static int job_replay_slot = -1;
+static uint32_t job_replay_index;
+
+// Offset of the slot inside the flash store
+static uint32_t job_slot_offset(uint8_t slot)
+{
+    return JOB_STORE_OFFSET + slot * JOB_SLOT_SIZE;
+}
+
+const job_header_t *job_get_header(uint8_t slot)
+{
+    if(slot >= JOB_SLOT_COUNT || (job_erase_pending & (1u << slot)))
+        return 0;
+
+    const job_header_t *header = (const job_header_t *)flash_store_read(job_slot_offset(slot));
+    return header->magic == JOB_MAGIC ? header : 0;
+}
+
+int job_find_free_slot(void)
+{
+    for(uint8_t slot = 0; slot < JOB_SLOT_COUNT; slot++)
+        if(!job_get_header(slot) && slot != job_recording_slot)
+            return slot;
+    return -1;
+}
+
+void job_erase(uint8_t slot)
+{
+    if(slot >= JOB_SLOT_COUNT || slot == job_recording_slot || slot == job_replay_slot)
+        return;
+    job_erase_pending |= 1u << slot;
+}
+
+bool job_record_start(uint8_t slot)
+{
+    if(slot >= JOB_SLOT_COUNT || job_recording_slot >= 0 || slot == job_replay_slot)
+        return false;
+
+    // Nothing is written until job_record_service, which erases the slot as it goes
+    if(!flash_writer_begin(&job_writer, job_slot_offset(slot), JOB_SLOT_SIZE))
+        return false;
+    job_erase_pending &= ~(1u << slot);
+    job_record_erased = 0;
+    job_record_added = job_record_written = 0;
+
+    // Leave space for the header. Writing erased bytes doesn't change the flash so it can be programmed when we stop
+    job_header_t placeholder;
+    memset(&placeholder, FLASH_STORE_ERASED, sizeof(job_header_t));
+    flash_writer_write(&job_writer, &placeholder, sizeof(job_header_t));
+
+    // Replay needs to start from the same place as the recording did
+    memset(&job_recording_header, 0, sizeof(job_header_t));
+    job_recording_header.magic = JOB_MAGIC;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        job_recording_header.start[axis] = pico_state.drv_location_pending[axis];
+
+    job_recording_slot = slot;
+    job_recording = true;
+    return true;
+}
+
+void job_record_node(const drv_queue_node_t *node)
+{
+    if(!job_is_recording())
+        return;
+
+    // Stop the recording when flash hasn't kept up, so what we have is kept
+    if(job_record_added - job_record_written >= JOB_RECORD_BUFFER_SEGMENTS)
+    {
+        job_record_stop(0);
+        return;
+    }
+
+    queue_node_to_segment(node, &job_record_buffer[job_record_added % JOB_RECORD_BUFFER_SEGMENTS]);
+    __dmb();
+    job_record_added++;
+}
+
+void job_record_stop(const char *name)
+{
+    if(!job_is_recording())
+        return;
+
+    if(name)
+        strncpy(job_recording_header.name, name, JOB_NAME_LENGTH - 1);
+    else
+        strncpy(job_recording_header.name, "Unnamed", JOB_NAME_LENGTH - 1);
+    job_recording = false;
+}
+
+bool job_is_recording(void)
+{
+    return job_recording;
+}
+
+// How much of the slot has to be erased. All of it while recording, only what was written once it has stopped
+static uint32_t job_record_erase_end(void)
+{
+    return job_recording ? job_writer.length : job_writer.position;
+}
+
+// Erase the next sector of the recording's slot. Only while the machine is idle: an erase stops core 1 and every interrupt
+// for about 45ms, which would freeze a step train part way through and overflow the UART FIFO. Returns true if it did
+static bool job_record_erase_ahead(bool idle)
+{
+    if(!idle || job_record_erased >= job_record_erase_end())
+        return false;
+    flash_store_erase(job_slot_offset(job_recording_slot) + job_record_erased, FLASH_STORE_SECTOR_SIZE);
+    job_record_erased += FLASH_STORE_SECTOR_SIZE;
+    return true;
+}
+
+// Write what has been recorded, a page at most. Returns true if it wrote to flash
+static bool job_record_write(void)
+{
+    while(job_record_written != job_record_added)
+    {
+        uint32_t end = job_writer.position + sizeof(drv_segment_t);
+
+        // Stop the recording when the slot is full, so what we have is kept
+        if(end > job_writer.length)
+        {
+            job_record_stop(0);
+            job_record_written = job_record_added;
+            return false;
+        }
+        // Wait for the machine to stop so the sector can be erased (The buffer holds the segments meanwhile)
+        if(end > job_record_erased)
+            return false;
+
+        uint32_t page = job_writer.position / FLASH_STORE_PAGE_SIZE;
+        flash_writer_write(&job_writer, &job_record_buffer[job_record_written % JOB_RECORD_BUFFER_SEGMENTS], sizeof(drv_segment_t));
+        job_recording_header.segment_count++;
+        job_record_written++;
+
+        // A page was programmed
+        if(job_writer.position / FLASH_STORE_PAGE_SIZE != page)
+            return true;
+    }
+    return false;
+}
+
+// Program the rest of a stopped recording and its header over the placeholder
+static void job_record_finish(void)
+{
+    flash_writer_close(&job_writer);
+
+    // Erased bytes in the page leave the recorded segments untouched
+    uint8_t page[FLASH_STORE_PAGE_SIZE];
+    memset(page, FLASH_STORE_ERASED, FLASH_STORE_PAGE_SIZE);
+    memcpy(page, &job_recording_header, sizeof(job_header_t));
+    flash_store_program(job_slot_offset(job_recording_slot), page, FLASH_STORE_PAGE_SIZE);
+
+    job_recording_slot = -1;
+}
+
+bool job_record_service(void)
+{
+    bool idle = queue_is_idle(&pico_state.step_queue);
+    uint32_t buffered = job_record_added - job_record_written;
+    bool erasing = job_recording_slot >= 0 && job_record_erased < job_record_erase_end();
+    bool pending = buffered || erasing || job_erase_pending || (job_recording_slot >= 0 && !job_recording);
+
+    // A job that keeps the machine busy is written anyway once half of the buffer is used, so none of it is lost
+    if(!pending || (!idle && buffered < JOB_RECORD_BUFFER_SEGMENTS / 2))
+        return pending;
+
+    // Emptying a slot only needs its header erased. The rest is erased when a recording reaches it
+    if(job_erase_pending && idle)
+    {
+        uint8_t slot = __builtin_ctz(job_erase_pending);
+        flash_store_erase(job_slot_offset(slot), FLASH_STORE_SECTOR_SIZE);
+        job_erase_pending &= ~(1u << slot);
+        return true;
+    }
+
+    if(job_recording_slot < 0 || job_record_erase_ahead(idle) || job_record_write())
+        return true;
+
+    // Finish a stopped recording once all of it is written and the machine has stopped
+    if(!job_recording && job_record_written == job_record_added && idle)
+    {
+        job_record_finish();
+        return true;
+    }
+    return job_record_written != job_record_added || !job_recording || erasing;
+}
+
+bool job_record_ready(void)
+{
+    return job_recording_slot < 0 || job_record_erased >= job_record_erase_end();
+}
+
+bool job_replay_start(uint8_t slot)
+{
+    const job_header_t *header = job_get_header(slot);
+    if(!header || job_is_replaying() || slot == job_recording_slot)
+        return false;
+
+    // Get back to where the recording started from (Refused while a jog or an abort is stopping, try again once it has)
+    if(!drv_go_to_axes(header->start))
+        return false;
+
+    job_replay_slot = slot;
+    job_replay_index = 0;
+    return true;
+}
+
+void job_replay_service(void)
+{
+    if(!job_is_replaying())
+        return;
+
+    const job_header_t *header = job_get_header(job_replay_slot);
+    const uint8_t *segments = flash_store_read(job_slot_offset(job_replay_slot) + sizeof(job_header_t));
+
+    // Top up the queue without taking the lock. Core 1 only ever makes it shorter. The UART interrupt runs between segments
+    // so an abort can stop the replay part way through (Nothing more is queued, even once core 1 has finished the abort)
+    while(job_is_replaying() && !pico_state.aborting &&
+        job_replay_index < header->segment_count && pico_state.step_queue.length < JOB_REPLAY_QUEUE_DEPTH)
+    {
+        // The segments are packed so copy them out rather than reading them in place
+        drv_segment_t segment;
+        memcpy(&segment, segments + job_replay_index * sizeof(drv_segment_t), sizeof(drv_segment_t));
+        pico_uart_irq_pause(true);
+        bool queued = drv_queue_segment(&segment);
+        pico_uart_irq_pause(false);
+        // Tried again on the next pass
+        if(!queued)
+            break;
+        job_replay_index++;
+    }
+
+    if(job_replay_index >= header->segment_count)
+        job_replay_stop();
+}
+
+void job_replay_stop(void)
+{
+    job_replay_slot = -1;
+}
+
+bool job_is_replaying(void)
+{
+    return job_replay_slot >= 0;
+}
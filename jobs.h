@@ -0,0 +1,70 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include "flash_store.h"
+#include "queue.h"
+
+// Record & Replay of Jobs from Flash
+// A job is the stream of segments that were pushed onto the step queue while recording.
+// Replaying pushes the same segments straight back onto the queue without needing the host
+
+#define JOB_SLOT_COUNT          8
+// The job slots take up the flash store after the checkpoint and machine profile sectors
+#define JOB_STORE_OFFSET        (3 * FLASH_STORE_SECTOR_SIZE)
+#define JOB_SLOT_SIZE           ((FLASH_STORE_SIZE - JOB_STORE_OFFSET) / JOB_SLOT_COUNT)
+#define JOB_NAME_LENGTH         16
+
+// "JOB4" - Identifies a slot that has a completed recording in it (Changes with the segment format)
+#define JOB_MAGIC               0x34424F4A
+
+// Amount of segments to keep in the step queue while replaying (The queue is heap allocated so don't load it all)
+#define JOB_REPLAY_QUEUE_DEPTH  32
+
+// Segments held in RAM until the main loop writes them to flash. Writing flash pauses core 1 (It runs from flash) so it is
+// only done while the machine is idle, unless a job keeps it busy until half of the buffer is used (Only programming, a page
+// takes about 1ms. Sectors are never erased while it is busy)
+#define JOB_RECORD_BUFFER_SEGMENTS  256
+
+// Stored at the start of each slot, followed by segment_count drv_segment_t's
+// Written last, so a recording that was cut off leaves the slot empty
+typedef struct {
+    uint32_t magic;
+    uint32_t segment_count;
+    // The pending position when the recording was started. Replay moves here first
+    double start[DRV_AXIS_COUNT];
+    char name[JOB_NAME_LENGTH];
+} job_header_t;
+
+// Returns the header of the job stored in the slot or 0 if the slot is empty
+const job_header_t *job_get_header(uint8_t slot);
+// Returns the first slot without a job in it or -1 if they are all used
+int job_find_free_slot(void);
+// Erase the job stored in a slot. The slot is empty straight away and erased by job_record_service
+void job_erase(uint8_t slot);
+
+// Start recording all segments that get queued into the slot. The main loop erases the slot a sector at a time while the machine is idle
+bool job_record_start(uint8_t slot);
+// Add a segment that has been queued to the recording
+void job_record_node(const drv_queue_node_t *node);
+// Finish the recording and give it a name. The rest of it is written by job_record_service
+void job_record_stop(const char *name);
+// Is a job currently being recorded
+bool job_is_recording(void);
+// Write recorded segments, finished recordings and erased slots to flash (One flash operation per call).
+// Called from the main loop. Returns true while there is something left to write
+bool job_record_service(void);
+// Has the slot of the recording been erased. Segments recorded before then wait in RAM and the recording stops if it fills
+// while the machine is busy, so the host waits for this before sending the job ($recording;)
+bool job_record_ready(void);
+
+// Start replaying the job in the slot
+bool job_replay_start(uint8_t slot);
+// Keep the step queue topped up with the replaying job. Should be called often while replaying
+void job_replay_service(void);
+// Stop the replay (segments already queued still execute)
+void job_replay_stop(void);
+// Is a job currently being replayed
+bool job_is_replaying(void);
+
+#endif // JOBS_H
@@ -19,26 +19,24 @@
 #include "menu.h"
 #include "drv8825.h"
 #include "queue.h"
+#include "jobs.h"
+#include "benchmark.h"
+#include "profile.h"
+#include "checkpoint.h"
+#include "telemetry.h"
 #include "terminal.h"
 
-// #define TEST
-
 // Foward Declaration so that main stays at the top
 void thread_main(void);
-void main_simple(void);
 
 // Core 1
 bool stop_processing;
 
 int main(void) {
-  #ifdef TEST
-  main_simple();
-  #else
-
   // Enable Standard I/O Functionality
   stdio_init_all();
 
-  // Turn on required PICO GPIO pins for UART
+  // Turn on required PICO GPIO pins for UART (USB is read from the main loop)
   pico_uart_init(uart_irq_handler);
 
   // Turn on DRV, Spindle and Header GPIO Pins
@@ -57,10 +55,16 @@ int main(void) {
   // Set Pullups/Pulldowns for pins
   // gpio_set_pulls(DRV_FAULT, 1, 0); //Logic Low when Fault Occurs, Pull Up. No Fault Trace hahaha... :(
   
+  // Load the Machine Profile (Limits & Timings) from Flash
+  profile_load();
+  // Load the Progress of the last Tracked Job so the host can carry on with it
+  checkpoint_load();
+
   // Set the Default State of the Drivers
   drv_enable_driver(false);
   drv_set_mode(0, 0, 0);
   enable_spindle(false);
+  pico_state.feed_override = RT_FEED_OVERRIDE_DEFAULT;
 
   // Setup Step Handler
   queue_init(&pico_state.step_queue);
@@ -68,20 +72,63 @@ int main(void) {
 
   // Create GUI Menus
   generate_menus();
-  // Print the Menu to Screen
-  draw_menu();
+  // Print the Menu to Screen (or go straight to Headless Mode for a host)
+  if (machine_profile.headless)
+    enter_headless();
+  else
+    draw_menu();
 
   // While we are in the menu's
   while (current_menu) {
+    // Send a Telemetry Frame if one is due (Wakes the wfi below through its timer interrupt)
+    telemetry_service();
+
+    // Read Commands that have arrived over USB (The UART has its own interrupt)
+    bool usb_pending = usb_input_service();
+
+    // Save the Progress of the Tracked Job every so often
+    bool checkpoint_pending = checkpoint_service();
+    // Write the Job being Recorded to Flash (Only while the Machine is Idle, see jobs.h)
+    bool record_pending = job_record_service();
+    // Write a Saved Machine Profile to Flash
+    bool profile_pending = profile_service();
+
+    // Feed a Stored Job into the Step Queue as fast as it is processed
+    if(job_is_replaying())
+    {
+      job_replay_service();
+      continue;
+    }
+    // Queue the next Benchmark run as soon as the last one has finished
+    if(benchmark_is_running())
+    {
+      benchmark_service();
+      continue;
+    }
+    // Keep watching the Tracked Job until all of its Progress has been saved, the Recording and Profile until they are written
+    // and the USB Input until the Step Queue has room for it
+    if(checkpoint_pending || usb_pending || record_pending || profile_pending)
+      continue;
     __wfi(); // Wait for Interrupt
     // Do All the Logic in the Interrupt as we are not using the main loop for anything else
   }
 
+  // Keep what was Recorded and Write the Rest of it to Flash (Waits for the Machine to be Idle)
+  job_record_stop(0);
+  while(job_record_service() | profile_service())
+    tight_loop_contents();
+
+  // Nothing can be queued until an abort or a jog has stopped and core 1 has resynced the pending location so wait for it.
+  // The UART is held off from then on so nothing can stop the movements back to the origin being queued
+  pico_uart_irq_pause(true);
+  while(pico_state.aborting || !drv_jog_stop())
+    tight_loop_contents();
+
   // Reset Position of Steppers
   // Get the Amount of Whole steps to get back to origin. int cast should floor
-  int x_steps = (int)pico_state.drv_x_location_pending;
-  int y_steps = (int)pico_state.drv_y_location_pending;
-  int z_steps = (int)pico_state.drv_z_location_pending;
+  int x_steps = (int)pico_state.drv_location_pending[X];
+  int y_steps = (int)pico_state.drv_location_pending[Y];
+  int z_steps = (int)pico_state.drv_location_pending[Z];
 
   // NOTE: Could use drv_go_to_position but need to provide additional pico states which append does for us
   // NOTE: Could use drv_go_to_position with 0's but that has the possiblity of taking smaller steps as it doesn't split steps
@@ -89,12 +136,17 @@ int main(void) {
   // Step the Z Axis Back to Origin / 0
   // Example: If we are at 73.25 Steps on the Z axis
   drv_append_position(0, 0, (double)(-z_steps)); // Will be -73
-  drv_append_position(0, 0, -pico_state.drv_z_location_pending); // Will be -0.25 as the pending location should be updated
+  drv_append_position(0, 0, -pico_state.drv_location_pending[Z]); // Will be -0.25 as the pending location should be updated
 
   // Step the X & Y Axis Back to Origin / 0
   drv_append_position((double)(-x_steps), (double)(-y_steps), 0);
   // The Steps are below 1 so even the lowest chaneg shouldn't matter
-  drv_append_position(-pico_state.drv_x_location_pending, -pico_state.drv_y_location_pending, 0);
+  drv_append_position(-pico_state.drv_location_pending[X], -pico_state.drv_location_pending[Y], 0);
+
+  // Any other Axes (eg. the Rotary Axis) go Back to 0 with the Pen Up
+  double origin[DRV_AXIS_COUNT] = {0};
+  drv_go_to_axes(origin);
+  pico_uart_irq_pause(false);
   
   // Disable the Processing Core
   stop_processing = true;
@@ -115,11 +167,8 @@ int main(void) {
 
   // Turn off LED as the board has exited the main loop
   gpio_put(PICO_DEFAULT_LED_PIN, GPIO_LOW);
-
-  #endif
 }
 
-#ifdef WAIT_FOR_INTERRUPT_CORE_1
 void process(uint gpio, uint32_t events)
 {
   // Using this function to get out of the low power mode on core 1
@@ -130,29 +179,36 @@ void process(uint gpio, uint32_t events)
     https://forums.raspberrypi.com/viewtopic.php?t=304815
   */
 }
-#endif
 
 void thread_main(void)
 {
-  #ifdef WAIT_FOR_INTERRUPT_CORE_1
-  // Setup a GPIO Pin which we put a interrupt on so that we can escape low power mode
-  gpio_init(PROCESS_QUEUE);
-  gpio_set_dir(PROCESS_QUEUE, GPIO_OUT);
-  gpio_pull_up(PROCESS_QUEUE);
-  gpio_put(PROCESS_QUEUE, GPIO_HIGH);
-  gpio_set_irq_enabled_with_callback(PROCESS_QUEUE, GPIO_IRQ_EDGE_FALL, true, &process);
-  #endif
+  // Allow Core 0 to pause this core while it writes to flash (This core runs from flash)
+  multicore_lockout_victim_init();
+
+  // Changing this in the profile only takes effect after a restart as the interrupt is setup here
+  bool wait_for_interrupt = machine_profile.wait_for_interrupt;
+
+  if(wait_for_interrupt)
+  {
+    // Setup a GPIO Pin which we put a interrupt on so that we can escape low power mode
+    gpio_init(PROCESS_QUEUE);
+    gpio_set_dir(PROCESS_QUEUE, GPIO_OUT);
+    gpio_pull_up(PROCESS_QUEUE);
+    gpio_put(PROCESS_QUEUE, GPIO_HIGH);
+    gpio_set_irq_enabled_with_callback(PROCESS_QUEUE, GPIO_IRQ_EDGE_FALL, true, &process);
+  }
 
   while(!stop_processing)
   {
-    #ifdef WAIT_FOR_INTERRUPT_CORE_1
-    // Want this at the top so that we can process data before we exit
-    // We have setup a interrupt on the PROCESS_QUEUE gpio pin 
-    // That interrupt will allow us to break out of the low power mode
-    __wfi(); 
-    #else
-    sleep_ms(1000);
-    #endif
+    if(wait_for_interrupt)
+    {
+      // Want this at the top so that we can process data before we exit
+      // We have setup a interrupt on the PROCESS_QUEUE gpio pin 
+      // That interrupt will allow us to break out of the low power mode
+      __wfi(); 
+    }
+    else
+      sleep_ms(1000);
 
     // Turn off LED to show processing
     gpio_put(PICO_DEFAULT_LED_PIN, GPIO_LOW);
@@ -162,76 +218,10 @@ void thread_main(void)
     do
     {
       process_step_queue(); // Process the Steps in the Queue and Act Upon Them
-    } while (!queue_is_empty_mutex(&pico_state.step_queue));
+    } while (queue_is_ready_mutex(&pico_state.step_queue));
     
     // Set the PICO LED to high to siginify that we have processed the data
     gpio_put(PICO_DEFAULT_LED_PIN, GPIO_HIGH);
     pico_state.step_queue.processing = false;
   }
 }
-
-// This Function is used to test the setup on a basic level by sending 20 full steps w/ large sleeps
-void main_simple(void)
-{
-  gpio_init(DRV_RESET);
-  gpio_set_dir(DRV_RESET, GPIO_OUT);
-  gpio_put(DRV_RESET, GPIO_HIGH);
-
-  gpio_init(DRV_SLEEP);
-  gpio_set_dir(DRV_SLEEP, GPIO_OUT);
-  gpio_put(DRV_SLEEP, GPIO_HIGH);
-
-  gpio_init(DRV_ENABLE);
-  gpio_set_dir(DRV_ENABLE, GPIO_OUT);
-  gpio_put(DRV_ENABLE, GPIO_LOW);
-
-  gpio_init(DRV_MODE_0);
-  gpio_set_dir(DRV_MODE_0, GPIO_OUT);
-  gpio_put(DRV_MODE_0, GPIO_LOW);
-
-  gpio_init(DRV_MODE_1);
-  gpio_set_dir(DRV_MODE_1, GPIO_OUT);
-  gpio_put(DRV_MODE_1, GPIO_LOW);
-
-  gpio_init(DRV_MODE_2);
-  gpio_set_dir(DRV_MODE_2, GPIO_OUT);
-  gpio_put(DRV_MODE_2, GPIO_LOW);
-
-  gpio_init(DRV_X_DIRECTION);
-  gpio_set_dir(DRV_X_DIRECTION, GPIO_OUT);
-  gpio_put(DRV_X_DIRECTION, GPIO_HIGH);
-
-  gpio_init(DRV_X_STEP);
-  gpio_set_dir(DRV_X_STEP, GPIO_OUT);
-  gpio_put(DRV_X_STEP, GPIO_LOW);
-
-  gpio_init(DRV_Y_DIRECTION);
-  gpio_set_dir(DRV_Y_DIRECTION, GPIO_OUT);
-  gpio_put(DRV_Y_DIRECTION, GPIO_HIGH);
-
-  gpio_init(DRV_Y_STEP);
-  gpio_set_dir(DRV_Y_STEP, GPIO_OUT);
-  gpio_put(DRV_Y_STEP, GPIO_LOW);
-
-  gpio_init(DRV_Z_DIRECTION);
-  gpio_set_dir(DRV_Z_DIRECTION, GPIO_OUT);
-  gpio_put(DRV_Z_DIRECTION, GPIO_HIGH);
-
-  gpio_init(DRV_Z_STEP);
-  gpio_set_dir(DRV_Z_STEP, GPIO_OUT);
-  gpio_put(DRV_Z_STEP, GPIO_LOW);
-
-  sleep_ms(1000); // Wait a Second For Setup Time
-
-  for(int i = 0; i < 20; i++)
-  {
-    gpio_put(DRV_X_STEP, GPIO_HIGH);
-    gpio_put(DRV_Y_STEP, GPIO_HIGH);
-    gpio_put(DRV_Z_STEP, GPIO_HIGH);
-    sleep_ms(100);
-    gpio_put(DRV_X_STEP, GPIO_LOW);
-    gpio_put(DRV_Y_STEP, GPIO_LOW);
-    gpio_put(DRV_Z_STEP, GPIO_LOW);
-    sleep_ms(100);
-  }
-}
\ No newline at end of file
@@ -1,11 +1,20 @@
 #include "menu.h"
 #include "pico.h"
 #include "terminal.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "queue.h"
 #include "drv8825.h"
+#include "jobs.h"
+#include "benchmark.h"
+#include "stream_decoder.h"
+#include "profile.h"
+#include "checkpoint.h"
+#include "wcs.h"
+#include "telemetry.h"
 
 char pending_character_buffer[INPUT_BUFFER_SIZE];
 int pending_character_buffer_index;
@@ -16,11 +25,88 @@ char input_buffer[INPUT_BUFFER_SIZE];
 int input_buffer_index;
 
 // WASD Based Menu
-struct menu_node *current_menu, *main_menu, *manual_draw_menu, *automated_draw_menu;
+struct menu_node *current_menu, *main_menu, *manual_draw_menu, *automated_draw_menu, *stored_jobs_menu, *benchmark_menu;
+
+// Option Text for each of the Stored Job Slots. Updated whenever the menu is opened
+char stored_job_text[JOB_SLOT_COUNT][48];
+
+// Automated Draw State. Text coordinates are parsed a character at a time
+char automated_buffer[300]; // Character buffer. Basically our string version of the double provided
+uint8_t automated_buffer_index; // The Index of the latest charatcer in the buffer
+double automated_coordinates[DRV_AXIS_COUNT]; // Coordinate Buffer. Index 0 = X, 1 = Y, 2 = Z, 3 = A
+uint8_t automated_coordinate_index; // The Index of the latest coordinate in the buffer
+bool automated_refused; // Was the last set of coordinates refused (eg. while a jog was stopping). Replied to as an error in Headless Mode
+stream_decoder_t automated_decoder; // Decodes the compact stream (see stream_decoder.h)
+
+// Headless Mode. Nothing is drawn and every command gets a status line (see menu.h)
+bool headless_mode;
 
 // This is the y index for additional text to be printed on (or larger) so that it doesn't overlap the menu text
 int text_output_y;
 
+// Handles a byte of input that isn't a Real-Time Command. The same for every transport (UART & USB)
+static void handle_input(char ch)
+{
+  // Every other byte is part of a command in Headless Mode
+  if (headless_mode)
+  {
+    headless_irq(ch);
+    return;
+  }
+
+  // Let the Menu Handle Key Presses / Exit if it has handled the keypress
+  if (current_menu->override_irq && current_menu->override_irq(ch))
+  {
+    return;
+  }
+
+  switch (ch)
+  {
+  // Navigation
+  // Move Up
+  case 'w': 
+    if (current_menu->current_selection > 0)
+    {
+      current_menu->previous_selection = current_menu->current_selection;
+      current_menu->current_selection--;
+      update_selection();
+    }
+    break;
+  // Move Down
+  case 's': 
+    if (current_menu->current_selection < current_menu->options_length - 1)
+    {
+      current_menu->previous_selection = current_menu->current_selection;
+      current_menu->current_selection++;
+      update_selection();
+    }
+    break;
+
+  // Redraw Menu
+  case 'r':
+    draw_menu();
+    break;
+
+  // Backspace
+  case '\b':
+  case 0x7f:
+    // Beware: This can go back to an undefined menu
+    go_to_menu(current_menu->previous_menu);
+    break;
+
+  // Enter
+  case ' ':
+  case '\r':
+  case '\n':
+    // Run the Selection Function for the current Menu Option 
+    if (current_menu->options_length && current_menu->options[current_menu->current_selection].on_select)
+      current_menu->options[current_menu->current_selection].on_select();
+    break;
+  default: // On non-special key
+    break;
+  }
+}
+
 void uart_irq_handler(void)
 {
   while (uart_is_readable(PICO_UART_ID))
@@ -29,61 +115,109 @@ void uart_irq_handler(void)
     if(!current_menu)
       return;
 
+    // The main loop switches the transport (Switching it here could change the stdio drivers part way through its printf)
     char ch = uart_getc(PICO_UART_ID);
+    pico_state.uart_input = true;
 
-    // Let the Menu Handle Key Presses / Exit if it has handled the keypress
-    if (current_menu->override_irq && current_menu->override_irq(ch))
-    {
-      return;
-    }
-      
-    
-    switch (ch)
-    {
-    // Navigation
-    // Move Up
-    case 'w': 
-      if (current_menu->current_selection > 0)
-      {
-        current_menu->previous_selection = current_menu->current_selection;
-        current_menu->current_selection--;
-        update_selection();
-      }
-      break;
-    // Move Down
-    case 's': 
-      if (current_menu->current_selection < current_menu->options_length - 1)
-      {
-        current_menu->previous_selection = current_menu->current_selection;
-        current_menu->current_selection++;
-        update_selection();
-      }
-      break;
+    // Real-Time Commands are handled on every menu before anything else
+    if (handle_realtime_command(ch))
+      continue;
 
-    // Redraw Menu
-    case 'r':
-      draw_menu();
-      break;
+    handle_input(ch);
+  }
+}
 
-    // Backspace
-    case '\b':
-    case 0x7f:
-      // Beware: This can go back to an undefined menu
-      go_to_menu(current_menu->previous_menu);
-      break;
+// USB Input waiting for room in the Step Queue (A ring buffer)
+static char usb_input[PICO_USB_INPUT_SIZE];
+static uint16_t usb_input_start, usb_input_length;
 
-    // Enter
-    case ' ':
-    case '\r':
-    case '\n':
-      // Run the Selection Function for the current Menu Option 
-      if (current_menu->options_length && current_menu->options[current_menu->current_selection].on_select)
-        current_menu->options[current_menu->current_selection].on_select();
-      break;
-    default: // On non-special key
+bool usb_input_service(void)
+{
+  // Replies go back over the UART once input has come from it (Noted by its interrupt)
+  if (pico_state.uart_input)
+  {
+    pico_state.uart_input = false;
+    pico_set_transport(PICO_TRANSPORT_UART);
+  }
+
+  // Read whole packets while there is room for one. Anything left is held back in the USB CDC until there is
+  char packet[PICO_USB_PACKET_SIZE];
+  while (current_menu && PICO_USB_INPUT_SIZE - usb_input_length >= PICO_USB_PACKET_SIZE)
+  {
+    int count = pico_usb_read(packet, sizeof(packet));
+    if (!count)
       break;
+
+    // The UART interrupt is held off while USB input is handled as it handles input too (The same menus, buffers and
+    // step queue lock). Its FIFO keeps what arrives meanwhile
+    pico_uart_irq_pause(true);
+    pico_set_transport(PICO_TRANSPORT_USB);
+    for (int i = 0; i < count; i++)
+    {
+      // Real-Time Commands are handled as soon as they arrive, even while the rest waits for the Step Queue.
+      // An abort drops what is waiting as it belonged to the aborted job
+      if ((uint8_t)packet[i] == RT_ABORT)
+        usb_input_start = usb_input_length = 0;
+      if (handle_realtime_command(packet[i]))
+        continue;
+      usb_input[(usb_input_start + usb_input_length++) % PICO_USB_INPUT_SIZE] = packet[i];
     }
+    pico_uart_irq_pause(false);
+  }
+
+  // Same as the UART from here on. Stops while the Step Queue is full so a fast host can't fill the heap with nodes
+  while (usb_input_length && current_menu && pico_state.step_queue.length < QUEUE_CAPACITY)
+  {
+    char ch = usb_input[usb_input_start];
+    usb_input_start = (usb_input_start + 1) % PICO_USB_INPUT_SIZE;
+    usb_input_length--;
+    pico_uart_irq_pause(true);
+    handle_input(ch);
+    pico_uart_irq_pause(false);
+  }
+  return usb_input_length && current_menu;
+}
+
+char handle_realtime_command(char ch)
+{
+  bool feed_hold = pico_state.feed_hold;
+  int feed_override = pico_state.feed_override;
+
+  switch ((uint8_t)ch)
+  {
+  case RT_FEED_HOLD:
+    drv_feed_hold();
+    break;
+  case RT_CYCLE_START:
+    drv_cycle_start();
+    break;
+  case RT_FEED_OVERRIDE_RESET:
+    drv_adjust_feed_override(0);
+    break;
+  case RT_FEED_OVERRIDE_PLUS:
+    drv_adjust_feed_override(RT_FEED_OVERRIDE_STEP);
+    break;
+  case RT_FEED_OVERRIDE_MINUS:
+    drv_adjust_feed_override(-RT_FEED_OVERRIDE_STEP);
+    break;
+  case RT_ABORT:
+    // Anything partially received belonged to the aborted job
+    drv_abort();
+    reset_automated_draw();
+    if (!headless_mode)
+      print_pico_state();
+    return 1;
+  case RT_HEADLESS:
+    enter_headless();
+    return 1;
+  default:
+    return 0;
   }
+
+  // The rest only change the feed line. A host can send them many times over so it is only drawn when it changed
+  if (!headless_mode && (feed_hold != pico_state.feed_hold || feed_override != pico_state.feed_override))
+    print_feed_state();
+  return 1;
 }
 
 void update_selection(void)
@@ -116,7 +250,7 @@ void draw_menu(void)
   term_move_to(0, text_output_y + 1);
   term_erase_line();
   term_set_color(clrGreen, clrBlack);
-  printf("Controls: W - Up | S - Down | Backspace - Back | Enter/Space - Select");
+  printf("Controls: W - Up | S - Down | Backspace - Back | Enter/Space - Select | ! - Hold | ~ - Resume | Ctrl+X - Abort");
 
   // write_debug("\nLength: %d\nText: %s\n", current_menu->options_length, current_menu->options[0].option_text);
 
@@ -213,6 +347,152 @@ void go_to_automated_draw(void)
   go_to_menu(automated_draw_menu);
 }
 
+void refresh_stored_jobs(void)
+{
+  // Update the Option Text of every slot with the job stored in it
+  for (uint8_t slot = 0; slot < JOB_SLOT_COUNT; slot++)
+  {
+    const job_header_t *header = job_get_header(slot);
+    if (header)
+      snprintf(stored_job_text[slot], sizeof(stored_job_text[slot]), "[%d] %.*s (%lu Segments)", slot + 1, JOB_NAME_LENGTH, header->name, header->segment_count);
+    else
+      snprintf(stored_job_text[slot], sizeof(stored_job_text[slot]), "[%d] Empty", slot + 1);
+  }
+}
+void go_to_stored_jobs(void)
+{
+  refresh_stored_jobs();
+  go_to_menu(stored_jobs_menu);
+}
+void record_new_job(void)
+{
+  // Record into the first free slot and let the automated draw menu receive the job
+  int slot = job_find_free_slot();
+  if (slot < 0 || !job_record_start(slot))
+  {
+    term_move_to(0, text_output_y + 2);
+    term_set_color(clrRed, clrBlack);
+    term_erase_line();
+    printf("No Free Job Slots. Erase a Job First");
+    return;
+  }
+  go_to_automated_draw();
+}
+void replay_selected_job(void)
+{
+  // The first option is "Record New Job" so the slots start at 1
+  uint8_t slot = current_menu->current_selection - 1;
+
+  term_move_to(0, text_output_y + 2);
+  term_erase_line();
+  if (job_replay_start(slot))
+  {
+    term_set_color(clrGreen, clrBlack);
+    printf("Replaying Job %d", slot + 1);
+  }
+  else
+  {
+    term_set_color(clrRed, clrBlack);
+    printf("Unable to Replay Job %d", slot + 1);
+  }
+}
+
+// Handle Keypresses for the stored jobs
+char stored_jobs_irq(char ch)
+{
+  /*
+    Menu Description:
+    Lists the jobs stored in flash so they can be replayed or erased
+  */
+  switch (ch)
+  {
+  // Erase the Selected Job
+  case 'x':
+    if (current_menu->current_selection > 0)
+    {
+      job_erase(current_menu->current_selection - 1);
+      refresh_stored_jobs();
+      draw_menu();
+    }
+    return 1;
+  // Stop Replaying
+  case 'c':
+    job_replay_stop();
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+void go_to_benchmark(void)
+{
+  go_to_menu(benchmark_menu);
+}
+void run_benchmark(void)
+{
+  // Results are printed a line per run below the menu
+  term_move_to(0, text_output_y + 12);
+  term_set_color(clrWhite, clrBlack);
+  printf("\n");
+  if (!benchmark_start())
+  {
+    term_move_to(0, text_output_y + 2);
+    term_set_color(clrRed, clrBlack);
+    term_erase_line();
+    printf("Unable to Benchmark While the Machine is Busy");
+  }
+}
+
+// Handle Keypresses for the benchmark
+char benchmark_irq(char ch)
+{
+  /*
+    Menu Description:
+    Sweeps the step rate and acceleration of every axis and reports how well the step loop kept up
+  */
+  switch (ch)
+  {
+  // Stop after the current run
+  case 'c':
+    benchmark_stop();
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Move an axis by the step value for a movement key. A key that is held down keeps repeating so once it does the axis is jogged instead
+// (Queuing a step for every repeat fills the queue faster than it drains and the axis carries on long after the key is released)
+static void manual_draw_move(char ch, DRV_DRIVER axis, bool direction, double step)
+{
+  static char last_key;
+  static uint32_t last_key_us;
+
+  uint32_t pressed_us = time_us_32();
+  bool repeating = ch == last_key && pressed_us - last_key_us < DRV_JOG_START_US;
+  last_key = ch;
+  last_key_us = pressed_us;
+
+  // Marked before queuing as core 1 may start the movement straight away
+  drv_measure_key_latency(pressed_us);
+
+  bool queued;
+  if (repeating)
+    queued = drv_jog(axis, direction, step);
+  else
+  {
+    double position[DRV_AXIS_COUNT], pending = pico_state.drv_location_pending[axis];
+    for (uint8_t i = 0; i < DRV_AXIS_COUNT; i++)
+      position[i] = pico_state.drv_location_pending[i];
+    position[axis] += direction ? step : -step;
+    queued = drv_go_to_axes(position) && pending != pico_state.drv_location_pending[axis];
+  }
+
+  // Only a movement that steps is measured (The axis may already be at its limit or a held key only kept the jog going)
+  if (!queued)
+    pico_state.key_latency_pending = false;
+}
+
 // Handle Keypresses for manual drawing
 char manual_draw_irq(char ch) 
 {
@@ -231,26 +511,34 @@ char manual_draw_irq(char ch)
   {
   // Move the Y Axis
   case 'w':
-    drv_append_position(0, step, 0);
+    manual_draw_move(ch, Y, true, step);
     break;
   case 's':
-    drv_append_position(0, -step, 0);
+    manual_draw_move(ch, Y, false, step);
     break;
   
   // Move the X Axis
   case 'a':
-    drv_append_position(-step, 0, 0);
+    manual_draw_move(ch, X, false, step);
     break;
   case 'd':
-    drv_append_position(step, 0, 0);
+    manual_draw_move(ch, X, true, step);
     break;
   
   // Move the Z Axis
   case 'q':
-    drv_append_position(0, 0, step);
+    manual_draw_move(ch, Z, true, step);
     break;
   case 'e':
-    drv_append_position(0, 0, -step);
+    manual_draw_move(ch, Z, false, step);
+    break;
+
+  // Turn the A (Rotary) Axis (Not R as that Redraws the Menu)
+  case 'g':
+    manual_draw_move(ch, A, true, step);
+    break;
+  case 'f':
+    manual_draw_move(ch, A, false, step);
     break;
 
   // Change Step Amounts
@@ -292,6 +580,136 @@ char manual_draw_irq(char ch)
   return 1;
 }
 
+// The number, state and underruns of the last batch as $name=value lines (Underruns are final once it is committed)
+static void print_batch(void)
+{
+  printf("$batch=%lu\n$batch_open=%d\n$batch_staged=%lu\n$batch_underruns=%lu\n$underruns=%lu\n",
+    pico_state.batch_number,
+    pico_state.batch_open,
+    pico_state.step_queue.held,
+    pico_state.batch_underruns,
+    pico_state.underruns
+  );
+}
+
+void handle_machine_command(char *command)
+{
+  // Replies go below the menu (Straight out in Headless Mode). Every reply ends with an ok or error line so the host knows it is complete
+  if (!headless_mode)
+  {
+    term_move_to(0, text_output_y + 12);
+    term_set_color(clrWhite, clrBlack);
+  }
+  printf("\n");
+
+  char *value = strchr(command, '=');
+  bool ok = true, leave_headless = false;
+  if (!command[0]) // List the Machine Profile
+    profile_print();
+  else if (!strcmp(command, "save")) // Save the Machine Profile to Flash
+    ok = profile_save();
+  else if (!strcmp(command, "reset")) // Go back to the Default Machine Profile
+    profile_reset();
+  else if (!strcmp(command, "progress")) // Progress of the Tracked Job
+    checkpoint_print();
+  else if (!strcmp(command, "restore")) // Carry on from the Position of the Saved Checkpoint after a Restart
+    ok = checkpoint_restore();
+  else if (!strncmp(command, "job=", 4)) // Track the Progress of a New Job (0 Stops Tracking)
+    checkpoint_start_job(strtoul(command + 4, 0, 10));
+  else if (!strncmp(command, "resume=", 7)) // Carry on Tracking the Last Job with this many Movements already Done
+    ok = checkpoint_resume_job(strtoul(command + 7, 0, 10));
+  else if (!strcmp(command, "wcs")) // List the Work Coordinate Transform
+    wcs_print();
+  else if (!strcmp(command, "wcs_reset")) // Go back to Machine Coordinates
+    wcs_reset();
+  else if (value && !strncmp(command, "wcs_", 4)) // Set a Value of the Work Coordinate Transform
+  {
+    *value = '\0';
+    ok = wcs_set(command + 4, atof(value + 1));
+  }
+  else if (!strcmp(command, "record")) // Record what follows into the First Free Job Slot (Finished by #name;)
+  {
+    int slot = job_find_free_slot();
+    ok = slot >= 0 && job_record_start(slot);
+  }
+  else if (!strcmp(command, "recording")) // Is a Job being Recorded and has its Slot been Erased (Send the Job once it has)
+    printf("$recording=%d\n$record_ready=%d\n", job_is_recording(), job_record_ready());
+  else if (!strncmp(command, "batch=", 6)) // Stage what follows until this many Movements are Queued (0 for as many as the Queue should hold) or $commit;
+    ok = drv_batch_open(strtoul(command + 6, 0, 10));
+  else if (!strcmp(command, "commit")) // Start the Staged Batch (Replies with its Underruns)
+  {
+    ok = drv_batch_commit();
+    print_batch();
+  }
+  else if (!strcmp(command, "batch")) // State of the Last Batch
+    print_batch();
+  else if (!strcmp(command, "status")) // Nothing but the Reply (Headless Mode polls the step queue with it)
+    ok = true;
+  else if (!strcmp(command, "merged")) // Movements Joined onto the one before them since Startup
+    printf("$merged=%lu\n", pico_state.merged_nodes);
+  else if (!strcmp(command, "menu")) // Leave Headless Mode (Once the reply has been sent)
+    ok = leave_headless = headless_mode;
+  else if (!strcmp(command, "telemetry")) // Rate of the Binary Telemetry Frames
+    printf("$telemetry=%lu\n", telemetry_rate());
+  else if (!strncmp(command, "telemetry=", 10)) // Send Binary Telemetry Frames at a Rate (0 Turns them Off)
+    ok = telemetry_set_rate(strtoul(command + 10, 0, 10));
+  else if (value) // Set a Value of the Machine Profile
+  {
+    *value = '\0';
+    ok = profile_set(command, atof(value + 1));
+  }
+  else
+    ok = false;
+
+  print_status(ok);
+
+  if (leave_headless)
+  {
+    headless_mode = false;
+    term_cls();
+    draw_menu();
+  }
+}
+
+void print_status(bool ok)
+{
+  if (!headless_mode)
+  {
+    printf(ok ? "ok\n" : "error\n");
+    return;
+  }
+
+  // Headless Mode adds where the axes are and how much more the step queue should take so the host never has to ask
+  uint32_t length = pico_state.step_queue.length;
+  printf("%s", ok ? "ok" : "error");
+  for (uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    printf(" %c=%.5f", drv_axes[axis].name, pico_state.drv_location[axis]);
+  printf(" queue=%lu free=%lu\n", length, length < QUEUE_CAPACITY ? QUEUE_CAPACITY - length : 0);
+}
+
+void reset_automated_draw(void)
+{
+  automated_decoder.active = false;
+  automated_coordinate_index = 0;
+  memset(automated_coordinates, 0, sizeof(automated_coordinates));
+  automated_buffer_index = 0;
+  automated_buffer[automated_buffer_index] = '\0';
+}
+
+// Round a coordinate in steps to the 1/32 step units the work coordinates are in. Clamped first as a coordinate that doesn't fit
+// can't be converted (It ends up at the travel limit either way, one that isn't a number is taken as 0)
+static int32_t automated_units(double coordinate)
+{
+  double units = round(coordinate * STREAM_UNITS_PER_STEP);
+  if (isnan(units))
+    return 0;
+  if (units > INT32_MAX)
+    return INT32_MAX;
+  if (units < INT32_MIN)
+    return INT32_MIN;
+  return (int32_t)units;
+}
+
 // Handle Keypresses for automated drawing
 char automated_draw_irq(char ch) 
 {
@@ -301,57 +719,127 @@ char automated_draw_irq(char ch)
     Pass Custom Coords to the queue
   */
 
-  // Setup Static and Scoped Variables used to track menu state
-  static char buffer[300]; // Character buffer. Basically our string version of the double provided
-  static uint8_t buffer_index = 0; // The Index of the latest charatcer in the buffer
-  static double coordinates[3]; // Coordinate Buffer. Index 0 = X, 1 = Y, 2 = Z
-  static uint8_t coordinate_index = 0; // The Index of the latest coordinate in the buffer
+  // While a compact stream is being received every byte belongs to it
+  if (automated_decoder.active)
+  {
+    stream_decoder_feed(&automated_decoder, ch);
+    return 1;
+  }
 
   switch (ch)
   {
+  case STREAM_START: // Start of a Compact Stream
+    stream_decoder_start(&automated_decoder);
+    break;
   case ';': // End of Coords
-    coordinates[coordinate_index++] = atof(buffer); // Convert our buffer to a double (Should be Z as it is the final element)
-    drv_go_to_position(coordinates[0], coordinates[1], coordinates[2]); // Add the New Set of coordinates to the proccessing queue
+    // End of a Recorded Job. The Rest of the Buffer is the Name of the Job
+    if (automated_buffer[0] == '#')
+    {
+      job_record_stop(automated_buffer + 1);
+      automated_buffer_index = 0;
+      automated_buffer[automated_buffer_index] = '\0';
+      break;
+    }
+
+    // Machine Command (eg. $max_steps_x=100). The Rest of the Buffer is the Command
+    if (automated_buffer[0] == '$')
+    {
+      handle_machine_command(automated_buffer + 1);
+      automated_buffer_index = 0;
+      automated_buffer[automated_buffer_index] = '\0';
+      break;
+    }
+
+    if (automated_coordinate_index < DRV_AXIS_COUNT)
+      automated_coordinates[automated_coordinate_index++] = atof(automated_buffer); // Convert our buffer to a double (Should be Z or A as it is the final element)
+    // Add the New Set of coordinates to the proccessing queue (They are work coordinates. Rounded onto the 1/32 step grid the transform works in)
+    if (automated_coordinate_index > Z + 1)
+    {
+      // The Axes after Z were given too (eg. x,y,z,a;). Any that weren't stay where they are
+      int32_t units[DRV_AXIS_COUNT];
+      for (uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        units[axis] = automated_units(axis < automated_coordinate_index ? automated_coordinates[axis] :
+          pico_state.drv_location_pending[axis]);
+      automated_refused = !wcs_go_to_axes(units);
+    }
+    else
+      automated_refused = !wcs_go_to_position(
+        automated_units(automated_coordinates[0]),
+        automated_units(automated_coordinates[1]),
+        automated_units(automated_coordinates[2])
+      );
     
     // Reset All Buffer Data
-    coordinate_index = 0;
-    buffer_index = 0;
-    buffer[buffer_index] = '\0';
+    automated_coordinate_index = 0;
+    automated_buffer_index = 0;
+    automated_buffer[automated_buffer_index] = '\0';
     break;
   case ',': // End of Axis Coordinate
-    coordinates[coordinate_index++] = atof(buffer); // Convert our buffer to a double (Should be X or Y as they are not the final element)
+    if (automated_coordinate_index < DRV_AXIS_COUNT)
+      automated_coordinates[automated_coordinate_index++] = atof(automated_buffer); // Convert our buffer to a double (Should be X, Y or Z as they are not the final element)
 
     // Reset String Buffer Data
-    buffer_index = 0;
-    buffer[buffer_index] = '\0';
+    automated_buffer_index = 0;
+    automated_buffer[automated_buffer_index] = '\0';
     break;
   case '\n':
     // As the Script Tries to access the Menu From Main Menu. Wipe Data on newline
-    buffer_index = 0;
-    buffer[buffer_index] = '\0';
+    automated_buffer_index = 0;
+    automated_buffer[automated_buffer_index] = '\0';
     break;
   case '\b':
   case 0x7f:
     // On backspace. Let User Escape menu if they selected it and wipe any data they provided
-    coordinate_index = 0;
-    coordinates[0] = coordinates[1] = coordinates[2] = 0;
-    buffer_index = 0;
-    buffer[buffer_index] = '\0';
+    job_record_stop(0); // Keep what was recorded if the host never finished the job
+    reset_automated_draw();
     return 0;
   default:
     // Store Character & Increment the string buffer when a non special character is received
-    buffer[buffer_index++] = ch;
-    buffer[buffer_index] = '\0';
+    automated_buffer[automated_buffer_index++] = ch;
+    automated_buffer[automated_buffer_index] = '\0';
     break;
   }
   return 1;
 }
+void enter_headless(void)
+{
+  // Commands are parsed the same way as the Automated Draw menu, which is where leaving Headless Mode goes back to
+  reset_automated_draw();
+  current_menu = automated_draw_menu;
+  headless_mode = true;
+  print_status(true);
+}
+
+char headless_irq(char ch)
+{
+  bool streaming = automated_decoder.active;
+
+  // There is no menu to go back to
+  if (!streaming && (ch == '\b' || ch == 0x7f))
+  {
+    job_record_stop(0);
+    reset_automated_draw();
+    return 1;
+  }
+
+  // Machine commands reply for themselves. Coordinates, the end of a recording and the end of a compact stream are replied to here
+  bool command_end = !streaming && ch == ';' && automated_buffer[0] != '$';
+  automated_refused = false;
+  automated_draw_irq(ch);
+  if (command_end)
+    print_status(!automated_refused);
+  else if (streaming && !automated_decoder.active) // A stream that stopped anywhere but its end token was invalid
+    print_status((uint8_t)ch == STREAM_TOKEN_END);
+  return 1;
+}
 void generate_menus(void)
 {
   // Allocate Memory for all the menus
   main_menu = (struct menu_node *)malloc(sizeof(struct menu_node));
   manual_draw_menu = (struct menu_node *)malloc(sizeof(struct menu_node));
   automated_draw_menu = (struct menu_node *)malloc(sizeof(struct menu_node));
+  stored_jobs_menu = (struct menu_node *)malloc(sizeof(struct menu_node));
+  benchmark_menu = (struct menu_node *)malloc(sizeof(struct menu_node));
 
   // Create Options
 
@@ -364,6 +852,14 @@ void generate_menus(void)
     {
       .on_select = go_to_automated_draw,
       .option_text = "Automated Draw [SCRIPT ONLY]"
+    },
+    {
+      .on_select = go_to_stored_jobs,
+      .option_text = "Stored Jobs"
+    },
+    {
+      .on_select = go_to_benchmark,
+      .option_text = "Benchmark"
     }
   };
 
@@ -391,6 +887,12 @@ void generate_menus(void)
     {
       .option_text = "[E] - Z Axis Backwards (-)"
     },
+    {
+      .option_text = "[G] - A Axis Forwards (+)"
+    },
+    {
+      .option_text = "[F] - A Axis Backwards (-)"
+    },
     {
       .option_text = "[Z] - Increase Step Value (+)"
     },
@@ -409,6 +911,9 @@ void generate_menus(void)
     {
       .option_text = "[Y] - Disable Spindle Motor (-)"
     },
+    {
+      .option_text = "Hold a Movement Key to Jog Continuously"
+    },
   };
 
   // Manual Draw Menu (Manual Movements)
@@ -419,6 +924,34 @@ void generate_menus(void)
   create_menu(automated_draw_menu, "Automated Draw", main_menu, 0, 0);
   automated_draw_menu->override_irq = automated_draw_irq;
 
+  // Stored Jobs Menu (Record & Replay from Flash)
+  struct menu_option stored_jobs_menu_options[JOB_SLOT_COUNT + 1] = {
+    {
+      .on_select = record_new_job,
+      .option_text = "Record New Job"
+    }
+  };
+  for (uint8_t slot = 0; slot < JOB_SLOT_COUNT; slot++)
+  {
+    stored_jobs_menu_options[slot + 1].on_select = replay_selected_job;
+    stored_jobs_menu_options[slot + 1].option_text = stored_job_text[slot];
+  }
+  create_menu(stored_jobs_menu, "Stored Jobs", main_menu, LENGTH_OF_ARRAY(stored_jobs_menu_options), stored_jobs_menu_options);
+  stored_jobs_menu->override_irq = stored_jobs_irq; // [X] Erase, [C] Stop Replay
+
+  // Benchmark Menu (Step Rate & Acceleration Sweep)
+  struct menu_option benchmark_menu_options[] = {
+    {
+      .on_select = run_benchmark,
+      .option_text = "Run Benchmark (Moves to the Origin then Sweeps X, Y & Z)"
+    },
+    {
+      .option_text = "[C] - Stop After the Current Run"
+    }
+  };
+  create_menu(benchmark_menu, "Benchmark", main_menu, LENGTH_OF_ARRAY(benchmark_menu_options), benchmark_menu_options);
+  benchmark_menu->override_irq = benchmark_irq;
+
   // Set The Current Menu to Main Menu
   current_menu = main_menu;
 }
@@ -432,6 +965,12 @@ void release_menus(void)
   free(automated_draw_menu->options);
   free(automated_draw_menu);
 
+  free(stored_jobs_menu->options);
+  free(stored_jobs_menu);
+
+  free(benchmark_menu->options);
+  free(benchmark_menu);
+
   free(main_menu->options);
   free(main_menu);
 }
@@ -448,25 +987,32 @@ void write_debug(const char *format, ...)
   va_end(args);
 }
 
+void print_feed_state(void)
+{
+  term_move_to(0, text_output_y + 10);
+  term_set_color(clrWhite, clrBlack);
+  term_erase_line();
+    printf("hold: %d | feed: %d%% | gap: %luus (max %luus)", 
+    pico_state.feed_hold, 
+    pico_state.feed_override,
+    (unsigned long)pico_state.segment_gap_us,
+    (unsigned long)pico_state.segment_gap_max_us
+  );
+}
+
 void print_pico_state(void)
 {
   term_move_to(0, text_output_y + 5);
   term_set_color(clrWhite, clrBlack);
   term_erase_line();
-  printf("X: %.5f | Y: %.5f | Z: %.5f", 
-    pico_state.drv_x_location, 
-    pico_state.drv_y_location, 
-    pico_state.drv_z_location
-  );
+  for (uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    printf("%s%c: %.5f", axis ? " | " : "", toupper(drv_axes[axis].name), pico_state.drv_location[axis]);
 
   term_move_to(0, text_output_y + 6);
   term_set_color(clrWhite, clrBlack);
   term_erase_line();
-    printf("<X>: %.5f | <Y>: %.5f | <Z>: %.5f", 
-    pico_state.drv_x_location_pending, 
-    pico_state.drv_y_location_pending, 
-    pico_state.drv_z_location_pending
-  );
+  for (uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    printf("%s<%c>: %.5f", axis ? " | " : "", toupper(drv_axes[axis].name), pico_state.drv_location_pending[axis]);
 
   term_move_to(0, text_output_y + 7);
   term_set_color(clrWhite, clrBlack);
@@ -480,18 +1026,27 @@ void print_pico_state(void)
   term_move_to(0, text_output_y + 8);
   term_set_color(clrWhite, clrBlack);
   term_erase_line();
-    printf("x_dir: %d | y_dir: %d | z_dir: %d", 
-    pico_state.drv_x_direction, 
-    pico_state.drv_y_direction, 
-    pico_state.drv_z_direction
-  );
+  for (uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    printf("%s%c_dir: %d", axis ? " | " : "", drv_axes[axis].name, pico_state.drv_direction[axis]);
 
   term_move_to(0, text_output_y + 9);
   term_set_color(clrWhite, clrBlack);
   term_erase_line();
-    printf("!drv!: %d | !spindle!: %d | queue: %d", 
+    printf("!drv!: %d | !spindle!: %d | queue: %d | merged: %lu", 
     pico_state.drv_enabled, 
     pico_state.spindle_enabled,
-    pico_state.step_queue.length
+    pico_state.step_queue.length,
+    (unsigned long)pico_state.merged_nodes
+  );
+
+  print_feed_state();
+
+  term_move_to(0, text_output_y + 11);
+  term_set_color(clrWhite, clrBlack);
+  term_erase_line();
+    printf("jog: %d | key latency: %luus (max %luus)", 
+    pico_state.jogging, 
+    (unsigned long)pico_state.key_latency_us,
+    (unsigned long)pico_state.key_latency_max_us
   );
 }
\ No newline at end of file
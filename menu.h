@@ -13,6 +13,11 @@
 // The current menu being displayed on UART at runtime
 extern struct menu_node *current_menu;
 
+// Headless Mode. Entered with RT_HEADLESS from any menu (or at startup when the profile's headless is set) and left with $menu;
+// Nothing is drawn, every byte is taken the same way as the Automated Draw menu and every command gets a status line:
+// ok|error x=<x> y=<y> z=<z> queue=<nodes> free=<nodes> (Where the axes are and how many more nodes the queue should take)
+extern bool headless_mode;
+
 // Structure to represent and scope a menu option
 struct menu_option {
     const char *option_text; // The Text Displayed in the CLI to represent the Selectable Option
@@ -32,6 +37,28 @@ struct menu_node {
 
 // The UART IRQ Handler (duh). Handles the UART Inputs received.
 void uart_irq_handler(void);
+// Reads what has arrived over USB and hands it to the same handlers as the UART (Called from the main loop on core 0).
+// Returns true while input is waiting for room in the Step Queue
+bool usb_input_service(void);
+
+// Acts on a Real-Time Command (Feed Hold, Resume, Feed Override & Abort). Returns 0 if the character is not one
+char handle_realtime_command(char ch);
+
+// Runs a $ command received by the Automated Draw menu ($ lists the machine profile, $name=value sets a value, $save & $reset)
+// and replies with ok or error
+void handle_machine_command(char *command);
+
+// Replies with ok or error. In Headless Mode the line also has the position and the queue length & free space
+void print_status(bool ok);
+
+// Stops drawing the menus and replies to every command (See headless_mode)
+void enter_headless(void);
+
+// Handles a byte received in Headless Mode. Replies once a coordinate, recording or compact stream is complete
+char headless_irq(char ch);
+
+// Drops any partially received coordinates or compact stream in the Automated Draw menu
+void reset_automated_draw(void);
 
 // Draws the Entire Menu (Title, Options, etc). Should be called on start
 void draw_menu(void);
@@ -56,5 +83,7 @@ void release_menus(void);
 
 // Prints the Values that are in pico_state to the terminal
 void print_pico_state(void);
+// Prints the Feed Hold & Feed Override line of pico_state on its own (What the Real-Time Commands change)
+void print_feed_state(void);
 
 #endif // PICO_MENU_H
\ No newline at end of file
@@ -1,10 +1,29 @@
 #include "pico.h"
 #include "drv8825.h"
+#include "jobs.h"
+#include "benchmark.h"
+#include "profile.h"
+#include "hardware/sync.h"
+#if LIB_PICO_STDIO_UART
+#include "pico/stdio_uart.h"
+#endif
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#endif
 #include <math.h>
+#include <string.h>
 
 
 PICO_STATE pico_state;
 
+// Every axis the machine has. Adding one is a new entry here (and its pins in pico.h)
+const drv_axis_t drv_axes[DRV_AXIS_COUNT] = {
+    { .name = 'x', .step_pin = DRV_X_STEP, .direction_pin = DRV_X_DIRECTION, .min_steps = DRV_X_MIN_STEPS, .max_steps = DRV_X_MAX_STEPS },
+    { .name = 'y', .step_pin = DRV_Y_STEP, .direction_pin = DRV_Y_DIRECTION, .min_steps = DRV_Y_MIN_STEPS, .max_steps = DRV_Y_MAX_STEPS },
+    { .name = 'z', .step_pin = DRV_Z_STEP, .direction_pin = DRV_Z_DIRECTION, .min_steps = DRV_Z_MIN_STEPS, .max_steps = DRV_Z_MAX_STEPS },
+    { .name = 'a', .step_pin = DRV_A_STEP, .direction_pin = DRV_A_DIRECTION, .min_steps = DRV_A_MIN_STEPS, .max_steps = DRV_A_MAX_STEPS },
+};
+
 // Initialise the DEBUG PICO's UART Pins
 void pico_uart_init(irq_handler_t handler)
 {
@@ -19,7 +38,10 @@ void pico_uart_init(irq_handler_t handler)
     
     uart_set_hw_flow(PICO_UART_ID, false, false);
     uart_set_format(PICO_UART_ID, PICO_DATA_BITS, PICO_STOP_BITS, PICO_PARITY);
-    uart_set_fifo_enabled(PICO_UART_ID, false);
+    // The FIFO holds what arrives while interrupts are off. Flash is written from the main loop with them off: a page takes
+    // about 1ms while moving, and sectors (about 45ms) are only erased while the machine is idle, when the host only sends
+    // a byte every 30ms or waits for each reply. A host streaming faster than that while a sector is erased loses input
+    uart_set_fifo_enabled(PICO_UART_ID, true);
     
     irq_set_exclusive_handler(PICO_UART_IRQ, handler);
     irq_set_enabled(PICO_UART_IRQ, true);
@@ -42,67 +64,355 @@ void pico_uart_deinit(void)
     uart_deinit(PICO_UART_ID);
 }
 
-void process_step_queue(void)
+void pico_uart_irq_pause(bool paused)
 {
-    // Process all movements that are enqueued or skip if there are none
-    while(!queue_is_empty(&pico_state.step_queue))
+    irq_set_enabled(PICO_UART_IRQ, !paused);
+}
+
+int pico_usb_read(char *buffer, int length)
+{
+#if LIB_PICO_STDIO_USB
+    // Takes the same lock as the USB background task so it can be read from the main loop
+    int count = stdio_usb.in_chars(buffer, length);
+    return count > 0 ? count : 0;
+#else
+    return 0;
+#endif
+}
+
+void pico_set_transport(PICO_TRANSPORT transport)
+{
+    if(transport == pico_state.transport)
+        return;
+
+    // Input that turns up on the UART while the host is on USB (eg. noise on a loose RX wire) doesn't take its replies away
+#if LIB_PICO_STDIO_USB
+    if(transport == PICO_TRANSPORT_UART && pico_state.transport == PICO_TRANSPORT_USB && stdio_usb_connected())
+        return;
+#endif
+
+    // Otherwise every reply waits on the UART (About 87us a byte at PICO_BAUD_RATE) even when the host is on USB
+#if LIB_PICO_STDIO_UART
+    stdio_set_driver_enabled(&stdio_uart, transport != PICO_TRANSPORT_USB);
+#endif
+#if LIB_PICO_STDIO_USB
+    stdio_set_driver_enabled(&stdio_usb, transport != PICO_TRANSPORT_UART);
+#endif
+    pico_state.transport = transport;
+}
+
+// Hold position (the drivers stay enabled) until the feed hold is released or the queue is aborted
+static void drv_wait_while_held(void)
+{
+    while(pico_state.feed_hold && !pico_state.aborting)
+      tight_loop_contents();
+}
+
+// Work out the delay for the next step from the feed override and any feed hold.
+// ramp_delay_us carries the deceleration into a hold (and the acceleration back out of it) between steps
+static uint32_t drv_next_step_delay(uint16_t step_delay_us, uint32_t *ramp_delay_us)
+{
+    // Apply the Feed Override. Never faster than the driver allows
+    uint32_t delay = (uint32_t)step_delay_us * 100 / pico_state.feed_override;
+    if(delay < DRV_STEP_DELAY_US) delay = DRV_STEP_DELAY_US;
+
+    if(pico_state.feed_hold)
     {
-      // Setup Information needed for step
-      uint32_t step_mask = 0;
-      drv_queue_node_t node;
-      queue_pop(&pico_state.step_queue, &node);
+      // Decelerate by doubling the delay every step until we are slow enough to stop
+      *ramp_delay_us = (*ramp_delay_us > delay ? *ramp_delay_us : delay) * 2;
+      if(*ramp_delay_us >= DRV_HOLD_STOP_DELAY_US)
+      {
+        drv_wait_while_held();
+        *ramp_delay_us = DRV_HOLD_STOP_DELAY_US;
+      }
+    }
+    else if(*ramp_delay_us > delay)
+      *ramp_delay_us /= 2; // Accelerate back up after a hold
+
+    return *ramp_delay_us > delay ? *ramp_delay_us : delay;
+}
+
+// Finish an abort once core 1 has stopped stepping
+static void drv_finish_abort(void)
+{
+    // Anything that was still queued is dropped
+    queue_clear(&pico_state.step_queue);
 
-      if(!node.initialized) // We have failed to get the data for the steps.
-        continue;    
+    // The axes stopped part way so plan from where they actually are
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        pico_state.drv_location_pending[axis] = pico_state.drv_location[axis];
 
-      if(!node.x_steps && !node.y_steps && !node.z_steps) // There are no steps to be performed
+    // An open batch is dropped with the rest of the job
+    queue_enable(&pico_state.step_queue, true);
+    pico_state.batch_open = false;
+
+    pico_state.jogging = false;
+    pico_state.aborting = false;
+}
+
+// Finish a jog once core 1 has stopped stepping it. Core 0 doesn't queue anything while jogging so the jog was the last node
+// and the axes are where everything queued leaves them. Plan from there (The jog was planned all the way to the travel limit)
+static void drv_finish_jog(void)
+{
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        pico_state.drv_location_pending[axis] = pico_state.drv_location[axis];
+
+    __dmb();
+    pico_state.jogging = false;
+}
+
+// Mark the movements up to the sequence number as done along with where the axes are now (Read by checkpoint.c)
+static void drv_complete_sequence(uint32_t sequence)
+{
+    if(!sequence)
+      return;
+
+    pico_state.sequence_done_version++;
+    __dmb();
+    pico_state.sequence_done = sequence;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        pico_state.sequence_done_location[axis] = pico_state.drv_location[axis];
+    __dmb();
+    pico_state.sequence_done_version++;
+}
+
+// A node taken off the queue with everything worked out that is needed to start pulsing it
+typedef struct {
+    bool ready;
+    drv_queue_node_t node;
+    double step_size;
+    // Every axis steps on a run of the node's pulses. They all start on the first pulse
+    // except Z when it is aligned to finish on the last pulse (A pen drop merged onto a travel)
+    uint32_t pulses, start[DRV_AXIS_COUNT];
+    // How far a step moves each axis (Negative towards its min)
+    double step_distance[DRV_AXIS_COUNT];
+    // Direction & Mode pin levels, set together with a single masked write
+    uint32_t setup_values;
+    // Sequence number of a movement without any steps that was skipped on the way to this node.
+    // It is done as soon as everything before it is
+    uint32_t skipped_sequence;
+} drv_prepared_node_t;
+
+// The pins drv_apply_setup writes
+#define DRV_SETUP_PINS ((DRV_DIRECTION_PINS) | (1 << DRV_MODE_0) | (1 << DRV_MODE_1) | (1 << DRV_MODE_2))
+
+// The most pulses any axis of a node steps
+static uint32_t drv_node_pulses(const drv_queue_node_t *node)
+{
+    uint32_t pulses = 0;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        if(node->steps[axis] > pulses) pulses = node->steps[axis];
+    return pulses;
+}
+
+// Pop the next node with steps off the queue and work out how to pulse it. Returns false if the queue is empty
+static bool drv_prepare_node(drv_prepared_node_t *prepared)
+{
+    while(!prepared->ready && queue_is_ready(&pico_state.step_queue))
+    {
+      drv_queue_node_t *node = &prepared->node;
+      memset(node, 0, sizeof(drv_queue_node_t));
+      queue_pop(&pico_state.step_queue, node);
+
+      if(!node->initialized) // We have failed to get the data for the steps.
         continue;
 
-      pico_state.step_queue.processing = true;
+      uint32_t pulses = drv_node_pulses(node);
+      if(!pulses) // There are no steps to be performed
+      {
+        if(node->sequence)
+          prepared->skipped_sequence = node->sequence;
+        continue;
+      }
+
+      prepared->step_size = drv_determine_step(node->mode_0, node->mode_1, node->mode_2);
+      prepared->pulses = pulses;
+      prepared->setup_values = (node->mode_0 << DRV_MODE_0) | (node->mode_1 << DRV_MODE_1) | (node->mode_2 << DRV_MODE_2);
+      for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+      {
+        prepared->start[axis] = axis == Z && node->z_align_end ? pulses - node->steps[axis] : 0;
+        prepared->step_distance[axis] = (node->dir[axis] ? 1 : -1) * prepared->step_size;
+        prepared->setup_values |= (uint32_t)(node->dir[axis] != drv_axes[axis].invert_direction) << drv_axes[axis].direction_pin;
+      }
+      prepared->ready = true;
+    }
+    return prepared->ready;
+}
+
+// The STEP pins to pulse from a pulse of a prepared node on and the axes they move. It stays the same
+// until the pulse one of the axes starts or stops (next_change), so it is only worked out a few times a node
+// and an axis that isn't moving costs nothing while pulsing
+static uint32_t drv_step_mask(const drv_prepared_node_t *prepared, uint32_t pulse, uint8_t *moving, uint8_t *moving_count, uint32_t *next_change)
+{
+    uint32_t step_mask = 0;
+    *moving_count = 0;
+    *next_change = prepared->pulses;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+      uint32_t start = prepared->start[axis], end = start + prepared->node.steps[axis];
+      if(pulse >= start && pulse < end)
+      {
+        step_mask |= 1 << drv_axes[axis].step_pin;
+        moving[(*moving_count)++] = axis;
+        if(end < *next_change) *next_change = end;
+      }
+      else if(pulse < start && start < *next_change)
+        *next_change = start;
+    }
+    return step_mask;
+}
+
+// Set the Direction & Mode pins of a prepared node in one write.
+// The previous node's last low half has already covered the hold time, so only the setup time is waited out (if anything changed)
+static void drv_apply_setup(const drv_prepared_node_t *prepared)
+{
+    const drv_queue_node_t *node = &prepared->node;
+    bool changed = node->mode_0 != pico_state.mode_0 || node->mode_1 != pico_state.mode_1 || node->mode_2 != pico_state.mode_2;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+      changed |= node->dir[axis] != pico_state.drv_direction[axis];
+    if(!changed)
+      return;
+
+    gpio_put_masked(DRV_SETUP_PINS, prepared->setup_values);
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+      pico_state.drv_direction[axis] = node->dir[axis];
+    pico_state.mode_0 = node->mode_0;
+    pico_state.mode_1 = node->mode_1;
+    pico_state.mode_2 = node->mode_2;
+
+    sleep_us(machine_profile.direction_setup_us > machine_profile.mode_setup_us ?
+      machine_profile.direction_setup_us : machine_profile.mode_setup_us); // Setup Time
+}
+
+void process_step_queue(void)
+{
+    // Double Buffer. The current node is pulsed while the next is prepared
+    drv_prepared_node_t prepared[2] = {0};
+    uint8_t current = 0;
+    // The next node was ready when the current one finished, so the gap between them is down to us
+    bool back_to_back = false;
+    uint32_t last_pulse_end_us = 0, node_start_us = 0;
+
+    // Set before anything is popped so core 0 never sees an empty queue while a node is in hand (queue_is_idle)
+    pico_state.step_queue.processing = true;
+    __dmb();
+
+    // Process all movements that are enqueued or skip if there are none
+    while(!pico_state.aborting && drv_prepare_node(&prepared[current]))
+    {
+      drv_prepared_node_t *active = &prepared[current], *next = &prepared[!current];
+      const drv_queue_node_t *node = &active->node;
+      uint32_t step_mask = 0, next_change = 0;
+      uint8_t moving[DRV_AXIS_COUNT], moving_count = 0;
 
-      // Get the Step Size
-      double step_size = drv_determine_step(node.mode_0, node.mode_1, node.mode_2);
+      pico_state.sequence_active = node->sequence;
 
-      // Enable Drivers
+      // Deceleration into / Acceleration out of a Feed Hold
+      uint32_t ramp_delay_us = 0;
+
+      // Enable Drivers (Only waits if they were disabled)
       drv_enable_driver(true);
 
-      // Setup Step Directions.
-      drv_set_direction(X, node.x_dir);
-      drv_set_direction(Y, node.y_dir);
-      drv_set_direction(Z, node.z_dir);
+      // Setup Step Directions & Mode
+      drv_apply_setup(active);
+
+      // Turn on Spindle (It stays on while nodes run back to back so it only spins up once)
+      if(!pico_state.spindle_enabled)
+        enable_spindle(true);
 
-      // Setup Mode.
-      drv_set_mode(node.mode_0, node.mode_1, node.mode_2);
+      // The axes are at rest between nodes so a feed hold can stop here straight away
+      drv_wait_while_held();
 
-      // Turn on Spindle
-      enable_spindle(true);
-      
-      // Keep Iterating While there are steps
-      for(uint32_t x = 0, y = 0, z = 0; x < node.x_steps || y < node.y_steps || z < node.z_steps; x = y = ++z)
+      // Keep Iterating While there are steps (or until aborted)
+      for(uint32_t pulse = 0; !pico_state.aborting && pulse < active->pulses; pulse++)
       {
-        // Setup Mask for this step
-        SET_BIT_N(step_mask, DRV_X_STEP, !!(x < node.x_steps));
-        SET_BIT_N(step_mask, DRV_Y_STEP, !!(y < node.y_steps));
-        SET_BIT_N(step_mask, DRV_Z_STEP, !!(z < node.z_steps));
+        // A jog stops within a step period of no longer being held
+        if(node->jog && (int32_t)(time_us_32() - pico_state.jog_until_us) >= 0)
+          break;
+
+        // Get the Step Rate (Feed Override & Feed Hold are checked every step)
+        uint32_t step_delay_us = drv_next_step_delay(node->step_delay_us, &ramp_delay_us);
 
-        // Step the Motors
+        // Setup Mask for this step (Only changes when an axis starts or stops)
+        if(pulse == next_change)
+          step_mask = drv_step_mask(active, pulse, moving, &moving_count, &next_change);
+
+        // Step the Motors. STEP is held high for the driver's tWH (counted in cycles, see drivers.h)
+        // and the rest of the step period (2 step delays) is spent low
+        uint32_t pulse_start_us = time_us_32();
         gpio_put_masked(step_mask, step_mask);
-        sleep_us(3); // tWH(STEP)	Pulse duration, STEP high	1.9		μs (min)
+        busy_wait_at_least_cycles(DRV_STEP_HIGH_CYCLES);
         gpio_put_masked(step_mask, ~step_mask);
-        sleep_us(3); // tWL(STEP)	Pulse duration, STEP low	1.9		μs (min)
-        // The 2 Sleeps will generate our frequency (see figure 1. in Data Sheet)
-        // As long as the overall time is larger than ~4us we are within the allowed frequency 
+
+        if(!pulse)
+        {
+          node_start_us = pulse_start_us;
+          if(back_to_back)
+          {
+            pico_state.segment_gap_us = pulse_start_us - last_pulse_end_us;
+            if(pico_state.segment_gap_us > pico_state.segment_gap_max_us)
+              pico_state.segment_gap_max_us = pico_state.segment_gap_us;
+            pico_state.step_loop_us += pico_state.segment_gap_us;
+          }
+
+          // Keypress to first pulse (Manual Draw)
+          if(pico_state.key_latency_pending)
+          {
+            pico_state.key_latency_us = pulse_start_us - pico_state.key_pressed_us;
+            if(pico_state.key_latency_us > pico_state.key_latency_max_us)
+              pico_state.key_latency_max_us = pico_state.key_latency_us;
+            pico_state.key_latency_pending = false;
+          }
+        }
+
+        // Prepare the next node while the STEP pins are low on the last pulse (Only stretches the last step period, if at all).
+        // Until then it stays in the queue where drv_queue_node can still merge what comes after it into it
+        if(pulse + 1 == active->pulses)
+          drv_prepare_node(next);
+
+        // As long as the step delay is at least DRV_STEP_DELAY_US the low time is longer than tWL.
+        // time_us_32 only counts whole microseconds so wait for one more to be sure the period is complete
+        uint32_t wait_start_us = time_us_32();
+        while(time_us_32() - pulse_start_us < 2 * step_delay_us + DRV_STEP_PERIOD_EXTRA_US)
+          tight_loop_contents();
+        pico_state.step_loop_wait_us += time_us_32() - wait_start_us;
+        pico_state.step_loop_pulses++;
 
         // Update the State of the PICO's Step Counter
-        if(GET_BIT_N(step_mask, DRV_X_STEP))
-          pico_state.drv_x_location += (node.x_dir ? 1 : -1) * step_size;
-        if(GET_BIT_N(step_mask, DRV_Y_STEP))
-          pico_state.drv_y_location += (node.y_dir ? 1 : -1) * step_size;
-        if(GET_BIT_N(step_mask, DRV_Z_STEP))
-          pico_state.drv_z_location += (node.z_dir ? 1 : -1) * step_size;
-      }     
+        for(uint8_t i = 0; i < moving_count; i++)
+          pico_state.drv_location[moving[i]] += active->step_distance[moving[i]];
+      }
+      last_pulse_end_us = time_us_32();
+      pico_state.step_loop_us += last_pulse_end_us - node_start_us;
+
+      // A node that was cut short by an abort isn't done (A jog that stopped early is)
+      if(!pico_state.aborting)
+      {
+        if(node->jog)
+          drv_finish_jog();
+        drv_complete_sequence(node->sequence ? node->sequence : active->skipped_sequence);
+      }
+      active->skipped_sequence = 0;
+
+      // Swap to the next node (Nodes queued during the last pulse are picked up by the loop condition)
+      active->ready = false;
+      back_to_back = drv_prepare_node(next);
+      current = !current;
+
+      // Ran out part way through a batch that has started (Only an underrun if more of the batch comes, see drv_queue_node)
+      if(!back_to_back && pico_state.batch_open && pico_state.step_queue.running)
+        pico_state.batch_starved = true;
     }
 
+    pico_state.sequence_active = 0;
+
+    // Empty the Queue and Resync the Pending Location now that nothing is stepping
+    // (A node that was already prepared is dropped with it)
+    if(pico_state.aborting)
+      drv_finish_abort();
+    else // Movements without steps at the end of the queue are done now that everything before them is
+      drv_complete_sequence(prepared[current].skipped_sequence);
+
     // NOTE:
     // These enables may be a waste to do between commands as they are probably always executed as a step is executed in microseconds
     // They can also lead to skipping a command as they a sleeping outside the while loop
@@ -123,7 +433,7 @@ void enable_spindle(bool enabled)
      
     gpio_put(SPINDLE_TOGGLE, enabled);
     if(enabled) // Only Allow Wind-up not wind down
-        busy_wait_ms(200); // Wind up time. Busy wait required as we use this inside an interrupt :(
+        busy_wait_us(machine_profile.spindle_spinup_us); // Wind up time. Busy wait required as we use this inside an interrupt :(
     pico_state.spindle_enabled = enabled;
 }
 void drv_set_mode(bool mode_0, bool mode_1, bool mode_2)
@@ -135,45 +445,23 @@ void drv_set_mode(bool mode_0, bool mode_1, bool mode_2)
     pico_state.mode_1 = mode_1;
     gpio_put(DRV_MODE_2, mode_2);
     pico_state.mode_2 = mode_2;
-    sleep_us(2); // Setup Time + Hold Time
+    sleep_us(machine_profile.mode_setup_us); // Setup Time + Hold Time
 }
 void drv_set_direction(DRV_DRIVER axis, bool direction)
 {
-    // Set the Pins to the respective high/low and update the state struct
-    char pin = drv_get_axis_pin(axis);
-    gpio_put(pin + 1, direction); // Direction is step pin + 1 on our board
-    sleep_us(2); // Setup Time + Hold Time
+    if(axis >= DRV_AXIS_COUNT)
+        return;
 
-    switch (axis)
-    {
-    case X:
-        pico_state.drv_x_direction = direction;
-        break;
-    case Y:
-        pico_state.drv_y_direction = direction;
-        break;
-    case Z:
-        pico_state.drv_z_direction = direction;
-        break;
-    default:
-        break;
-    }
+    // Set the Pins to the respective high/low and update the state struct
+    gpio_put(drv_axes[axis].direction_pin, direction != drv_axes[axis].invert_direction);
+    sleep_us(machine_profile.direction_setup_us); // Setup Time + Hold Time
+    pico_state.drv_direction[axis] = direction;
 }
 
 
 char drv_get_axis_pin(DRV_DRIVER axis)
 {
-    switch(axis)
-    {
-        case X:
-            return DRV_X_STEP;
-        case Y:
-            return DRV_Y_STEP;
-        case Z:
-            return DRV_Z_STEP;
-        default:
-            return -1;
-    }
+    return axis < DRV_AXIS_COUNT ? drv_axes[axis].step_pin : -1;
 }
 
 void drv_enable_driver(bool enabled)
@@ -199,91 +487,433 @@ void drv_enable_driver(bool enabled)
         gpio_put(DRV_ENABLE, !enabled); // Make Sure it is giving outputs (Active Low, Pulled Low)
         gpio_put(DRV_RESET, enabled); // Enable HBridge Outputs (Active High, Pulled Low)
         pico_state.drv_enabled = enabled;
-        sleep_ms(3);
+        sleep_us(machine_profile.enable_delay_us);
     }
 }
 
-void drv_append_position(double x, double y, double z)
+// The step delay for a node. The slowest of the profile's step delay and the max rate of every axis that moves
+static uint16_t drv_plan_step_delay(const drv_queue_node_t *node)
 {
-    return drv_go_to_position(
-        pico_state.drv_x_location_pending + x, 
-        pico_state.drv_y_location_pending + y, 
-        pico_state.drv_z_location_pending + z
-    );
+    double step_size = drv_determine_step(node->mode_0, node->mode_1, node->mode_2);
+    double delay = machine_profile.step_delay_us;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+        // Every axis makes a step of step_size every 2 delays. Keep that under the max rate (full steps per second)
+        if(node->steps[axis] && machine_profile.max_rate[axis] > 0)
+        {
+            double axis_delay = step_size * 1e6 / (2 * machine_profile.max_rate[axis]);
+            if(axis_delay > delay) delay = axis_delay;
+        }
+    }
+    return delay > 0xFFFF ? 0xFFFF : (uint16_t)ceil(delay);
+}
+
+// Move a node onto the mode of another node with an equal or smaller step.
+// The step sizes are powers of 2 apart so it covers the same distance in a whole number of steps.
+// The step delay is shortened by the same amount so it keeps its rate (Never below the profile's step delay)
+static void drv_node_set_mode(drv_queue_node_t *node, const drv_queue_node_t *mode)
+{
+    uint32_t ratio = (uint32_t)(drv_determine_step(node->mode_0, node->mode_1, node->mode_2) /
+        drv_determine_step(mode->mode_0, mode->mode_1, mode->mode_2));
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        node->steps[axis] *= ratio;
+    if(ratio > 1)
+    {
+        uint32_t step_delay_us = (node->step_delay_us + ratio - 1) / ratio;
+        node->step_delay_us = step_delay_us > machine_profile.step_delay_us ? step_delay_us : machine_profile.step_delay_us;
+    }
+    node->mode_0 = mode->mode_0;
+    node->mode_1 = mode->mode_1;
+    node->mode_2 = mode->mode_2;
+}
+
+// Time a node takes to step when it runs straight after another (The same as durationUs in compiler.js)
+static uint64_t drv_node_duration_us(const drv_queue_node_t *node)
+{
+    uint32_t setup_us = machine_profile.direction_setup_us > machine_profile.mode_setup_us ?
+        machine_profile.direction_setup_us : machine_profile.mode_setup_us;
+    return setup_us + (uint64_t)drv_node_pulses(node) * (2 * node->step_delay_us + DRV_STEP_PERIOD_EXTRA_US);
 }
 
-// NOTE: X, Y, Z should be absolute values here (not relative)
-void drv_go_to_position(double x, double y, double z)
+// Overlap the pen move of a pair of nodes that drv_merge_pen_moves found (Lift then travel, otherwise travel then drop).
+// Returns true when the node was merged into the end node, otherwise the node is what is left of the travel with the drop
+static bool drv_merge_pen_pair(drv_queue_node_t *end, drv_queue_node_t *node, bool lift_then_travel)
 {
-    // Handle Position Overflows
-    // Check if new location is more than the defined MAX_STEPS
-    if(x > DRV_X_MAX_STEPS) x = DRV_X_MAX_STEPS;
-    if(y > DRV_Y_MAX_STEPS) y = DRV_Y_MAX_STEPS;
-    if(z > DRV_Z_MAX_STEPS) z = DRV_Z_MAX_STEPS;
+    // Both nodes step with the smaller of their step sizes and the slower of their step rates in it
+    if(drv_determine_step(end->mode_0, end->mode_1, end->mode_2) > drv_determine_step(node->mode_0, node->mode_1, node->mode_2))
+        drv_node_set_mode(end, node);
+    else
+        drv_node_set_mode(node, end);
+    uint16_t step_delay_us = end->step_delay_us > node->step_delay_us ? end->step_delay_us : node->step_delay_us;
+
+    if(lift_then_travel)
+    {
+        // The end node finishes the movements of both
+        if(node->sequence) end->sequence = node->sequence;
+        end->steps[X] = node->steps[X];
+        end->dir[X] = node->dir[X];
+        end->steps[Y] = node->steps[Y];
+        end->dir[Y] = node->dir[Y];
+        end->step_delay_us = step_delay_us;
+        return true;
+    }
+
+    if(!end->steps[Z])
+    {
+        end->steps[Z] = node->steps[Z];
+        end->dir[Z] = node->dir[Z];
+        end->z_align_end = true;
+        end->step_delay_us = step_delay_us;
+        if(node->sequence) end->sequence = node->sequence;
+        return true;
+    }
+
+    // The node becomes the rest of the travel with the drop and is pushed after the end node.
+    // The end node now stops part way through the travel so finishing it only finishes the lift (The movement before the travel)
+    if(end->sequence) end->sequence--;
+    uint32_t split = end->steps[Z];
+    node->steps[X] = end->steps[X] > split ? end->steps[X] - split : 0;
+    node->dir[X] = end->dir[X];
+    node->steps[Y] = end->steps[Y] > split ? end->steps[Y] - split : 0;
+    node->dir[Y] = end->dir[Y];
+    node->z_align_end = true;
+    node->step_delay_us = step_delay_us;
+    end->steps[X] -= node->steps[X];
+    end->steps[Y] -= node->steps[Y];
+    return false;
+}
+
+// Overlap pen moves with XY travel (Passed to queue_try_merge). Z moving towards its minimum lifts the pen.
+// A lift followed by an XY move is travel, so the XY move is merged into the lift and starts while the pen is still going up.
+// An XY move followed by a drop has the drop merged onto its end so the pen lands exactly as X & Y reach the start of the path.
+// Every axis keeps its own pulses so the merged nodes end up at exactly the same position
+static bool drv_merge_pen_moves(drv_queue_node_t *end, drv_queue_node_t *node)
+{
+    // A jog can stop anywhere so nothing is overlapped with it
+    if(end->jog || node->jog)
+        return false;
+
+    // Only travel across the bed is overlapped (Nothing that moves any other axis)
+    for(uint8_t axis = Z + 1; axis < DRV_AXIS_COUNT; axis++)
+        if(end->steps[axis] || node->steps[axis])
+            return false;
+
+    bool end_moves_xy = end->steps[X] || end->steps[Y], node_moves_xy = node->steps[X] || node->steps[Y];
+    bool lift_then_travel = !end_moves_xy && end->steps[Z] && !end->dir[Z] && node_moves_xy && !node->steps[Z];
+    bool travel_then_drop = end_moves_xy && !end->z_align_end && !node_moves_xy && node->steps[Z] && node->dir[Z];
+
+    // A travel that already has a lift merged in is split once the lift is done so the rest can take the drop.
+    // Nothing to do when the travel is over by then
+    if(travel_then_drop && end->steps[Z] && end->steps[X] <= end->steps[Z] && end->steps[Y] <= end->steps[Z])
+        return false;
+    if(!lift_then_travel && !travel_then_drop)
+        return false;
+
+    // Merged on copies as it is only worth it when the pair finishes sooner than stepping one after the other.
+    // The finer mode takes more pulses for the same distance (eg. a full step lift merged into 1/32 travel)
+    drv_queue_node_t merged_end = *end, merged_node = *node;
+    bool joined = drv_merge_pen_pair(&merged_end, &merged_node, lift_then_travel);
+    uint64_t merged_us = drv_node_duration_us(&merged_end) + (joined ? 0 : drv_node_duration_us(&merged_node));
+    if(merged_us >= drv_node_duration_us(end) + drv_node_duration_us(node))
+        return false;
+
+    *end = merged_end;
+    *node = merged_node;
+    return joined;
+}
+
+// Join a node onto the end node when pulsing one after the other already steps exactly like the joined node would.
+// Every axis steps on the first pulses of a node so an axis can only carry on into the next node if it stepped on every
+// pulse of the end node, otherwise joining them would close the gap it left. That covers moves along an axis or a
+// diagonal split up by the host and a move that carries on once the other axes have finished.
+// Both need the same mode & step rate and an axis that carries on keeps its direction
+static bool drv_merge_collinear(drv_queue_node_t *end, drv_queue_node_t *node)
+{
+    if(end->jog || node->jog || end->z_align_end || node->z_align_end)
+        return false;
+    if(end->mode_0 != node->mode_0 || end->mode_1 != node->mode_1 || end->mode_2 != node->mode_2 ||
+        end->step_delay_us != node->step_delay_us)
+        return false;
+
+    uint32_t pulses = drv_node_pulses(end);
+    if(!pulses || !drv_node_pulses(node))
+        return false;
+
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        if(node->steps[axis] && (end->steps[axis] != pulses || end->dir[axis] != node->dir[axis]))
+            return false;
+
+    // The end node finishes the movements of both
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        end->steps[axis] += node->steps[axis];
+    if(node->sequence) end->sequence = node->sequence;
+    pico_state.merged_nodes++;
+    return true;
+}
+
+// Merge a node into the end node of the queue (Passed to queue_try_merge). Moves that carry straight on are joined,
+// otherwise pen moves are overlapped with the travel around them
+static bool drv_merge_nodes(drv_queue_node_t *end, drv_queue_node_t *node)
+{
+    return drv_merge_collinear(end, node) || drv_merge_pen_moves(end, node);
+}
+
+// Wake Core 1 to process the step queue (Only needed when it waits for interrupts but harmless when it polls)
+static void drv_signal_process_queue(void)
+{
+    gpio_put(PROCESS_QUEUE, GPIO_LOW);
+    gpio_put(PROCESS_QUEUE, GPIO_HIGH);
+}
+
+void drv_feed_hold(void)
+{
+    pico_state.feed_hold = true;
+}
+
+void drv_cycle_start(void)
+{
+    pico_state.feed_hold = false;
+}
+
+void drv_adjust_feed_override(int change)
+{
+    int feed_override = change ? pico_state.feed_override + change : RT_FEED_OVERRIDE_DEFAULT;
+    if(feed_override < RT_FEED_OVERRIDE_MIN) feed_override = RT_FEED_OVERRIDE_MIN;
+    if(feed_override > RT_FEED_OVERRIDE_MAX) feed_override = RT_FEED_OVERRIDE_MAX;
+    pico_state.feed_override = feed_override;
+}
+
+void drv_abort(void)
+{
+    // Core 1 stops at the next step and finishes the abort (see drv_finish_abort)
+    pico_state.aborting = true;
+    pico_state.feed_hold = false;
+
+    // Stop feeding the queue. Core 1 drops what is in it (Nothing is started while aborting, and the queue lock isn't
+    // taken here as this runs in the UART interrupt which can interrupt core 0 code that holds it)
+    job_replay_stop();
+    job_record_stop(0);
+    benchmark_stop();
+
+    // Wake Core 1 so the abort is finished even if it is idle
+    drv_signal_process_queue();
+}
+
+bool drv_jog(DRV_DRIVER axis, bool direction, double step)
+{
+    // A jog queued in an open batch would be staged with it and never stop being jogged until the batch is committed
+    if(pico_state.aborting || pico_state.batch_open)
+        return false;
+
+    // Already jogging this way. Keep going until the key stops repeating
+    uint32_t now = time_us_32();
+    if(pico_state.jogging && pico_state.jog_axis == axis && pico_state.jog_direction == direction)
+    {
+        pico_state.jog_until_us = now + DRV_JOG_TIMEOUT_US;
+        return false;
+    }
+    if(!drv_jog_stop())
+        return false;
+
+    // Plan all the way to the travel limit in the mode of the step value (or smaller if the axis is between its steps)
+    double location = pico_state.drv_location_pending[axis];
+    double limit = direction ? machine_profile.max_steps[axis] : machine_profile.min_steps[axis];
+    double distance = direction ? limit - location : location - limit;
+    if(distance <= 0)
+        return false;
+    uint8_t mode = drv_determine_mode(step), distance_mode = drv_determine_mode(distance);
+    if(mode == DRV_MODE_INVALID || distance_mode == DRV_MODE_INVALID)
+        return false;
+    if(distance_mode > mode) mode = distance_mode;
+    uint8_t mode_pins = drv_mode_pins(mode);
+    uint32_t steps = drv_step_amount_mode(distance, mode);
+
+    drv_queue_node_t node = {
+        .mode_0 = GET_BIT_N(mode_pins, 0),
+        .mode_1 = GET_BIT_N(mode_pins, 1),
+        .mode_2 = GET_BIT_N(mode_pins, 2),
+        .jog = true,
+        .sequence = ++pico_state.sequence,
+    };
+    node.steps[axis] = steps;
+    node.dir[axis] = direction;
+
+    // The step value every DRV_JOG_STEP_PERIOD_US (Never faster than the profile allows)
+    double delay = drv_determine_step(node.mode_0, node.mode_1, node.mode_2) / step * DRV_JOG_STEP_PERIOD_US / 2;
+    node.step_delay_us = drv_plan_step_delay(&node);
+    if(delay > node.step_delay_us)
+        node.step_delay_us = delay > 0xFFFF ? 0xFFFF : (uint16_t)ceil(delay);
+
+    pico_state.drv_location_pending[axis] = limit;
+
+    pico_state.jog_axis = axis;
+    pico_state.jog_direction = direction;
+    pico_state.jog_until_us = now + DRV_JOG_TIMEOUT_US;
+    pico_state.jogging = true;
+    drv_queue_node(&node);
+    return true;
+}
+
+bool drv_jog_stop(void)
+{
+    if(!pico_state.jogging)
+        return true;
+
+    // Core 1 stops at its next step (or as soon as it gets to the jog). This runs in the UART interrupt so it isn't waited for,
+    // the next key tries again once core 1 has resynced the pending location
+    pico_state.jog_until_us = time_us_32();
+    return !pico_state.jogging;
+}
 
-    // Handle Position Underflow
-    // Check if new location less than our set minimum
-    if(x < DRV_X_MIN_STEPS) x = DRV_X_MIN_STEPS;
-    if(y < DRV_Y_MIN_STEPS) y = DRV_Y_MIN_STEPS;
-    if(z < DRV_Z_MIN_STEPS) z = DRV_Z_MIN_STEPS;
+void drv_measure_key_latency(uint32_t pressed_us)
+{
+    pico_state.key_pressed_us = pressed_us;
+    pico_state.key_latency_pending = true;
+}
 
-    // For Each Axis Determine the Direction
-    bool x_dir = pico_state.drv_x_location_pending <= x,
-        y_dir = pico_state.drv_y_location_pending <= y,
-        z_dir = pico_state.drv_z_location_pending <= z;
+bool drv_append_position(double x, double y, double z)
+{
+    return drv_go_to_position(
+        pico_state.drv_location_pending[X] + x, 
+        pico_state.drv_location_pending[Y] + y, 
+        pico_state.drv_location_pending[Z] + z
+    );
+}
+
+bool drv_go_to_position(double x, double y, double z)
+{
+    double position[DRV_AXIS_COUNT];
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        position[axis] = pico_state.drv_location_pending[axis];
+    position[X] = x;
+    position[Y] = y;
+    position[Z] = z;
+    return drv_go_to_axes(position);
+}
 
-    // For Each Axis Determine the Distance Required
-    // As we have calculated the direction 
-    // get the absolute distance between the current axis vs where we want to be
-    double x_distance = fabs(pico_state.drv_x_location_pending - x),
-        y_distance = fabs(pico_state.drv_y_location_pending - y),
-        z_distance = fabs(pico_state.drv_z_location_pending - z);
+// NOTE: Positions should be absolute values here (not relative)
+bool drv_go_to_axes(const double position[DRV_AXIS_COUNT])
+{
+    // Nothing can be queued until an abort (or a jog) has resynced the pending location
+    if(pico_state.aborting || !drv_jog_stop())
+        return false;
 
-    // For Each Axis Determine the Mode Required
-    int8_t x_mode = drv_determine_mode(x_distance),
-        y_mode = drv_determine_mode(y_distance),
-        z_mode = drv_determine_mode(z_distance);
+    // Every movement is counted (even one that goes nowhere) so the host can tell which of the ones it sent are done
+    uint32_t sequence = ++pico_state.sequence;
 
-    // Get the Largest Mode (which is the smallest step) (As all motors share modes)
-    uint8_t mode_mask = x_mode;
-    if (y_mode > mode_mask) mode_mask = y_mode;
-    if (z_mode > mode_mask) mode_mask = z_mode;
+    double target[DRV_AXIS_COUNT], distance[DRV_AXIS_COUNT];
+    uint8_t mode = 0;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+        // Handle Position Overflows & Underflows
+        // Keep the new location inside the travel limits of the machine profile
+        target[axis] = position[axis];
+        if(target[axis] > machine_profile.max_steps[axis]) target[axis] = machine_profile.max_steps[axis];
+        if(target[axis] < machine_profile.min_steps[axis]) target[axis] = machine_profile.min_steps[axis];
+
+        // Determine the Distance Required
+        // get the absolute distance between the current axis vs where we want to be
+        distance[axis] = fabs(pico_state.drv_location_pending[axis] - target[axis]);
+
+        // Get the Largest Mode (which is the smallest step) (As all motors share modes)
+        uint8_t axis_mode = drv_determine_mode(distance[axis]);
+        if(axis_mode > mode) mode = axis_mode;
+    }
 
     // Validate that the provided position is within the allowed stepping range (as position is steps)
     // e.g. The new position is divisible by 0.03125 (32 microsteps)
-    // Check the Error bit of the mode_mask
-    if(GET_BIT_N(mode_mask, 3))
-        return; // TODO: Find a better way to display this error
-
-    // Update the pending locations
-    pico_state.drv_x_location_pending = x;
-    pico_state.drv_y_location_pending = y;
-    pico_state.drv_z_location_pending = z;
+    if(mode == DRV_MODE_INVALID)
+        return false;
+    uint8_t mode_pins = drv_mode_pins(mode);
 
     // Add Changes to the Queue
     drv_queue_node_t node = {
-        .x_steps = drv_step_amount_masked(x_distance, mode_mask),
-        .x_dir = x_dir,
-        .y_steps = drv_step_amount_masked(y_distance, mode_mask),
-        .y_dir = y_dir,
-        .z_steps = drv_step_amount_masked(z_distance, mode_mask),
-        .z_dir = z_dir,
-        #ifndef A4988_DRIVER
-        // A4988_DRIVER modes are inversed compared to he DRV8825
-        .mode_0 = GET_BIT_N(mode_mask, 2), 
-        .mode_1 = GET_BIT_N(mode_mask, 1), 
-        .mode_2 = GET_BIT_N(mode_mask, 0)
-        #else
-        .mode_0 = GET_BIT_N(mode_mask, 0), 
-        .mode_1 = GET_BIT_N(mode_mask, 1), 
-        .mode_2 = GET_BIT_N(mode_mask, 2)
-        #endif
+        // Pin levels of the mode come from the driver's table (drivers.h)
+        .mode_0 = GET_BIT_N(mode_pins, 0), 
+        .mode_1 = GET_BIT_N(mode_pins, 1), 
+        .mode_2 = GET_BIT_N(mode_pins, 2),
+        .sequence = sequence,
     };
-    queue_push(&pico_state.step_queue, &node);
+
+    // Determine the Direction & Steps of each Axis and Update the pending locations
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+        node.dir[axis] = pico_state.drv_location_pending[axis] <= target[axis];
+        node.steps[axis] = drv_step_amount_mode(distance[axis], mode);
+        pico_state.drv_location_pending[axis] = target[axis];
+    }
+    node.step_delay_us = drv_plan_step_delay(&node);
+    drv_queue_node(&node);
+    return true;
+}
+
+bool drv_queue_segment(const drv_segment_t *segment)
+{
+    if(pico_state.aborting || !drv_jog_stop())
+        return false;
+
+    drv_queue_node_t node = {0};
+    queue_node_from_segment(&node, segment);
+    node.sequence = ++pico_state.sequence;
+
+    // The segment has already been planned so just move the pending location by the distance it will travel
+    double step_size = drv_determine_step(node.mode_0, node.mode_1, node.mode_2);
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        pico_state.drv_location_pending[axis] += (node.dir[axis] ? 1 : -1) * drv_determine_distance(step_size, node.steps[axis]);
+
+    drv_queue_node(&node);
+    return true;
+}
+
+void drv_queue_node(drv_queue_node_t *node)
+{
+    if(pico_state.aborting)
+        return;
+
+    // Keep a copy of the movement if a job is being recorded
+    // (Before merging, replaying merges it again. A jog only knows where it stops once it has)
+    if(job_is_recording() && !node->jog)
+        job_record_node(node);
+
+    // Core 1 ran out part way through the batch and this carries it on, so the batch stopped and started again
+    if(pico_state.batch_open && pico_state.batch_starved)
+    {
+        pico_state.batch_starved = false;
+        pico_state.batch_underruns++;
+        pico_state.underruns++;
+    }
+
+    // Join straight moves and overlap pen moves with travel if the last node is still waiting in the queue
+    if(!queue_try_merge(&pico_state.step_queue, node, drv_merge_nodes))
+        queue_push(&pico_state.step_queue, node);
     
-    // Send the GPIO Process Signal if we are using Interrupts
-    #ifdef WAIT_FOR_INTERRUPT_CORE_1
-    gpio_put(PROCESS_QUEUE, GPIO_LOW);
-    gpio_put(PROCESS_QUEUE, GPIO_HIGH);
-    #endif
+    // Send the GPIO Process Signal in case we are using Interrupts
+    drv_signal_process_queue();
+}
+
+bool drv_batch_open(uint32_t prefix)
+{
+    if(pico_state.batch_open || pico_state.aborting)
+        return false;
+
+    pico_state.batch_number++;
+    pico_state.batch_underruns = 0;
+    pico_state.batch_starved = false;
+    pico_state.batch_open = true;
+
+    // Staged nodes take up the heap so never hold more than the queue should have
+    queue_stage(&pico_state.step_queue, prefix && prefix < QUEUE_CAPACITY ? prefix : QUEUE_CAPACITY);
+    return true;
+}
+
+bool drv_batch_commit(void)
+{
+    if(!pico_state.batch_open)
+        return false;
+
+    pico_state.batch_open = false;
+    pico_state.batch_starved = false;
+    queue_enable(&pico_state.step_queue, true);
+    drv_signal_process_queue();
+    return true;
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "hardware/irq.h"
 #include "queue.h"
 #include "utils.h"
+#include "drivers.h"
 
 #define GPIO_HIGH   1
 #define GPIO_LOW    0
@@ -21,6 +22,15 @@
 #define PICO_STOP_BITS       1
 #define PICO_PARITY          UART_PARITY_NONE
 
+// USB Settings (The PICO's own USB CDC from pico_stdio_usb. Carries the same commands, replies & telemetry as the UART)
+// Bytes read from the USB CDC at once (One full speed bulk packet)
+#define PICO_USB_PACKET_SIZE 64
+// Input read over USB that is waiting for room in the Step Queue. Once it is full the host is held back by the USB flow control
+#define PICO_USB_INPUT_SIZE  1024
+
+// Where the last input came from. Replies and telemetry only go back over that transport (Both until the first input)
+typedef enum { PICO_TRANSPORT_ANY, PICO_TRANSPORT_UART, PICO_TRANSPORT_USB } PICO_TRANSPORT;
+
 // PICO GPIO PINS
 #define PICO_UART_TX         0
 #define PICO_UART_RX         1
@@ -43,16 +53,58 @@
 #define DRV_Z_STEP          14
 #define DRV_Z_DIRECTION     15
 
-
 #define SPINDLE_TOGGLE      16
 
+#define DRV_A_STEP          17
+#define DRV_A_DIRECTION     18
+
 #define PROCESS_QUEUE       21
 
-// Wait for Interrupt to process the step queue. Comment out define to just sleep
+// Half of the shortest step period. Each period is tWH(STEP) + tWL(STEP) of the driver at least (drivers.h) so this is also the fastest we step
+#define DRV_STEP_DELAY_US   DRV_STEP_DELAY_MIN_US
+// time_us_32 only counts whole microseconds so the step loop waits for one more to be sure each period is complete.
+// Every step period takes 2 step delays and this much more, which planned durations include (So does compiler.js)
+#define DRV_STEP_PERIOD_EXTRA_US    1
+
+// Defaults for the Machine Profile (profile.h). The profile saved in flash is used instead when there is one
+#define DRV_DIRECTION_SETUP_US  DRV_SETUP_MIN_US // Setup Time (The hold time is covered by the last STEP low time)
+#define DRV_MODE_SETUP_US       DRV_SETUP_MIN_US
+#define DRV_ENABLE_DELAY_US     DRV_WAKE_US
+#define SPINDLE_SPINUP_US       200000
+#define DRV_STEPS_PER_MM        0 // Not calibrated
+#define DRV_MAX_RATE            0 // Only limited by the step delay
+#define DRV_ACCELERATION        0
+
+// Step delay a feed hold decelerates to before stopping (The delay doubles every step while holding)
+#define DRV_HOLD_STOP_DELAY_US  500
+
+// Continuous Jog (Manual Draw). A movement key that repeats within DRV_JOG_START_US (The terminal's delay before it repeats
+// a held key) jogs the axis until the repeats stop for DRV_JOG_TIMEOUT_US. The axis moves the step value every DRV_JOG_STEP_PERIOD_US
+#define DRV_JOG_START_US        750000
+#define DRV_JOG_TIMEOUT_US      100000
+#define DRV_JOG_STEP_PERIOD_US  50000
+
+// Real-Time Commands. Single bytes that are acted on as soon as they are received, before any menu sees them
+// (The compact stream escapes these bytes, see stream_decoder.h)
+#define RT_FEED_HOLD            '!'
+#define RT_CYCLE_START          '~'
+#define RT_ABORT                0x18 // Ctrl+X
+#define RT_FEED_OVERRIDE_RESET  0x90
+#define RT_FEED_OVERRIDE_PLUS   0x91
+#define RT_FEED_OVERRIDE_MINUS  0x92
+#define RT_HEADLESS             0x93 // Enter Headless Mode (menu.h)
+
+// Feed Override in percent of the step rate each segment was planned with
+#define RT_FEED_OVERRIDE_DEFAULT    100
+#define RT_FEED_OVERRIDE_MIN        10
+#define RT_FEED_OVERRIDE_MAX        200
+#define RT_FEED_OVERRIDE_STEP       10
+
+// Wait for Interrupt to process the step queue. Comment out define to just sleep (Default of the machine profile)
 #define WAIT_FOR_INTERRUPT_CORE_1
 
 
-// Maximum and Minimum Nuber of Steps available on each axis (from a arbitray origin)
+// Maximum and Minimum Nuber of Steps available on each axis (from a arbitray origin) (Defaults of the machine profile)
 // TODO: Get the Max Steps Possible for each axis (Need to Physically Test the motors)
 #define DRV_X_MAX_STEPS 100
 #define DRV_Y_MAX_STEPS 100
@@ -62,6 +114,23 @@
 #define DRV_Y_MIN_STEPS 0
 #define DRV_Z_MIN_STEPS 0
 
+// The rotary axis travels one turn of a 200 step motor
+#define DRV_A_MAX_STEPS 200
+#define DRV_A_MIN_STEPS 0
+
+// Masks of the STEP and DIRECTION pins of every axis
+#define DRV_STEP_PINS \
+    (1 << DRV_X_STEP)       |\
+    (1 << DRV_Y_STEP)       |\
+    (1 << DRV_Z_STEP)       |\
+    (1 << DRV_A_STEP)
+
+#define DRV_DIRECTION_PINS \
+    (1 << DRV_X_DIRECTION)  |\
+    (1 << DRV_Y_DIRECTION)  |\
+    (1 << DRV_Z_DIRECTION)  |\
+    (1 << DRV_A_DIRECTION)
+
 // Mask of all the gpio pin w/ direction out
 #define GPIO_OUTPUT_PINS \
     (1 << DRV_RESET)        |\
@@ -73,12 +142,8 @@
     (1 << DRV_MODE_1)       |\
     (1 << DRV_MODE_2)       |\
                              \
-    (1 << DRV_X_DIRECTION)  |\
-    (1 << DRV_X_STEP)       |\
-    (1 << DRV_Y_DIRECTION)  |\
-    (1 << DRV_Y_STEP)       |\
-    (1 << DRV_Z_DIRECTION)  |\
-    (1 << DRV_Z_STEP)       |\
+    DRV_STEP_PINS           |\
+    DRV_DIRECTION_PINS      |\
                              \
     (1 << SPINDLE_TOGGLE)
 
@@ -86,14 +151,28 @@
 #define GPIO_INPUT_PINS 0
 
    
-typedef enum { X, Y, Z } DRV_DRIVER;
+typedef enum { X, Y, Z, A } DRV_DRIVER;
+
+// Axis Descriptor. Everything that differs between the axes so the planner and the step loop handle them all the same way
+typedef struct {
+    // Name used in $ commands, replies and the profile (eg. max_steps_a)
+    char name;
+    uint8_t step_pin, direction_pin;
+    // Drive the DIRECTION pin low to move towards the max (A motor that is wired the other way round)
+    bool invert_direction;
+    // Default travel limits of the machine profile
+    double min_steps, max_steps;
+} drv_axis_t;
+
+// Descriptors of every axis (Indexed by DRV_DRIVER)
+extern const drv_axis_t drv_axes[DRV_AXIS_COUNT];
 
 typedef struct {
-    // The Current Location of the Axis in Microsteps
-    double drv_x_location, drv_y_location, drv_z_location;
+    // The Current Location of each Axis in Microsteps
+    double drv_location[DRV_AXIS_COUNT];
 
     // The Future absolute location based on upcoming movements
-    double drv_x_location_pending, drv_y_location_pending, drv_z_location_pending;
+    double drv_location_pending[DRV_AXIS_COUNT];
 
     // The Currently Enabled Modes
     bool mode_0, mode_1, mode_2;
@@ -108,7 +187,56 @@ typedef struct {
     bool drv_enabled;
 
     // Motor Direction
-    bool drv_x_direction, drv_y_direction, drv_z_direction;
+    bool drv_direction[DRV_AXIS_COUNT];
+
+    // Real-Time Command State. Set by core 0 and checked by core 1 before every step
+    volatile bool feed_hold;
+    // Set until core 1 has stopped stepping, emptied the queue and resynced the pending location
+    volatile bool aborting;
+    volatile uint16_t feed_override;
+
+    // Dead time between the last pulse of a node and the first pulse of the next (Only measured when they run back to back)
+    // The max is since startup
+    volatile uint32_t segment_gap_us, segment_gap_max_us;
+
+    // Step Loop Counters (Reset and read by the benchmark). Pulses made, time spent stepping (including the gaps
+    // between back to back nodes) and the part of that spent waiting out step periods
+    volatile uint32_t step_loop_pulses, step_loop_us, step_loop_wait_us;
+
+    // Continuous Jog. Core 1 steps a jog node until time_us_32() passes jog_until_us (Pushed back by every key repeat).
+    // jogging is set from when a jog is queued until core 1 has stopped it and resynced the pending location
+    volatile bool jogging;
+    volatile uint32_t jog_until_us;
+    DRV_DRIVER jog_axis;
+    bool jog_direction;
+
+    // Keypress to first pulse of the movement it queued (Manual Draw). The max is since startup
+    volatile uint32_t key_pressed_us, key_latency_us, key_latency_max_us;
+    volatile bool key_latency_pending;
+
+    // Batch Staging. batch_open is set from when a batch is opened until it is committed. batch_starved is set by core 1
+    // when it runs out of movements part way through the open batch and becomes an underrun once the batch carries on
+    // (Running out after the last movement of a batch that hasn't been committed yet isn't one). underruns is since startup
+    volatile bool batch_open, batch_starved;
+    uint32_t batch_number;
+    volatile uint32_t batch_underruns, underruns;
+
+    // Nodes joined onto the one before them while it was waiting in the queue because they carried straight on (Since startup)
+    volatile uint32_t merged_nodes;
+
+    // Sequence number given to the last movement that was queued (checkpoint.h)
+    uint32_t sequence;
+    // Sequence number of the movement core 1 is stepping (0 when it is idle or the movement isn't numbered)
+    volatile uint32_t sequence_active;
+    // The last movement core 1 finished and where the axes were when it did. sequence_done_version is odd
+    // while core 1 is changing them so core 0 can tell if it read them part way through
+    volatile uint32_t sequence_done, sequence_done_version;
+    volatile double sequence_done_location[DRV_AXIS_COUNT];
+
+    // The transport the last input came from (pico_set_transport)
+    volatile PICO_TRANSPORT transport;
+    // Set by the UART interrupt when input arrives. The main loop switches the transport to it (usb_input_service)
+    volatile bool uart_input;
 
 } PICO_STATE;
 
@@ -122,8 +250,16 @@ void pico_uart_init(irq_handler_t handler);
 void pico_gpio_init(int n_pins, ...);
 // (Helper Function) Disable UART Functionality 
 void pico_uart_deinit(void);
-
-// Process the Step Queue (Blocking)
+// (Helper Function) Hold off the UART interrupt while core 0 thread code (the main loop) queues movements.
+// The interrupt queues movements too and would wait forever on the step queue lock held by the code it interrupted
+void pico_uart_irq_pause(bool paused);
+// (Helper Function) Read up to length bytes that have arrived over USB. Returns how many were read (0 if there are none)
+int pico_usb_read(char *buffer, int length);
+// (Helper Function) Send stdout (replies & telemetry) only over the transport input last came from. Never switches from USB to
+// the UART while a USB host is attached. Only call it from core 0 thread code as it changes the stdio drivers
+void pico_set_transport(PICO_TRANSPORT transport);
+
+// Process the Step Queue (Blocking). The next node is popped and prepared while the current one is pulsing
 void process_step_queue(void);
 // Toggle the Spindle Motor
 void enable_spindle(bool enabled);
@@ -132,11 +268,42 @@ void drv_set_mode(bool mode_0, bool mode_1, bool mode_2);
 // Set the Direction for a DRV
 void drv_set_direction(DRV_DRIVER axis, bool direction);
 
-// Finds the Optimal modes and Direction to get the specified absolute position
-void drv_go_to_position(double x, double y, double z);
+// Finds the Optimal modes and Direction to get the specified absolute position of every axis. Returns false if nothing was queued:
+// while aborting, until a jog has stopped (drv_jog_stop) or for a position that isn't a multiple of the smallest step
+bool drv_go_to_axes(const double position[DRV_AXIS_COUNT]);
+// Same as drv_go_to_axes for X, Y & Z. The other axes stay where they are
+bool drv_go_to_position(double x, double y, double z);
 // Appends the Given values onto the existing position
-void drv_append_position(double x, double y, double z);
-
+bool drv_append_position(double x, double y, double z);
+// Jog an axis towards its travel limit at the step value every DRV_JOG_STEP_PERIOD_US until the jog is no longer pushed back
+// (Called again for every key repeat). Returns true if a new jog was queued (Never while a batch is open)
+bool drv_jog(DRV_DRIVER axis, bool direction, double step);
+// Stop jogging at the next step. Fails until core 1 has stopped and resynced the pending location (Call again to check)
+bool drv_jog_stop(void);
+// Measure the time from a keypress (time_us_32() when it was received) to the first pulse core 1 makes after it.
+// Clear key_latency_pending if the keypress didn't queue anything
+void drv_measure_key_latency(uint32_t pressed_us);
+// Queues an already planned segment (eg. from a stored job) and updates the pending location. Refused the same way as drv_go_to_axes
+bool drv_queue_segment(const drv_segment_t *segment);
+// Adds a node to the step queue (joining straight moves and merging pen moves into the travel around them) and signals core 1 to process it
+void drv_queue_node(drv_queue_node_t *node);
+// Open a batch. Movements queued from now on are staged and only start once prefix of them are queued
+// (0 or more than QUEUE_CAPACITY waits for QUEUE_CAPACITY) or the batch is committed, so a slow link can't starve a path
+// part way through. Fails if a batch is already open
+bool drv_batch_open(uint32_t prefix);
+// Start everything that is staged and close the batch. Its underruns are final from here. Fails if no batch is open
+bool drv_batch_commit(void);
+
+
+// Pause the step queue with a controlled stop (Decelerates then holds position)
+void drv_feed_hold(void);
+// Carry on after a feed hold
+void drv_cycle_start(void);
+// Change the feed override by a percentage (0 resets it)
+void drv_adjust_feed_override(int change);
+// Stop all movement, empty the step queue and resync the pending location to where the axes actually are
+// (Core 1 does both once it has stopped. Nothing can be queued until then so it is safe from the UART interrupt)
+void drv_abort(void);
 
 // Enable All DRV Drivers
 void drv_enable_driver(bool enabled);
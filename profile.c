@@ -0,0 +1,236 @@
+#include "profile.h"
+#include "pico.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+machine_profile_t machine_profile;
+
+// Copy of the profile waiting to be written to flash by profile_service
+static machine_profile_t profile_pending;
+static volatile bool profile_save_pending;
+
+// Types of the values that can be set by name
+typedef enum { PROFILE_FLOAT, PROFILE_DOUBLE, PROFILE_UINT16, PROFILE_UINT32, PROFILE_BOOL } PROFILE_TYPE;
+
+typedef struct {
+    const char *name;
+    PROFILE_TYPE type;
+    size_t offset;
+    // An array with a value for every axis. Each one is named after its axis (eg. max_steps_x)
+    bool per_axis;
+} profile_field_t;
+
+// Every value of the profile that can be read and set over serial
+static const profile_field_t profile_fields[] = {
+    { "steps_per_mm", PROFILE_FLOAT, offsetof(machine_profile_t, steps_per_mm), true },
+    { "max_steps", PROFILE_DOUBLE, offsetof(machine_profile_t, max_steps), true },
+    { "min_steps", PROFILE_DOUBLE, offsetof(machine_profile_t, min_steps), true },
+    { "max_rate", PROFILE_FLOAT, offsetof(machine_profile_t, max_rate), true },
+    { "acceleration", PROFILE_FLOAT, offsetof(machine_profile_t, acceleration), true },
+    { "step_delay_us", PROFILE_UINT16, offsetof(machine_profile_t, step_delay_us) },
+    { "direction_setup_us", PROFILE_UINT16, offsetof(machine_profile_t, direction_setup_us) },
+    { "mode_setup_us", PROFILE_UINT16, offsetof(machine_profile_t, mode_setup_us) },
+    { "enable_delay_us", PROFILE_UINT16, offsetof(machine_profile_t, enable_delay_us) },
+    { "spindle_spinup_us", PROFILE_UINT32, offsetof(machine_profile_t, spindle_spinup_us) },
+    { "wait_for_interrupt", PROFILE_BOOL, offsetof(machine_profile_t, wait_for_interrupt) },
+    { "headless", PROFILE_BOOL, offsetof(machine_profile_t, headless) },
+};
+
+#define PROFILE_FIELD_COUNT (sizeof(profile_fields) / sizeof(profile_fields[0]))
+
+// Size of a value of each type
+static const size_t profile_type_sizes[] = { sizeof(float), sizeof(double), sizeof(uint16_t), sizeof(uint32_t), sizeof(bool) };
+
+// Where a value of a field is in the profile (The axis is ignored unless the field has one value per axis)
+static uint8_t *profile_value(const profile_field_t *field, uint8_t axis)
+{
+    return (uint8_t *)&machine_profile + field->offset + (field->per_axis ? axis * profile_type_sizes[field->type] : 0);
+}
+
+// The axis a name picks out of a field (0 for a field without axes) or -1 if the name isn't for the field
+static int profile_match(const profile_field_t *field, const char *name)
+{
+    size_t length = strlen(field->name);
+    if(!field->per_axis)
+        return strcmp(field->name, name) ? -1 : 0;
+    if(strncmp(field->name, name, length) || name[length] != '_' || !name[length + 1] || name[length + 2])
+        return -1;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+        if(drv_axes[axis].name == name[length + 1])
+            return axis;
+    return -1;
+}
+
+// FNV-1a hash of the profile up to the checksum
+static uint32_t profile_checksum(const machine_profile_t *profile)
+{
+    const uint8_t *bytes = (const uint8_t *)profile;
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < offsetof(machine_profile_t, checksum); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void profile_reset(void)
+{
+    // Zero everything (including padding) so the checksum only depends on the values
+    memset(&machine_profile, 0, sizeof(machine_profile_t));
+    machine_profile.magic = PROFILE_MAGIC;
+    machine_profile.version = PROFILE_VERSION;
+    machine_profile.size = sizeof(machine_profile_t);
+
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+        machine_profile.steps_per_mm[axis] = DRV_STEPS_PER_MM;
+        machine_profile.max_steps[axis] = drv_axes[axis].max_steps;
+        machine_profile.min_steps[axis] = drv_axes[axis].min_steps;
+        machine_profile.max_rate[axis] = DRV_MAX_RATE;
+        machine_profile.acceleration[axis] = DRV_ACCELERATION;
+    }
+
+    machine_profile.step_delay_us = DRV_STEP_DELAY_US;
+    machine_profile.direction_setup_us = DRV_DIRECTION_SETUP_US;
+    machine_profile.mode_setup_us = DRV_MODE_SETUP_US;
+    machine_profile.enable_delay_us = DRV_ENABLE_DELAY_US;
+    machine_profile.spindle_spinup_us = SPINDLE_SPINUP_US;
+
+    #ifdef WAIT_FOR_INTERRUPT_CORE_1
+    machine_profile.wait_for_interrupt = true;
+    #endif
+
+    machine_profile.checksum = profile_checksum(&machine_profile);
+}
+
+void profile_load(void)
+{
+    const machine_profile_t *saved = (const machine_profile_t *)flash_store_read(PROFILE_OFFSET);
+
+    // Anything that isn't a complete profile from this version of the firmware is ignored
+    if(saved->magic != PROFILE_MAGIC || saved->version != PROFILE_VERSION || saved->size != sizeof(machine_profile_t) ||
+        saved->checksum != profile_checksum(saved))
+    {
+        profile_reset();
+        return;
+    }
+    memcpy(&machine_profile, saved, sizeof(machine_profile_t));
+}
+
+bool profile_save(void)
+{
+    // Writing to flash parks core 1 so don't do it part way through a movement
+    if(!queue_is_idle(&pico_state.step_queue))
+        return false;
+
+    // Saved as it is now. Anything set before it has been written waits for the next save
+    machine_profile.checksum = profile_checksum(&machine_profile);
+    memcpy(&profile_pending, &machine_profile, sizeof(machine_profile_t));
+    profile_save_pending = true;
+    return true;
+}
+
+bool profile_service(void)
+{
+    if(!profile_save_pending)
+        return false;
+
+    // Wait for anything queued since the save was asked for
+    if(!queue_is_idle(&pico_state.step_queue))
+        return true;
+
+    flash_writer_t writer;
+    if(flash_writer_open(&writer, PROFILE_OFFSET, PROFILE_SIZE))
+    {
+        flash_writer_write(&writer, &profile_pending, sizeof(machine_profile_t));
+        flash_writer_close(&writer);
+    }
+    profile_save_pending = false;
+    return false;
+}
+
+bool profile_set(const char *name, double value)
+{
+    for(size_t i = 0; i < PROFILE_FIELD_COUNT; i++)
+    {
+        const profile_field_t *field = &profile_fields[i];
+        int axis = profile_match(field, name);
+        if(axis < 0)
+            continue;
+
+        uint8_t *location = profile_value(field, axis);
+        switch(field->type)
+        {
+        case PROFILE_FLOAT:
+            if(value < 0)
+                return false;
+            *(float *)location = (float)value;
+            break;
+        case PROFILE_DOUBLE:
+            *(double *)location = value;
+            break;
+        case PROFILE_UINT16:
+            if(value < 0 || value > 0xFFFF)
+                return false;
+            *(uint16_t *)location = (uint16_t)value;
+            break;
+        case PROFILE_UINT32:
+            if(value < 0 || value > 0xFFFFFFFF)
+                return false;
+            *(uint32_t *)location = (uint32_t)value;
+            break;
+        case PROFILE_BOOL:
+            *(bool *)location = value != 0;
+            break;
+        }
+
+        // Never step faster than the driver allows
+        if(machine_profile.step_delay_us < DRV_STEP_DELAY_US)
+            machine_profile.step_delay_us = DRV_STEP_DELAY_US;
+
+        machine_profile.checksum = profile_checksum(&machine_profile);
+        return true;
+    }
+    return false;
+}
+
+void profile_print(void)
+{
+    // The driver is picked when the firmware is built (drivers.h) so it can only be read
+    printf("$driver=%d\n", STEPPER_DRIVER);
+    for(size_t i = 0; i < PROFILE_FIELD_COUNT; i++)
+    {
+        const profile_field_t *field = &profile_fields[i];
+        for(uint8_t axis = 0; axis < (field->per_axis ? DRV_AXIS_COUNT : 1); axis++)
+        {
+            // Per axis values are named after their axis (eg. $max_steps_x)
+            char name[32];
+            if(field->per_axis)
+                snprintf(name, sizeof(name), "%s_%c", field->name, drv_axes[axis].name);
+            else
+                snprintf(name, sizeof(name), "%s", field->name);
+
+            const uint8_t *location = profile_value(field, axis);
+            switch(field->type)
+            {
+            case PROFILE_FLOAT:
+                printf("$%s=%g\n", name, *(const float *)location);
+                break;
+            case PROFILE_DOUBLE:
+                printf("$%s=%g\n", name, *(const double *)location);
+                break;
+            case PROFILE_UINT16:
+                printf("$%s=%u\n", name, *(const uint16_t *)location);
+                break;
+            case PROFILE_UINT32:
+                printf("$%s=%lu\n", name, (unsigned long)*(const uint32_t *)location);
+                break;
+            case PROFILE_BOOL:
+                printf("$%s=%d\n", name, *(const bool *)location);
+                break;
+            }
+        }
+    }
+}
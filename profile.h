@@ -0,0 +1,74 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "flash_store.h"
+#include "queue.h"
+
+// Runtime Machine Profile
+// The limits and timings of the machine. Loaded from flash at startup (the defaults in pico.h are used when
+// no valid profile has been saved), read and changed over serial with $ commands and saved back with $save
+
+// "PROF" - Identifies a saved profile
+#define PROFILE_MAGIC           0x464F5250
+// Bump whenever machine_profile_t changes so a profile saved by older firmware is replaced by the defaults
+#define PROFILE_VERSION         3
+
+// Location of the profile inside the flash store (The sector between the checkpoints and the job slots)
+#define PROFILE_OFFSET          (2 * FLASH_STORE_SECTOR_SIZE)
+#define PROFILE_SIZE            FLASH_STORE_SECTOR_SIZE
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    // sizeof(machine_profile_t) when it was saved
+    uint16_t size;
+
+    // Index 0 = X, 1 = Y, 2 = Z, 3 = A (The axes of drv_axes)
+    // Full steps per mm of each axis (Only used by the host to show sizes in mm)
+    float steps_per_mm[DRV_AXIS_COUNT];
+    // Travel limits of each axis in steps. Every position is clamped to these
+    double max_steps[DRV_AXIS_COUNT], min_steps[DRV_AXIS_COUNT];
+    // Fastest each axis may move in full steps per second (0 is only limited by step_delay_us)
+    float max_rate[DRV_AXIS_COUNT];
+    // Acceleration of each axis in full steps per second^2 (Reported to the host, not planned with yet)
+    float acceleration[DRV_AXIS_COUNT];
+
+    // Driver Timings
+    // Time to hold each half of a step pulse at full speed. Never below DRV_STEP_DELAY_US
+    uint16_t step_delay_us;
+    // Setup time after changing the direction or mode pins
+    uint16_t direction_setup_us, mode_setup_us;
+    // Wake up time after enabling the drivers
+    uint16_t enable_delay_us;
+    // Time for the spindle to get up to speed after it is turned on
+    uint32_t spindle_spinup_us;
+
+    // Wake core 1 with the PROCESS_QUEUE interrupt instead of polling the queue every second (Applied on restart)
+    bool wait_for_interrupt;
+    // Start in Headless Mode instead of drawing the menus (menu.h)
+    bool headless;
+
+    // FNV-1a hash of everything before it
+    uint32_t checksum;
+} machine_profile_t;
+
+// The profile in use
+extern machine_profile_t machine_profile;
+
+// Load the saved profile from flash or the defaults if there isn't a valid one
+void profile_load(void);
+// Go back to the default profile (Not saved until profile_save is called)
+void profile_reset(void);
+// Save the profile to flash. Fails while the step queue is being processed
+// (Only takes a copy. Flash can't be written from the UART interrupt so profile_service writes it)
+bool profile_save(void);
+// Write a saved profile to flash once the machine is idle. Called from the main loop. Returns true while one is waiting
+bool profile_service(void);
+// Set a value of the profile by name (eg. max_steps_x). Returns false for an unknown name or a value out of range
+bool profile_set(const char *name, double value);
+// Print every value of the profile as $name=value lines (Starting with the read only STEPPER_DRIVER the firmware was built for)
+void profile_print(void);
+
+#endif // PROFILE_H
@@ -1,4 +1,5 @@
 #include "queue.h"
+#include "utils.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -16,12 +17,32 @@ bool queue_is_empty_mutex(drv_queue_t *queue)
     return isEmpty;
 }
 
+bool queue_is_idle(drv_queue_t *queue)
+{
+    // Single aligned words so they are read whole. processing is set before core 1 pops anything
+    const volatile drv_queue_t *shared = queue;
+    return !shared->processing && shared->length == 0;
+}
+
+bool queue_is_ready(drv_queue_t *queue)
+{
+    return queue->length > queue->held;
+}
+
+bool queue_is_ready_mutex(drv_queue_t *queue)
+{
+    mutex_enter_blocking(&queue->queue_lock);
+    bool isReady = queue_is_ready(queue);
+    mutex_exit(&queue->queue_lock);
+    return isReady;
+}
+
 void queue_pop(drv_queue_t *queue, drv_queue_node_t *node)
 {
     mutex_enter_blocking(&queue->queue_lock);
     
-    // Check to see if we have nodes in the queue
-    if(!queue_is_empty(queue))
+    // Check to see if we have nodes in the queue that aren't staged
+    if(queue_is_ready(queue))
     {
         // Copy the data from the current node into the provided node
         drv_queue_node_t *start = queue->start;
@@ -55,6 +76,17 @@ void queue_peek(drv_queue_t *queue, drv_queue_node_t *node)
     mutex_exit(&queue->queue_lock);
 }
 
+// Count a movement pushed while the queue isn't running (Merged into a staged node or not) and run once enough are staged
+static void queue_count_staged(drv_queue_t *queue)
+{
+    queue->staged++;
+    if(queue->release_at && queue->staged >= queue->release_at)
+    {
+        queue->running = true;
+        queue->held = 0;
+    }
+}
+
 void queue_push(drv_queue_t *queue, drv_queue_node_t* node)
 {   
     mutex_enter_blocking(&queue->queue_lock);
@@ -80,6 +112,46 @@ void queue_push(drv_queue_t *queue, drv_queue_node_t* node)
     queue->end = new_end;
     queue->length++;
 
+    // Hold the node until the queue runs again (or enough of them are staged)
+    if(!queue->running)
+    {
+        queue->held++;
+        queue_count_staged(queue);
+    }
+
+    mutex_exit(&queue->queue_lock);
+}
+
+bool queue_try_merge(drv_queue_t *queue, drv_queue_node_t *node, bool (*merge)(drv_queue_node_t *end, drv_queue_node_t *node))
+{
+    mutex_enter_blocking(&queue->queue_lock);
+
+    // Once Core 1 has popped the last node it is being stepped and can't change. While staging only a staged node can take it
+    // (Core 1 could take a node that isn't straight away, so the staged movement would start early)
+    bool merged = queue->end && (queue->running || queue->held) && merge(queue->end, node);
+    if(merged && !queue->running)
+        queue_count_staged(queue);
+
+    mutex_exit(&queue->queue_lock);
+    return merged;
+}
+
+void queue_clear(drv_queue_t *queue)
+{
+    mutex_enter_blocking(&queue->queue_lock);
+
+    // Free every node from the start of the queue
+    while(queue->start)
+    {
+        drv_queue_node_t *next = queue->start->next;
+        free(queue->start);
+        queue->start = next;
+    }
+    queue->end = 0;
+    queue->length = 0;
+    queue->held = 0;
+    queue->staged = 0;
+
     mutex_exit(&queue->queue_lock);
 }
 
@@ -87,6 +159,9 @@ void queue_init(drv_queue_t *queue)
 {
     mutex_init(&queue->queue_lock);
     queue->length = 0;
+    queue->held = 0;
+    queue->staged = 0;
+    queue->release_at = 0;
     queue_enable(queue, true);
 }
 
@@ -94,5 +169,43 @@ void queue_enable(drv_queue_t *queue, bool enable)
 {
     mutex_enter_blocking(&queue->queue_lock);
     queue->running = enable;
+    if(enable)
+        queue->held = queue->staged = 0;
+    mutex_exit(&queue->queue_lock);
+}
+
+void queue_stage(drv_queue_t *queue, uint32_t release_at)
+{
+    mutex_enter_blocking(&queue->queue_lock);
+    queue->running = false;
+    queue->staged = 0;
+    queue->release_at = release_at;
     mutex_exit(&queue->queue_lock);
+}
+
+void queue_node_to_segment(const drv_queue_node_t *node, drv_segment_t *segment)
+{
+    segment->dir_mask = 0;
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+        segment->steps[axis] = node->steps[axis];
+        segment->dir_mask |= node->dir[axis] << axis;
+    }
+    segment->mode_mask = node->mode_0 | (node->mode_1 << 1) | (node->mode_2 << 2);
+    segment->step_delay_us = node->step_delay_us;
+    segment->flags = node->z_align_end ? DRV_SEGMENT_Z_ALIGN_END : 0;
+}
+
+void queue_node_from_segment(drv_queue_node_t *node, const drv_segment_t *segment)
+{
+    for(uint8_t axis = 0; axis < DRV_AXIS_COUNT; axis++)
+    {
+        node->steps[axis] = segment->steps[axis];
+        node->dir[axis] = GET_BIT_N(segment->dir_mask, axis);
+    }
+    node->mode_0 = GET_BIT_N(segment->mode_mask, 0);
+    node->mode_1 = GET_BIT_N(segment->mode_mask, 1);
+    node->mode_2 = GET_BIT_N(segment->mode_mask, 2);
+    node->step_delay_us = segment->step_delay_us;
+    node->z_align_end = segment->flags & DRV_SEGMENT_Z_ALIGN_END;
 }
\ No newline at end of file
@@ -5,11 +5,15 @@
 #include "pico/mutex.h"
 
 typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
 typedef unsigned long uint32_t;
 
 
 // Queue Movements
 
+// Axes every movement steps. Index 0 = X, 1 = Y, 2 = Z, 3 = A (The rotary axis). Each one is described by drv_axes (pico.h)
+#define DRV_AXIS_COUNT  4
+
 typedef struct drv_queue_node_t {
     // Since Nodes will be statically allocated on the stack we cannot compare them to nullptrs;
     // So it will be hard to tell if it is valid
@@ -19,21 +23,52 @@ typedef struct drv_queue_node_t {
 
     /* Below properties are subject to change */
 
-    // The amount of steps we want to take. 
+    // The amount of steps we want to take on each axis.
     // The pico should calcuate the actual distance and let this be as "dumb" as possible
-    uint32_t x_steps, y_steps, z_steps;
-    // The Direction of the steps to perform on the axis
-    bool x_dir, y_dir, z_dir;
+    uint32_t steps[DRV_AXIS_COUNT];
+    // The Direction of the steps to perform on each axis (true moves towards its max)
+    bool dir[DRV_AXIS_COUNT];
     // The step mode for the steps
     bool mode_0, mode_1, mode_2;
+    // Time to hold each half of a step pulse for (Sets the step rate)
+    uint16_t step_delay_us;
+    // Step Z during the last pulses of the node instead of the first (So it finishes with X & Y)
+    bool z_align_end;
+    // Only keep stepping while the jog is held (pico.h). Stops part way when it isn't
+    bool jog;
+    // Sequence number of the last movement this node finishes (checkpoint.h). 0 isn't counted (eg. benchmark runs)
+    uint32_t sequence;
 } drv_queue_node_t;
 
+// Most nodes the host should keep queued. The queue itself is only limited by the heap, this is what the
+// free space in Headless Mode replies is counted against so a host can send ahead without running out of memory
+#define QUEUE_CAPACITY  128
+
+// Segment flags
+#define DRV_SEGMENT_Z_ALIGN_END     (1 << 0)
+
+// Compact form of a node's movement so it can be stored or sent without the queue bookkeeping
+typedef struct __attribute__((packed)) {
+    uint32_t steps[DRV_AXIS_COUNT];
+    // Bit n is the direction of axis n
+    uint8_t dir_mask;
+    // Bit 0 is mode_0, 1 is mode_1, 2 is mode_2
+    uint8_t mode_mask;
+    uint16_t step_delay_us;
+    // DRV_SEGMENT_ flags
+    uint8_t flags;
+} drv_segment_t;
+
 typedef struct {
     drv_queue_node_t *start;
     drv_queue_node_t *end;
     uint32_t length;
     mutex_t queue_lock;
+    // Nodes pushed while the queue isn't running are staged (held at the end of the queue) until it runs again
+    // or release_at movements have been staged (0 holds them until queue_enable). held is the amount of staged nodes,
+    // staged the amount of movements in them (Movements merged into a staged node are counted too)
     bool running;
+    uint32_t held, staged, release_at;
     bool processing;
 } drv_queue_t;
 
@@ -41,18 +76,37 @@ typedef struct {
 bool queue_is_empty(drv_queue_t* queue);
 // Checks to see if there are nodes in the queue and locks mutex
 bool queue_is_empty_mutex(drv_queue_t* queue);
+// Checks to see if the queue is empty and Core 1 isn't stepping a node, without the lock. For core 0 thread code
+// (eg. the main loop) which the UART IRQ can interrupt. The IRQ takes the lock too so it would wait on itself forever
+bool queue_is_idle(drv_queue_t* queue);
+// Checks to see if there are nodes that can be taken (Staged nodes are held until the queue runs)
+bool queue_is_ready(drv_queue_t* queue);
+// Checks to see if there are nodes that can be taken and locks mutex
+bool queue_is_ready_mutex(drv_queue_t* queue);
 
 
-// Return and remove the 1st node in the queue
+// Return and remove the 1st node in the queue (Unless it is staged)
 void queue_pop(drv_queue_t* queue, drv_queue_node_t* node);
 // Return the 1st node in the queue
 void queue_peek(drv_queue_t* queue, drv_queue_node_t* node);
 // Add a node to the end of the queue
 void queue_push(drv_queue_t* queue, drv_queue_node_t* node);
+// Offer a node to the last node in the queue (if there is one that hasn't been taken yet).
+// merge can change both nodes and returns true if the node was absorbed into the last one, otherwise the node still needs pushing
+bool queue_try_merge(drv_queue_t* queue, drv_queue_node_t* node, bool (*merge)(drv_queue_node_t* end, drv_queue_node_t* node));
+// Remove and free every node in the queue
+void queue_clear(drv_queue_t* queue);
 // Initialse the Queue and its mutex lock
 void queue_init(drv_queue_t* queue);
-// Set Queue Running State. So we can run batches of nodes
+// Set Queue Running State. So we can run batches of nodes. Running releases every staged node
 void queue_enable(drv_queue_t* queue, bool enable);
+// Stop running and stage every node pushed from now on until the queue is enabled again or release_at movements have been staged
+void queue_stage(drv_queue_t* queue, uint32_t release_at);
+
+// Copy the movement of a node into a segment
+void queue_node_to_segment(const drv_queue_node_t* node, drv_segment_t* segment);
+// Copy the movement of a segment into a node
+void queue_node_from_segment(drv_queue_node_t* node, const drv_segment_t* segment);
 
 
 
@@ -0,0 +1,191 @@
+#include "stream_decoder.h"
+#include "pico.h"
+#include "wcs.h"
+#include <math.h>
+
+#define STREAM_NO_TOKEN 0xFF
+
+// Map a zig-zag encoded number back to a signed number (0, 1, 2, 3 => 0, -1, 1, -2)
+static int32_t stream_unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// The amount of operands that follow each token
+static uint8_t stream_operand_count(uint8_t token)
+{
+    switch (token)
+    {
+    case STREAM_TOKEN_END:
+        return 0;
+    case STREAM_TOKEN_PEN_UP:
+    case STREAM_TOKEN_PEN_DOWN:
+    case STREAM_TOKEN_REPEAT:
+        return 1;
+    case STREAM_TOKEN_MOVE:
+    case STREAM_TOKEN_MOVE_TO:
+        return 2;
+    case STREAM_TOKEN_SEGMENT:
+        return 5;
+    default:
+        return STREAM_NO_TOKEN;
+    }
+}
+
+// Queue a movement to the decoder's current position (In work coordinates)
+static bool stream_go_to_position(stream_decoder_t *decoder)
+{
+    return wcs_go_to_position(decoder->x, decoder->y, decoder->z);
+}
+
+// Carry on from wherever the queued movements will leave us (In work coordinates)
+static void stream_sync_position(stream_decoder_t *decoder)
+{
+    int32_t units[3];
+    wcs_from_machine(pico_state.drv_location_pending[X], pico_state.drv_location_pending[Y], pico_state.drv_location_pending[Z], units);
+    decoder->x = units[X];
+    decoder->y = units[Y];
+    decoder->z = units[Z];
+}
+
+// Queue a segment that was planned by the host and keep track of where it leaves us
+static bool stream_queue_segment(stream_decoder_t *decoder)
+{
+    drv_segment_t segment = {
+        .dir_mask = decoder->operands[0] & 0b111,
+        .mode_mask = (decoder->operands[0] >> 3) & 0b111,
+        .steps = { decoder->operands[1], decoder->operands[2], decoder->operands[3] }, // Planned segments only move X, Y & Z
+        .step_delay_us = decoder->operands[4],
+        .flags = (decoder->operands[0] >> 6) & DRV_SEGMENT_Z_ALIGN_END
+    };
+    if (!drv_queue_segment(&segment))
+        return false;
+
+    // Relative movements after the segment carry on from the new pending location
+    stream_sync_position(decoder);
+    return true;
+}
+
+// Act on a token once all of its operands have been received. Returns false if a movement was refused
+static bool stream_execute(stream_decoder_t *decoder)
+{
+    switch (decoder->token)
+    {
+    case STREAM_TOKEN_PEN_UP:
+    case STREAM_TOKEN_PEN_DOWN:
+        decoder->z = decoder->operands[0];
+        return stream_go_to_position(decoder);
+    case STREAM_TOKEN_MOVE:
+        decoder->last_dx = stream_unzigzag(decoder->operands[0]);
+        decoder->last_dy = stream_unzigzag(decoder->operands[1]);
+        decoder->x += decoder->last_dx;
+        decoder->y += decoder->last_dy;
+        return stream_go_to_position(decoder);
+    case STREAM_TOKEN_REPEAT:
+        for (uint32_t i = 0; i < decoder->operands[0]; i++)
+        {
+            decoder->x += decoder->last_dx;
+            decoder->y += decoder->last_dy;
+            if (!stream_go_to_position(decoder))
+                return false;
+        }
+        return true;
+    case STREAM_TOKEN_MOVE_TO:
+        decoder->x = decoder->operands[0];
+        decoder->y = decoder->operands[1];
+        return stream_go_to_position(decoder);
+    case STREAM_TOKEN_SEGMENT:
+        return stream_queue_segment(decoder);
+    default:
+        return true;
+    }
+}
+
+void stream_decoder_start(stream_decoder_t *decoder)
+{
+    decoder->active = true;
+    decoder->escaped = false;
+    decoder->token = STREAM_NO_TOKEN;
+    decoder->operand_index = 0;
+    decoder->value = 0;
+    decoder->shift = 0;
+    decoder->last_dx = decoder->last_dy = 0;
+
+    // Relative movements continue from wherever the queued movements will leave us
+    stream_sync_position(decoder);
+}
+
+bool stream_decoder_feed(stream_decoder_t *decoder, uint8_t byte)
+{
+    if (!decoder->active)
+        return false;
+
+    // Restore an escaped byte
+    if (decoder->escaped)
+    {
+        byte ^= STREAM_ESCAPE_XOR;
+        decoder->escaped = false;
+    }
+    else if (byte == STREAM_ESCAPE)
+    {
+        decoder->escaped = true;
+        return true;
+    }
+
+    // Waiting for a Token
+    if (decoder->token == STREAM_NO_TOKEN)
+    {
+        uint8_t operand_count = stream_operand_count(byte);
+
+        // End of the stream or an unknown token (We can't tell where the next token starts so stop)
+        if (byte == STREAM_TOKEN_END || operand_count == STREAM_NO_TOKEN)
+        {
+            decoder->active = false;
+            return false;
+        }
+
+        decoder->token = byte;
+        decoder->operand_index = 0;
+        decoder->value = 0;
+        decoder->shift = 0;
+        return true;
+    }
+
+    // More than 32 bits (The fifth byte only has room for 4). Invalid rather than losing the top bits
+    if (decoder->shift == 28 && (byte & 0xF0))
+    {
+        decoder->active = false;
+        return false;
+    }
+
+    // Receive the Operand 7 bits at a time
+    decoder->value |= (uint32_t)(byte & 0x7F) << decoder->shift;
+    decoder->shift += 7;
+    if (byte & 0x80)
+        return true;
+
+    // Too many repeats for one token. Invalid rather than queuing them all
+    if (decoder->token == STREAM_TOKEN_REPEAT && decoder->value > STREAM_MAX_REPEAT)
+    {
+        decoder->active = false;
+        return false;
+    }
+
+    decoder->operands[decoder->operand_index++] = decoder->value;
+    decoder->value = 0;
+    decoder->shift = 0;
+
+    // Run the token once all its operands are received. A movement that was refused leaves the rest of the stream
+    // going from the wrong place so it is invalid
+    if (decoder->operand_index == stream_operand_count(decoder->token))
+    {
+        bool queued = stream_execute(decoder);
+        decoder->token = STREAM_NO_TOKEN;
+        if (!queued)
+        {
+            decoder->active = false;
+            return false;
+        }
+    }
+    return true;
+}
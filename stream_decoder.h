@@ -0,0 +1,62 @@
+#ifndef STREAM_DECODER_H
+#define STREAM_DECODER_H
+
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+// Streaming Decoder for the Compact Job Encoding (Encoded by feed_serial/encoding.js)
+// Bytes are fed in one at a time as they arrive and every decoded movement is sent to wcs_go_to_position (Work coordinates)
+// or straight onto the step queue when it has already been planned by the host
+
+// Byte that switches the Automated Draw menu from text coordinates to the compact stream
+#define STREAM_START            0x02
+
+// Tokens. Followed by their operands as varints (7 bits per byte, high bit set when more bytes follow. At most 32 bits
+// and a longer operand makes the stream invalid)
+#define STREAM_TOKEN_END        0x00 // Back to text coordinates
+#define STREAM_TOKEN_PEN_UP     0x01 // Absolute Z
+#define STREAM_TOKEN_PEN_DOWN   0x02 // Absolute Z
+#define STREAM_TOKEN_MOVE       0x03 // Relative X & Y (zig-zag encoded)
+#define STREAM_TOKEN_REPEAT     0x04 // Repeat the last MOVE n more times (At most STREAM_MAX_REPEAT)
+#define STREAM_TOKEN_MOVE_TO    0x05 // Absolute X & Y
+#define STREAM_TOKEN_SEGMENT    0x06 // Planned segment (compiler.js): Dir mask | Mode mask << 3 | Flags << 6, X, Y & Z steps, Step delay (us)
+
+// Amount of units in a single step (Positions are sent in 1/32 steps)
+#define STREAM_UNITS_PER_STEP   32
+
+#define STREAM_MAX_OPERANDS     5
+
+// Most movements a single REPEAT queues (Same as MAX_REPEAT in encoding.js). The repeats are queued from the UART interrupt
+// so a larger count (eg. a corrupt byte) makes the stream invalid rather than holding it up and filling the heap
+#define STREAM_MAX_REPEAT       127
+
+// Bytes of the stream that would be taken as real-time commands (and this byte) are sent as
+// STREAM_ESCAPE followed by the byte XOR STREAM_ESCAPE_XOR so a stream can never pause or abort the machine
+#define STREAM_ESCAPE           0x7D
+#define STREAM_ESCAPE_XOR       0x20
+
+typedef struct {
+    // Is the decoder currently receiving a stream
+    bool active;
+    // Was the last byte STREAM_ESCAPE
+    bool escaped;
+    // The token whose operands are being received (0xFF when waiting for a token)
+    uint8_t token;
+    // The operands received so far for the token
+    uint32_t operands[STREAM_MAX_OPERANDS];
+    uint8_t operand_index;
+    // The varint currently being received
+    uint32_t value;
+    uint8_t shift;
+    // The position (in units) the last movement went to
+    int32_t x, y, z;
+    // The last relative movement so it can be repeated
+    int32_t last_dx, last_dy;
+} stream_decoder_t;
+
+// Start decoding a stream from the current pending position
+void stream_decoder_start(stream_decoder_t *decoder);
+// Feed the next byte of the stream. Returns false once the stream has ended (or was invalid, or a movement of it was refused)
+bool stream_decoder_feed(stream_decoder_t *decoder, uint8_t byte);
+
+#endif // STREAM_DECODER_H
@@ -0,0 +1,109 @@
+#include "telemetry.h"
+#include "pico.h"
+#include "jobs.h"
+#include "stream_decoder.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+_Static_assert(sizeof(telemetry_frame_t) == TELEMETRY_FRAME_SIZE, "The host reads frames of exactly TELEMETRY_FRAME_SIZE bytes");
+
+static repeating_timer_t telemetry_timer;
+static uint32_t telemetry_rate_hz;
+// Set by the timer, cleared once the frame has been sent
+static volatile bool telemetry_due;
+
+static bool telemetry_timer_callback(repeating_timer_t *timer)
+{
+    telemetry_due = true;
+    return true;
+}
+
+// Fletcher-16 of a block of bytes
+static uint16_t telemetry_checksum(const uint8_t *bytes, size_t length)
+{
+    uint16_t sum_0 = 0, sum_1 = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        sum_0 = (sum_0 + bytes[i]) % 255;
+        sum_1 = (sum_1 + sum_0) % 255;
+    }
+    return (uint16_t)((sum_1 << 8) | sum_0);
+}
+
+// A location core 1 is changing in units of 1/32 step. A double takes two reads on core 0
+// so read it again until it is the same twice in a row (It can't have been read half way through a change)
+static int32_t telemetry_read_location(const volatile double *location)
+{
+    double value;
+    do
+    {
+        value = *location;
+    } while(value != *location);
+    return (int32_t)lround(value * STREAM_UNITS_PER_STEP);
+}
+
+bool telemetry_set_rate(uint32_t rate_hz)
+{
+    if(rate_hz > TELEMETRY_MAX_RATE_HZ)
+        return false;
+
+    if(telemetry_rate_hz)
+        cancel_repeating_timer(&telemetry_timer);
+    telemetry_rate_hz = rate_hz;
+    telemetry_due = false;
+
+    // A negative delay keeps the rate fixed however long the callback takes
+    if(rate_hz && !add_repeating_timer_us(-(int64_t)(1000000 / rate_hz), telemetry_timer_callback, NULL, &telemetry_timer))
+    {
+        telemetry_rate_hz = 0;
+        return false;
+    }
+    return true;
+}
+
+uint32_t telemetry_rate(void)
+{
+    return telemetry_rate_hz;
+}
+
+void telemetry_service(void)
+{
+    if(!telemetry_due)
+        return;
+    telemetry_due = false;
+
+    telemetry_frame_t frame;
+    memset(&frame, 0, sizeof(telemetry_frame_t));
+    frame.sync[0] = TELEMETRY_SYNC_0;
+    frame.sync[1] = TELEMETRY_SYNC_1;
+    frame.version = TELEMETRY_VERSION;
+
+    bool moving = pico_state.step_queue.processing || pico_state.step_queue.length;
+    frame.flags =
+        (moving ? TELEMETRY_FLAG_MOVING : 0) |
+        (pico_state.feed_hold ? TELEMETRY_FLAG_HOLD : 0) |
+        (pico_state.aborting ? TELEMETRY_FLAG_ABORTING : 0) |
+        (pico_state.spindle_enabled ? TELEMETRY_FLAG_SPINDLE : 0) |
+        (pico_state.jogging ? TELEMETRY_FLAG_JOGGING : 0) |
+        (job_is_replaying() ? TELEMETRY_FLAG_REPLAYING : 0) |
+        (job_is_recording() ? TELEMETRY_FLAG_RECORDING : 0) |
+        (pico_state.drv_enabled ? TELEMETRY_FLAG_DRIVERS : 0);
+    frame.time_ms = (uint32_t)(time_us_64() / 1000);
+
+    frame.x = telemetry_read_location(&pico_state.drv_location[X]);
+    frame.y = telemetry_read_location(&pico_state.drv_location[Y]);
+    frame.z = telemetry_read_location(&pico_state.drv_location[Z]);
+
+    frame.queue_length = pico_state.step_queue.length > 0xFFFF ? 0xFFFF : (uint16_t)pico_state.step_queue.length;
+    frame.feed_override = pico_state.feed_override;
+    frame.sequence_active = pico_state.sequence_active;
+    frame.sequence_done = pico_state.sequence_done;
+    frame.sequence_queued = pico_state.sequence;
+    frame.checksum = telemetry_checksum((const uint8_t *)&frame, offsetof(telemetry_frame_t, checksum));
+
+    // Raw so stdio doesn't turn a 0x0A byte into CR LF
+    const uint8_t *bytes = (const uint8_t *)&frame;
+    for(size_t i = 0; i < sizeof(telemetry_frame_t); i++)
+        putchar_raw(bytes[i]);
+}
@@ -0,0 +1,59 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+// Binary Telemetry
+// While it is on ($telemetry=<hz>;) a small fixed size frame with the live state of the machine is sent at a fixed rate
+// so the host can follow the job as it runs. A repeating timer only marks a frame as due, the main loop on core 0 sends
+// it so core 1 never waits on the UART. Frames are mixed in with the text replies, the host finds them by the sync bytes
+// and drops any that fail the checksum (eg. a reply that was printed part way through one)
+
+#define TELEMETRY_SYNC_0        0xA5
+#define TELEMETRY_SYNC_1        0x5A
+#define TELEMETRY_VERSION       1
+// Bytes in a frame (telemetry_frame_t). The host reads frames of exactly this size
+#define TELEMETRY_FRAME_SIZE    38
+// Fastest rate in frames per second (A frame takes about 3.3ms to send at 115200 baud)
+#define TELEMETRY_MAX_RATE_HZ   50
+
+// State Flags
+#define TELEMETRY_FLAG_MOVING       (1 << 0)
+#define TELEMETRY_FLAG_HOLD         (1 << 1)
+#define TELEMETRY_FLAG_ABORTING     (1 << 2)
+#define TELEMETRY_FLAG_SPINDLE      (1 << 3)
+#define TELEMETRY_FLAG_JOGGING      (1 << 4)
+#define TELEMETRY_FLAG_REPLAYING    (1 << 5)
+#define TELEMETRY_FLAG_RECORDING    (1 << 6)
+#define TELEMETRY_FLAG_DRIVERS      (1 << 7)
+
+// Sent as it is laid out in memory (Little Endian)
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];
+    uint8_t version;
+    // TELEMETRY_FLAG_ bits
+    uint8_t flags;
+    // Milliseconds since startup (Wraps)
+    uint32_t time_ms;
+    // Where the axes are in units of 1/32 step (STREAM_UNITS_PER_STEP)
+    int32_t x, y, z;
+    // Nodes waiting in the step queue
+    uint16_t queue_length;
+    // Percent
+    uint16_t feed_override;
+    // Sequence numbers (checkpoint.h) of the movement being stepped (0 when there isn't a numbered one),
+    // the last one that finished and the last one that was queued
+    uint32_t sequence_active, sequence_done, sequence_queued;
+    // Fletcher-16 of everything before it
+    uint16_t checksum;
+} telemetry_frame_t;
+
+// Send frames at a rate (in frames per second). 0 turns them off. Returns false if the rate is too high
+bool telemetry_set_rate(uint32_t rate_hz);
+// Frames per second or 0 if they are off
+uint32_t telemetry_rate(void);
+// Send a frame if one is due (Called from the main loop)
+void telemetry_service(void);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,111 @@
+#include "wcs.h"
+#include "pico.h"
+#include "stream_decoder.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WCS_PI 3.14159265358979323846
+
+// The values as they were set
+static double wcs_offset_steps[3], wcs_scale = 1, wcs_rotation;
+
+// Fixed Point Transform. Offset in units and scale * cos / sin of the rotation with WCS_FRACTION_BITS fraction bits
+static int32_t wcs_offset[3];
+static int32_t wcs_cos = 1 << WCS_FRACTION_BITS, wcs_sin;
+
+// Work out the fixed point transform from the values
+static void wcs_update(void)
+{
+    for(uint8_t axis = 0; axis < 3; axis++)
+        wcs_offset[axis] = (int32_t)lround(wcs_offset_steps[axis] * STREAM_UNITS_PER_STEP);
+
+    double radians = wcs_rotation * WCS_PI / 180;
+    wcs_cos = (int32_t)lround(wcs_scale * cos(radians) * (1 << WCS_FRACTION_BITS));
+    wcs_sin = (int32_t)lround(wcs_scale * sin(radians) * (1 << WCS_FRACTION_BITS));
+}
+
+// Drop the fraction bits, rounding to the nearest unit
+static int64_t wcs_round(int64_t value)
+{
+    return (value + (1 << (WCS_FRACTION_BITS - 1))) >> WCS_FRACTION_BITS;
+}
+
+void wcs_reset(void)
+{
+    memset(wcs_offset_steps, 0, sizeof(wcs_offset_steps));
+    wcs_scale = 1;
+    wcs_rotation = 0;
+    wcs_update();
+}
+
+bool wcs_set(const char *name, double value)
+{
+    if(!isfinite(value))
+        return false;
+
+    if(!strcmp(name, "x") || !strcmp(name, "y") || !strcmp(name, "z"))
+    {
+        if(fabs(value) > WCS_MAX_OFFSET)
+            return false;
+        wcs_offset_steps[name[0] - 'x'] = value;
+    }
+    else if(!strcmp(name, "scale"))
+    {
+        if(value <= 0 || value > WCS_MAX_SCALE)
+            return false;
+        wcs_scale = value;
+    }
+    else if(!strcmp(name, "rotation"))
+        wcs_rotation = fmod(value, 360);
+    else
+        return false;
+
+    wcs_update();
+    return true;
+}
+
+void wcs_print(void)
+{
+    printf("$wcs_x=%g\n$wcs_y=%g\n$wcs_z=%g\n", wcs_offset_steps[X], wcs_offset_steps[Y], wcs_offset_steps[Z]);
+    printf("$wcs_scale=%g\n$wcs_rotation=%g\n", wcs_scale, wcs_rotation);
+}
+
+// Where a position in work coordinates is on the bed in steps
+static void wcs_to_machine(int32_t x, int32_t y, int32_t z, double position[3])
+{
+    // Scale & rotate about the work origin then offset onto the bed. Whole units so the position is always a multiple of 1/32 step
+    int64_t bed_x = wcs_round((int64_t)wcs_cos * x - (int64_t)wcs_sin * y) + wcs_offset[X];
+    int64_t bed_y = wcs_round((int64_t)wcs_sin * x + (int64_t)wcs_cos * y) + wcs_offset[Y];
+    int64_t bed_z = (int64_t)z + wcs_offset[Z];
+
+    position[X] = (double)bed_x / STREAM_UNITS_PER_STEP;
+    position[Y] = (double)bed_y / STREAM_UNITS_PER_STEP;
+    position[Z] = (double)bed_z / STREAM_UNITS_PER_STEP;
+}
+
+bool wcs_go_to_position(int32_t x, int32_t y, int32_t z)
+{
+    double position[3];
+    wcs_to_machine(x, y, z, position);
+    return drv_go_to_position(position[X], position[Y], position[Z]);
+}
+
+bool wcs_go_to_axes(const int32_t units[DRV_AXIS_COUNT])
+{
+    double position[DRV_AXIS_COUNT];
+    wcs_to_machine(units[X], units[Y], units[Z], position);
+    for(uint8_t axis = Z + 1; axis < DRV_AXIS_COUNT; axis++)
+        position[axis] = (double)units[axis] / STREAM_UNITS_PER_STEP;
+    return drv_go_to_axes(position);
+}
+
+void wcs_from_machine(double x, double y, double z, int32_t units[3])
+{
+    // Only needed now and then (eg. starting a stream) so it is worked out with doubles from the fixed point matrix
+    double dx = x * STREAM_UNITS_PER_STEP - wcs_offset[X], dy = y * STREAM_UNITS_PER_STEP - wcs_offset[Y];
+    double c = wcs_cos, s = wcs_sin, determinant = (c * c + s * s) / (1 << WCS_FRACTION_BITS);
+    units[X] = (int32_t)lround((c * dx + s * dy) / determinant);
+    units[Y] = (int32_t)lround((c * dy - s * dx) / determinant);
+    units[Z] = (int32_t)lround(z * STREAM_UNITS_PER_STEP - wcs_offset[Z]);
+}
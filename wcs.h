@@ -0,0 +1,39 @@
+#ifndef WCS_H
+#define WCS_H
+
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "queue.h"
+
+// Work Coordinates
+// Positions from the host (text coordinates and the compact stream) are in work coordinates. They are scaled and rotated
+// about the work origin then offset onto the bed before drv_go_to_position clamps them to the travel limits, so one
+// normalised job can be placed, resized or repeated on the bed without the host processing it again.
+// Planned segments (compiled streams and stored jobs) are already in machine steps so they aren't transformed
+
+// Positions are transformed in units of 1/32 step (STREAM_UNITS_PER_STEP) with the scale & rotation in fixed point
+// with this many fraction bits, so every transformed position lands on a step the drivers can take
+#define WCS_FRACTION_BITS   16
+// Largest scale (Keeps the fixed point matrix well inside 32 bits)
+#define WCS_MAX_SCALE       1024
+// Largest offset from the machine origin in steps
+#define WCS_MAX_OFFSET      (1 << 20)
+
+// Go back to the machine coordinates (No offset, scale or rotation)
+void wcs_reset(void);
+// Set a value of the transform by name: x, y & z (Where the work origin is on the bed in steps), scale (1 is unchanged)
+// or rotation (Anticlockwise degrees). Only X & Y are scaled and rotated. Returns false for an unknown name or a value out of range
+bool wcs_set(const char *name, double value);
+// Print every value of the transform as $wcs_name=value lines
+void wcs_print(void);
+
+// Queue a movement to a position in work coordinates (in units of 1/32 step). The axes after Z stay where they are.
+// Returns false if it was refused (see drv_go_to_axes)
+bool wcs_go_to_position(int32_t x, int32_t y, int32_t z);
+// Queue a movement of every axis (in units of 1/32 step). X, Y & Z are in work coordinates,
+// the axes after them (eg. the rotary axis) aren't transformed
+bool wcs_go_to_axes(const int32_t units[DRV_AXIS_COUNT]);
+// The work coordinates (in units of 1/32 step) of a position on the bed in steps. The inverse of the transform
+void wcs_from_machine(double x, double y, double z, int32_t units[3]);
+
+#endif // WCS_H